@@ -1,284 +1,561 @@
-#include <openssl/aes.h>
-#include <openssl/pem.h>
-#include <openssl/evp.h>
-#include <openssl/err.h>
-#include <cstring>
-
-void handleErrors(void)
-{
-    ERR_print_errors_fp(stderr);
-    abort();
-}
-
-int encrypt(std::vector<unsigned char>& plaintext, int plaintext_len, unsigned char *key,
-            unsigned char *iv, std::vector<unsigned char>& ciphertext)
-{
-    int k_len = strlen((const char*)key), plaintext_length = static_cast<int>(plaintext.size());
-
-    EVP_CIPHER_CTX *en;
-    en = EVP_CIPHER_CTX_new();
-
-    /* Create and initialise the context */
-    EVP_CIPHER_CTX_init(en);
-
-    /*
-     * Initialise the encryption operation. IMPORTANT - ensure you use a key
-     * and IV size appropriate for your cipher
-     * In this example, we are using 256-bit AES (i.e., a 256-bit key). The
-     * IV size for *most* modes is the same as the block size. For AES, this
-     * is 128 bits
-     */
-    if (1 != EVP_EncryptInit_ex(en, EVP_aes_256_cbc(), NULL, key, iv)) {
-        fprintf(stderr, "Error: EVP_EncryptInit_ex() failed.\n");
-        EVP_CIPHER_CTX_free(en);
-        return -1; // Return an error code
-    }
-
-    int c_len = plaintext_length + AES_BLOCK_SIZE, f_len = 0;
-    ciphertext.resize(c_len);
-
-    /*
-     * Provide the message to be encrypted, and obtain the encrypted output.
-     * EVP_EncryptUpdate can be called multiple times if necessary
-     */
-    if (1 != EVP_EncryptUpdate(en, ciphertext.data(), &c_len, plaintext.data(), plaintext_len)) {
-        fprintf(stderr, "Error: EVP_EncryptUpdate() failed.\n");
-        EVP_CIPHER_CTX_free(en);
-        return -1; // Return an error code
-    }
-
-    /*
-     * Finalise the encryption. Further ciphertext bytes may be written at
-     * this stage.
-     */
-    if (1 != EVP_EncryptFinal_ex(en, ciphertext.data() + c_len, &f_len)) {
-        fprintf(stderr, "Error: EVP_EncryptFinal_ex() failed.\n");
-        EVP_CIPHER_CTX_free(en);
-        return -1; // Return an error code
-    }
-
-    ciphertext.erase(ciphertext.begin() + c_len + f_len, ciphertext.end());
-
-    /* Clean up */
-    EVP_CIPHER_CTX_free(en);
-
-    return f_len;
-}
-
-int decrypt(std::vector<unsigned char>& ciphertext, int ciphertext_len, unsigned char *key,
-            unsigned char *iv, std::vector<unsigned char>& plaintext)
-{
-    EVP_CIPHER_CTX *ctx;
-    int k_len = strlen((const char *)key);
-    int p_len = static_cast<int>(plaintext.size()), f_len = 0;
-
-    if (!(ctx = EVP_CIPHER_CTX_new())) {
-        handleErrors();
-    }
-
-    EVP_CIPHER_CTX_init(ctx);
-
-    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) {
-        handleErrors();
-    }
-
-    if (1 != EVP_DecryptUpdate(ctx, plaintext.data(), &p_len, ciphertext.data(), p_len)) {
-        handleErrors();
-    }
-
-    if (1 != EVP_DecryptFinal_ex(ctx, plaintext.data() + p_len, &f_len)) {
-        // Print error and details if decryption fails
-        ERR_print_errors_fp(stderr);
-        EVP_CIPHER_CTX_free(ctx);
-        return -1; // Indicate decryption failure
-    }
-
-    EVP_CIPHER_CTX_free(ctx);
-
-    return f_len;
-}
-
-int encrypt_seed(unsigned char *plaintext, int plaintext_len, unsigned char *key,
-            unsigned char *iv, unsigned char *ciphertext)
-{
-    EVP_CIPHER_CTX *ctx;
-
-    int len;
-
-    int ciphertext_len;
-
-    /* Create and initialise the context */
-    if(!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
-
-    /*
-     * Initialise the encryption operation. IMPORTANT - ensure you use a key
-     * and IV size appropriate for your cipher
-     * In this example we are using 256 bit AES (i.e. a 256 bit key). The
-     * IV size for *most* modes is the same as the block size. For AES this
-     * is 128 bits
-     */
-    if(1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
-        handleErrors();
-
-    /*
-     * Provide the message to be encrypted, and obtain the encrypted output.
-     * EVP_EncryptUpdate can be called multiple times if necessary
-     */
-    if(1 != EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len))
-        handleErrors();
-    ciphertext_len = len;
-
-    /*
-     * Finalise the encryption. Further ciphertext bytes may be written at
-     * this stage.
-     */
-    if(1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len))
-        handleErrors();
-    ciphertext_len += len;
-
-    /* Clean up */
-    EVP_CIPHER_CTX_free(ctx);
-
-    return ciphertext_len;
-}
-
-int decrypt_seed(unsigned char *ciphertext, int ciphertext_len, unsigned char *key,
-            unsigned char *iv, unsigned char *plaintext)
-{
-    EVP_CIPHER_CTX *ctx;
-
-    int len;
-
-    int plaintext_len;
-
-    /* Create and initialise the context */
-    if(!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
-
-    /*
-     * Initialise the decryption operation. IMPORTANT - ensure you use a key
-     * and IV size appropriate for your cipher
-     * In this example we are using 256 bit AES (i.e. a 256 bit key). The
-     * IV size for *most* modes is the same as the block size. For AES this
-     * is 128 bits
-     */
-    if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
-        handleErrors();
-
-    /*
-     * Provide the message to be decrypted, and obtain the plaintext output.
-     * EVP_DecryptUpdate can be called multiple times if necessary.
-     */
-    if(1 != EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len))
-        handleErrors();
-    plaintext_len = len;
-
-    /*
-     * Finalise the decryption. Further plaintext bytes may be written at
-     * this stage.
-     */
-    if(1 != EVP_DecryptFinal_ex(ctx, plaintext + len, &len))
-        handleErrors();
-    plaintext_len += len;
-
-    /* Clean up */
-    EVP_CIPHER_CTX_free(ctx);
-
-    return plaintext_len;
-}
-
-EVP_PKEY* loadEcdhKey(const std::string& keyPath, bool isPrivate) {
-    FILE* keyFile = fopen(keyPath.c_str(), "r");
-    if (!keyFile) {
-        throw std::runtime_error("Unable to open key file.");
-    }
-
-    EVP_PKEY* key = nullptr;
-    if (isPrivate) {
-        key = PEM_read_PrivateKey(keyFile, NULL, NULL, NULL);
-    } else {
-        key = PEM_read_PUBKEY(keyFile, NULL, NULL, NULL);
-    }
-    fclose(keyFile);
-    if (!key) {
-        throw std::runtime_error("Unable to load key.");
-    }
-
-    return key;
-}
-
-std::vector<unsigned char> computeSharedSecret(const std::string& privateKeyPath, const std::string& publicKeyPath) {
-    EVP_PKEY *privateKey = loadEcdhKey(privateKeyPath, true);
-    EVP_PKEY *publicKey = loadEcdhKey(publicKeyPath, false);
-
-    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(privateKey, NULL);
-    if (!ctx) {
-        ERR_print_errors_fp(stderr);
-        throw std::runtime_error("Failed to create EVP_PKEY_CTX.");
-    }
-
-    if (EVP_PKEY_derive_init(ctx) <= 0) {
-        ERR_print_errors_fp(stderr);
-        throw std::runtime_error("Failed to initialize derivation.");
-    }
-
-    if (EVP_PKEY_derive_set_peer(ctx, publicKey) <= 0) {
-        ERR_print_errors_fp(stderr);
-        throw std::runtime_error("Failed to set peer key.");
-    }
-
-    size_t secretLen = 0;
-    if (EVP_PKEY_derive(ctx, NULL, &secretLen) <= 0) {
-        ERR_print_errors_fp(stderr);
-        throw std::runtime_error("Failed to determine shared secret length.");
-    }
-
-    std::vector<unsigned char> secret(secretLen);
-    if (EVP_PKEY_derive(ctx, secret.data(), &secretLen) <= 0) {
-        ERR_print_errors_fp(stderr);
-        throw std::runtime_error("Failed to derive shared secret.");
-    }
-
-    EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_free(privateKey);
-    EVP_PKEY_free(publicKey);
-
-    return secret;
-}
-
-void deriveAesKeyAndIv(const std::vector<unsigned char>& sharedSecret, unsigned char* aesKey, unsigned char* iv) {
-    const size_t AES_KEY_SIZE = 32; // AES-256 key size
-    const size_t IV_SIZE = 16;      // AES block size for IV
-    const unsigned char* salt = reinterpret_cast<const unsigned char*>("salt"); // Use a secure random salt in practice
-    const int iterations = 10000; // Number of PBKDF2 iterations
-
-    // Derive AES key using PBKDF2 with HMAC-SHA256
-    if (!PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(sharedSecret.data()), sharedSecret.size(),
-                           salt, strlen(reinterpret_cast<const char*>(salt)), iterations,
-                           EVP_sha256(), AES_KEY_SIZE, aesKey)) {
-        throw std::runtime_error("PBKDF2 key derivation with HMAC-SHA256 failed.");
-    }
-
-    // Derive IV using PBKDF2 with HMAC-SHA256
-    if (!PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(sharedSecret.data()), sharedSecret.size(),
-                           salt, strlen(reinterpret_cast<const char*>(salt)), iterations,
-                           EVP_sha256(), IV_SIZE, iv)) {
-        throw std::runtime_error("PBKDF2 IV derivation with HMAC-SHA256 failed.");
-    }
-
-    // Optional: Debugging output (uncomment for debugging)
-    /*
-    std::cout << "Derived AES Key: ";
-    for (size_t i = 0; i < AES_KEY_SIZE; ++i) {
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(aesKey[i]);
-    }
-    std::cout << std::dec << std::endl;
-
-    std::cout << "Derived IV: ";
-    for (size_t i = 0; i < IV_SIZE; ++i) {
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(iv[i]);
-    }
-    std::cout << std::dec << std::endl;
-    */
-}
\ No newline at end of file
+#include <openssl/aes.h>
+#include <openssl/pem.h>
+#include <openssl/evp.h>
+#include <openssl/err.h>
+#include <openssl/rand.h>
+#include <cstring>
+#include <functional>
+
+void handleErrors(void)
+{
+    ERR_print_errors_fp(stderr);
+    abort();
+}
+
+// EVP lengths are int, buffers past INT_MAX go through in EVP_CHUNK_SIZE pieces
+const size_t EVP_CHUNK_SIZE = size_t(1) << 30;
+
+int encrypt(std::vector<unsigned char>& plaintext, size_t plaintext_len, unsigned char *key,
+            unsigned char *iv, std::vector<unsigned char>& ciphertext)
+{
+    size_t plaintext_length = plaintext.size();
+
+    EVP_CIPHER_CTX *en;
+    en = EVP_CIPHER_CTX_new();
+
+    /* Create and initialise the context */
+    EVP_CIPHER_CTX_init(en);
+
+    /*
+     * Initialise the encryption operation. IMPORTANT - ensure you use a key
+     * and IV size appropriate for your cipher
+     * In this example, we are using 256-bit AES (i.e., a 256-bit key). The
+     * IV size for *most* modes is the same as the block size. For AES, this
+     * is 128 bits
+     */
+    if (1 != EVP_EncryptInit_ex(en, EVP_aes_256_cbc(), NULL, key, iv)) {
+        fprintf(stderr, "Error: EVP_EncryptInit_ex() failed.\n");
+        EVP_CIPHER_CTX_free(en);
+        return -1; // Return an error code
+    }
+
+    size_t c_len = 0;
+    int len = 0, f_len = 0;
+    ciphertext.resize(plaintext_length + AES_BLOCK_SIZE);
+
+    /*
+     * Provide the message to be encrypted, and obtain the encrypted output.
+     * EVP_EncryptUpdate can be called multiple times if necessary
+     */
+    for (size_t offset = 0; offset < plaintext_len; offset += EVP_CHUNK_SIZE) {
+        size_t n = std::min(EVP_CHUNK_SIZE, plaintext_len - offset);
+        if (1 != EVP_EncryptUpdate(en, ciphertext.data() + c_len, &len, plaintext.data() + offset, static_cast<int>(n))) {
+            fprintf(stderr, "Error: EVP_EncryptUpdate() failed.\n");
+            EVP_CIPHER_CTX_free(en);
+            return -1; // Return an error code
+        }
+        c_len += len;
+    }
+
+    /*
+     * Finalise the encryption. Further ciphertext bytes may be written at
+     * this stage.
+     */
+    if (1 != EVP_EncryptFinal_ex(en, ciphertext.data() + c_len, &f_len)) {
+        fprintf(stderr, "Error: EVP_EncryptFinal_ex() failed.\n");
+        EVP_CIPHER_CTX_free(en);
+        return -1; // Return an error code
+    }
+
+    ciphertext.erase(ciphertext.begin() + c_len + f_len, ciphertext.end());
+
+    /* Clean up */
+    EVP_CIPHER_CTX_free(en);
+
+    return f_len;
+}
+
+int decrypt(std::vector<unsigned char>& ciphertext, size_t ciphertext_len, unsigned char *key,
+            unsigned char *iv, std::vector<unsigned char>& plaintext)
+{
+    EVP_CIPHER_CTX *ctx;
+    size_t p_len = 0;
+    int len = 0, f_len = 0;
+
+    if (!(ctx = EVP_CIPHER_CTX_new())) {
+        handleErrors();
+    }
+
+    EVP_CIPHER_CTX_init(ctx);
+
+    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) {
+        handleErrors();
+    }
+
+    for (size_t offset = 0; offset < ciphertext_len; offset += EVP_CHUNK_SIZE) {
+        size_t n = std::min(EVP_CHUNK_SIZE, ciphertext_len - offset);
+        if (1 != EVP_DecryptUpdate(ctx, plaintext.data() + p_len, &len, ciphertext.data() + offset, static_cast<int>(n))) {
+            handleErrors();
+        }
+        p_len += len;
+    }
+
+    if (1 != EVP_DecryptFinal_ex(ctx, plaintext.data() + p_len, &f_len)) {
+        // Print error and details if decryption fails
+        ERR_print_errors_fp(stderr);
+        EVP_CIPHER_CTX_free(ctx);
+        return -1; // Indicate decryption failure
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return f_len;
+}
+
+// Encrypt every chunk next() hands out, the plaintext is never held in full.
+// Returns the number of plaintext bytes read.
+template <typename NextChunk>
+long long encryptChunks(NextChunk&& next, unsigned char *key, unsigned char *iv, std::vector<unsigned char>& ciphertext)
+{
+    RSTEG_TRACE_SCOPE("encrypt");
+    EVP_CIPHER_CTX *ctx;
+    if (!(ctx = EVP_CIPHER_CTX_new())) {
+        handleErrors();
+    }
+
+    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) {
+        fprintf(stderr, "Error: EVP_EncryptInit_ex() failed.\n");
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+
+    long long plaintextBytes = 0;
+    const unsigned char* chunk;
+    size_t bytesRead;
+    int len = 0;
+    ciphertext.clear();
+    while (next(chunk, bytesRead)) {
+        size_t offset = ciphertext.size();
+        ciphertext.resize(offset + bytesRead + AES_BLOCK_SIZE);
+        if (1 != EVP_EncryptUpdate(ctx, ciphertext.data() + offset, &len, chunk, static_cast<int>(bytesRead))) {
+            fprintf(stderr, "Error: EVP_EncryptUpdate() failed.\n");
+            EVP_CIPHER_CTX_free(ctx);
+            return -1;
+        }
+        ciphertext.resize(offset + len);
+        plaintextBytes += bytesRead;
+    }
+
+    size_t offset = ciphertext.size();
+    ciphertext.resize(offset + AES_BLOCK_SIZE);
+    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext.data() + offset, &len)) {
+        fprintf(stderr, "Error: EVP_EncryptFinal_ex() failed.\n");
+        EVP_CIPHER_CTX_free(ctx);
+        return -1;
+    }
+    ciphertext.resize(offset + len);
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return plaintextBytes;
+}
+
+// pipes and stdin, read in STREAM_CHUNK_SIZE pieces
+long long encryptStream(FILE* input, unsigned char *key, unsigned char *iv, std::vector<unsigned char>& ciphertext)
+{
+    std::vector<unsigned char> buffer(STREAM_CHUNK_SIZE);
+    return encryptChunks([&](const unsigned char*& chunk, size_t& length) {
+        length = fread(buffer.data(), 1, buffer.size(), input);
+        chunk = buffer.data();
+        return length > 0;
+    }, key, iv, ciphertext);
+}
+
+// regular files are read ahead asynchronously while the previous chunk is encrypted,
+// "-" and anything that is not a regular file are read through stdio. digest, when
+// given, receives the SHA-256 of the plaintext (enc --verify compares against it)
+long long encryptFile(const std::string& path, unsigned char *key, unsigned char *iv, std::vector<unsigned char>& ciphertext,
+                      unsigned char* digest = nullptr)
+{
+    AsyncReader reader;
+    FILE* input = nullptr;
+    std::vector<unsigned char> buffer;
+    if (path == "-" || !reader.open(path)) {
+        if (!(input = openPayloadStream(path, false))) {
+            return -1;
+        }
+        buffer.resize(STREAM_CHUNK_SIZE);
+    } else {
+        ciphertext.reserve(reader.size() + AES_BLOCK_SIZE);
+    }
+
+    EVP_MD_CTX* md = nullptr;
+    if (digest) {
+        md = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    }
+    long long plaintextBytes = encryptChunks([&](const unsigned char*& chunk, size_t& length) {
+        bool more;
+        if (input) {
+            length = fread(buffer.data(), 1, buffer.size(), input);
+            chunk = buffer.data();
+            more = length > 0;
+        } else {
+            more = reader.next(chunk, length);
+        }
+        if (more && md) {
+            EVP_DigestUpdate(md, chunk, length);
+        }
+        return more;
+    }, key, iv, ciphertext);
+
+    if (input) {
+        closePayloadStream(input);
+    }
+    if (md) {
+        EVP_DigestFinal_ex(md, digest, NULL);
+        EVP_MD_CTX_free(md);
+    }
+    return reader.failed() ? -1 : plaintextBytes;
+}
+
+// Decrypt in STREAM_CHUNK_SIZE pieces and hand every plaintext chunk to sink,
+// so the output can be written (or piped) while decryption is still running.
+// Without padding the final block is passed through unchecked (used for recovery).
+bool decryptStream(const std::vector<unsigned char>& ciphertext, unsigned char *key, unsigned char *iv,
+            const std::function<bool(const unsigned char*, size_t)>& sink, bool padding = true)
+{
+    RSTEG_TRACE_SCOPE("decrypt");
+    EVP_CIPHER_CTX *ctx;
+    if (!(ctx = EVP_CIPHER_CTX_new())) {
+        handleErrors();
+    }
+
+    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) {
+        handleErrors();
+    }
+    EVP_CIPHER_CTX_set_padding(ctx, padding ? 1 : 0);
+
+    std::vector<unsigned char> chunk(STREAM_CHUNK_SIZE + AES_BLOCK_SIZE);
+    int len = 0;
+    for (size_t offset = 0; offset < ciphertext.size(); offset += STREAM_CHUNK_SIZE) {
+        size_t n = std::min(STREAM_CHUNK_SIZE, ciphertext.size() - offset);
+        if (1 != EVP_DecryptUpdate(ctx, chunk.data(), &len, ciphertext.data() + offset, static_cast<int>(n))) {
+            handleErrors();
+        }
+        if (len > 0 && !sink(chunk.data(), len)) {
+            EVP_CIPHER_CTX_free(ctx);
+            return false;
+        }
+    }
+
+    if (1 != EVP_DecryptFinal_ex(ctx, chunk.data(), &len)) {
+        ERR_print_errors_fp(stderr);
+        EVP_CIPHER_CTX_free(ctx);
+        return false;
+    }
+    if (len > 0 && !sink(chunk.data(), len)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return false;
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return true;
+}
+
+// CBC random access: a run of whole blocks decrypts on its own with the
+// ciphertext block before it as IV. Padding is left in place, the caller
+// strips it when the run ends the stream.
+bool decryptBlocks(const unsigned char* ciphertext, size_t length, const unsigned char* chainIv,
+            unsigned char *key, std::vector<unsigned char>& plaintext)
+{
+    RSTEG_TRACE_SCOPE("decryptBlocks");
+    EVP_CIPHER_CTX *ctx;
+    if (!(ctx = EVP_CIPHER_CTX_new())) {
+        handleErrors();
+    }
+
+    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, chainIv)) {
+        handleErrors();
+    }
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+
+    plaintext.resize(length + AES_BLOCK_SIZE);
+    size_t total = 0;
+    int len = 0;
+    for (size_t offset = 0; offset < length; offset += STREAM_CHUNK_SIZE) {
+        size_t n = std::min(STREAM_CHUNK_SIZE, length - offset);
+        if (1 != EVP_DecryptUpdate(ctx, plaintext.data() + total, &len, ciphertext + offset, static_cast<int>(n))) {
+            EVP_CIPHER_CTX_free(ctx);
+            return false;
+        }
+        total += len;
+    }
+    if (1 != EVP_DecryptFinal_ex(ctx, plaintext.data() + total, &len)) {
+        EVP_CIPHER_CTX_free(ctx);
+        return false;
+    }
+    plaintext.resize(total + len);
+
+    EVP_CIPHER_CTX_free(ctx);
+
+    return true;
+}
+
+int encrypt_seed(unsigned char *plaintext, int plaintext_len, unsigned char *key,
+            unsigned char *iv, unsigned char *ciphertext)
+{
+    EVP_CIPHER_CTX *ctx;
+
+    int len;
+
+    int ciphertext_len;
+
+    /* Create and initialise the context */
+    if(!(ctx = EVP_CIPHER_CTX_new()))
+        handleErrors();
+
+    /*
+     * Initialise the encryption operation. IMPORTANT - ensure you use a key
+     * and IV size appropriate for your cipher
+     * In this example we are using 256 bit AES (i.e. a 256 bit key). The
+     * IV size for *most* modes is the same as the block size. For AES this
+     * is 128 bits
+     */
+    if(1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
+        handleErrors();
+
+    /*
+     * Provide the message to be encrypted, and obtain the encrypted output.
+     * EVP_EncryptUpdate can be called multiple times if necessary
+     */
+    if(1 != EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len))
+        handleErrors();
+    ciphertext_len = len;
+
+    /*
+     * Finalise the encryption. Further ciphertext bytes may be written at
+     * this stage.
+     */
+    if(1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len))
+        handleErrors();
+    ciphertext_len += len;
+
+    /* Clean up */
+    EVP_CIPHER_CTX_free(ctx);
+
+    return ciphertext_len;
+}
+
+int decrypt_seed(unsigned char *ciphertext, int ciphertext_len, unsigned char *key,
+            unsigned char *iv, unsigned char *plaintext)
+{
+    EVP_CIPHER_CTX *ctx;
+
+    int len;
+
+    int plaintext_len;
+
+    /* Create and initialise the context */
+    if(!(ctx = EVP_CIPHER_CTX_new()))
+        handleErrors();
+
+    /*
+     * Initialise the decryption operation. IMPORTANT - ensure you use a key
+     * and IV size appropriate for your cipher
+     * In this example we are using 256 bit AES (i.e. a 256 bit key). The
+     * IV size for *most* modes is the same as the block size. For AES this
+     * is 128 bits
+     */
+    if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
+        handleErrors();
+
+    /*
+     * Provide the message to be decrypted, and obtain the plaintext output.
+     * EVP_DecryptUpdate can be called multiple times if necessary.
+     */
+    if(1 != EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len))
+        handleErrors();
+    plaintext_len = len;
+
+    /*
+     * Finalise the decryption. Further plaintext bytes may be written at
+     * this stage.
+     */
+    if(1 != EVP_DecryptFinal_ex(ctx, plaintext + len, &len))
+        handleErrors();
+    plaintext_len += len;
+
+    /* Clean up */
+    EVP_CIPHER_CTX_free(ctx);
+
+    return plaintext_len;
+}
+
+EVP_PKEY* loadEcdhKey(const std::string& keyPath, bool isPrivate) {
+    FILE* keyFile = fopen(keyPath.c_str(), "r");
+    if (!keyFile) {
+        throw std::runtime_error("Unable to open key file.");
+    }
+
+    EVP_PKEY* key = nullptr;
+    if (isPrivate) {
+        key = PEM_read_PrivateKey(keyFile, NULL, NULL, NULL);
+    } else {
+        key = PEM_read_PUBKEY(keyFile, NULL, NULL, NULL);
+    }
+    fclose(keyFile);
+    if (!key) {
+        throw std::runtime_error("Unable to load key.");
+    }
+
+    return key;
+}
+
+std::vector<unsigned char> computeSharedSecret(const std::string& privateKeyPath, const std::string& publicKeyPath) {
+    RSTEG_TRACE_SCOPE("computeSharedSecret");
+    EVP_PKEY *privateKey = loadEcdhKey(privateKeyPath, true);
+    EVP_PKEY *publicKey = loadEcdhKey(publicKeyPath, false);
+
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(privateKey, NULL);
+    if (!ctx) {
+        ERR_print_errors_fp(stderr);
+        throw std::runtime_error("Failed to create EVP_PKEY_CTX.");
+    }
+
+    if (EVP_PKEY_derive_init(ctx) <= 0) {
+        ERR_print_errors_fp(stderr);
+        throw std::runtime_error("Failed to initialize derivation.");
+    }
+
+    if (EVP_PKEY_derive_set_peer(ctx, publicKey) <= 0) {
+        ERR_print_errors_fp(stderr);
+        throw std::runtime_error("Failed to set peer key.");
+    }
+
+    size_t secretLen = 0;
+    if (EVP_PKEY_derive(ctx, NULL, &secretLen) <= 0) {
+        ERR_print_errors_fp(stderr);
+        throw std::runtime_error("Failed to determine shared secret length.");
+    }
+
+    std::vector<unsigned char> secret(secretLen);
+    if (EVP_PKEY_derive(ctx, secret.data(), &secretLen) <= 0) {
+        ERR_print_errors_fp(stderr);
+        throw std::runtime_error("Failed to derive shared secret.");
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(privateKey);
+    EVP_PKEY_free(publicKey);
+
+    return secret;
+}
+
+void deriveAesKeyAndIv(const std::vector<unsigned char>& sharedSecret, unsigned char* aesKey, unsigned char* iv) {
+    RSTEG_TRACE_SCOPE("deriveAesKeyAndIv");
+    const size_t AES_KEY_SIZE = 32; // AES-256 key size
+    const size_t IV_SIZE = 16;      // AES block size for IV
+    const unsigned char* salt = reinterpret_cast<const unsigned char*>("salt"); // Use a secure random salt in practice
+    const int iterations = 10000; // Number of PBKDF2 iterations
+
+    // Derive AES key using PBKDF2 with HMAC-SHA256
+    if (!PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(sharedSecret.data()), sharedSecret.size(),
+                           salt, strlen(reinterpret_cast<const char*>(salt)), iterations,
+                           EVP_sha256(), AES_KEY_SIZE, aesKey)) {
+        throw std::runtime_error("PBKDF2 key derivation with HMAC-SHA256 failed.");
+    }
+
+    // Derive IV using PBKDF2 with HMAC-SHA256
+    if (!PKCS5_PBKDF2_HMAC(reinterpret_cast<const char*>(sharedSecret.data()), sharedSecret.size(),
+                           salt, strlen(reinterpret_cast<const char*>(salt)), iterations,
+                           EVP_sha256(), IV_SIZE, iv)) {
+        throw std::runtime_error("PBKDF2 IV derivation with HMAC-SHA256 failed.");
+    }
+
+    // Optional: Debugging output (uncomment for debugging)
+    /*
+    std::cout << "Derived AES Key: ";
+    for (size_t i = 0; i < AES_KEY_SIZE; ++i) {
+        std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(aesKey[i]);
+    }
+    std::cout << std::dec << std::endl;
+
+    std::cout << "Derived IV: ";
+    for (size_t i = 0; i < IV_SIZE; ++i) {
+        std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(iv[i]);
+    }
+    std::cout << std::dec << std::endl;
+    */
+}
+
+// Multi-recipient containers encrypt the payload once under a random message key
+// and IV. The key table holds them once per recipient, wrapped with a key derived
+// from that recipient's ECDH secret with the sender. Every entry is KEY_TABLE_MARKER,
+// a format identifier, then key and IV under AES-256 key wrap (RFC 3394): its
+// integrity check is what tells dec which entry is its own, and a tampered or foreign
+// entry fails it, there are no recipient ids in the file.
+const size_t KEY_TABLE_ENTRY_SIZE = 64;
+const size_t WRAPPED_KEY_SIZE = 56;    // 32 key + 16 IV + 8 integrity
+const unsigned char KEY_TABLE_MARKER[8] = { 'r', 's', 't', 'e', 'g', 'k', 'w', '1' };
+const unsigned char KEY_WRAP_LABEL[16] = { 'r', 's', 't', 'e', 'g', ' ', 'k', 'e', 'y', ' ', 't', 'a', 'b', 'l', 'e', 0 };
+
+// kept apart from the single-recipient message key of the same pair
+void deriveWrapKey(const std::vector<unsigned char>& sharedSecret, unsigned char* wrapKey) {
+    std::vector<unsigned char> labelled(sharedSecret);
+    labelled.insert(labelled.end(), KEY_WRAP_LABEL, KEY_WRAP_LABEL + sizeof(KEY_WRAP_LABEL));
+    unsigned char unusedIv[16];
+    deriveAesKeyAndIv(labelled, wrapKey, unusedIv);
+}
+
+// key wrap of the 48 bytes of key and IV; unwrapping fails on any changed bit or wrong key
+bool cryptKeyEntry(bool encrypt, const unsigned char* key, const unsigned char* in, unsigned char* out) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int len = 0, finalLen = 0;
+    int inLength = static_cast<int>(encrypt ? WRAPPED_KEY_SIZE - 8 : WRAPPED_KEY_SIZE);
+    if (ctx)
+        EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+    bool ok = ctx && EVP_CipherInit_ex(ctx, EVP_aes_256_wrap(), NULL, key, NULL, encrypt ? 1 : 0) == 1 &&
+              EVP_CipherUpdate(ctx, out, &len, in, inLength) == 1 &&
+              EVP_CipherFinal_ex(ctx, out + len, &finalLen) == 1 &&
+              len + finalLen == static_cast<int>(encrypt ? WRAPPED_KEY_SIZE : WRAPPED_KEY_SIZE - 8);
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+bool randomMessageKey(unsigned char* messageKey, unsigned char* iv) {
+    return RAND_bytes(messageKey, 32) == 1 && RAND_bytes(iv, 16) == 1;
+}
+
+std::vector<unsigned char> wrapMessageKey(const std::vector<unsigned char>& sharedSecret, const unsigned char* messageKey, const unsigned char* iv) {
+    unsigned char wrapKey[32], plain[WRAPPED_KEY_SIZE - 8];
+    deriveWrapKey(sharedSecret, wrapKey);
+    memcpy(plain, messageKey, 32);
+    memcpy(plain + 32, iv, 16);
+
+    std::vector<unsigned char> entry(KEY_TABLE_ENTRY_SIZE);
+    memcpy(entry.data(), KEY_TABLE_MARKER, sizeof(KEY_TABLE_MARKER));
+    if (!cryptKeyEntry(true, wrapKey, plain, entry.data() + sizeof(KEY_TABLE_MARKER)))
+        handleErrors();
+    OPENSSL_cleanse(plain, sizeof(plain));
+    return entry;
+}
+
+// tries every entry, false when none of them is addressed to this key pair
+bool unwrapMessageKey(const std::vector<unsigned char>& sharedSecret, const std::vector<unsigned char>& keyTable,
+                      unsigned char* messageKey, unsigned char* iv) {
+    unsigned char wrapKey[32], plain[WRAPPED_KEY_SIZE];
+    deriveWrapKey(sharedSecret, wrapKey);
+    for (size_t at = 0; at + KEY_TABLE_ENTRY_SIZE <= keyTable.size(); at += KEY_TABLE_ENTRY_SIZE) {
+        const unsigned char* entry = keyTable.data() + at;
+        if (memcmp(entry, KEY_TABLE_MARKER, sizeof(KEY_TABLE_MARKER)) == 0 &&
+            cryptKeyEntry(false, wrapKey, entry + sizeof(KEY_TABLE_MARKER), plain)) {
+            memcpy(messageKey, plain, 32);
+            memcpy(iv, plain + 32, 16);
+            OPENSSL_cleanse(plain, sizeof(plain));
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,280 @@
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+// Uncompressed image carriers (binary PPM/PAM, 24/32-bit BMP, uncompressed
+// TIFF) are not decoded at all: the carrier bytes are the file's pixel region,
+// mapped in place. It has to be one contiguous run of bytes, BMP row padding
+// included, so a position is a plain file offset. enc clones the file to the
+// output and embeds into a shared mapping of the copy, only the pages that
+// receive a position are ever written.
+
+enum BitmapFormat { BITMAP_PNM, BITMAP_BMP, BITMAP_TIFF };
+
+struct Bitmap {
+    BitmapFormat format = BITMAP_PNM;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::uint64_t dataOffset = 0;
+    std::uint64_t dataLength = 0;
+};
+
+bool isBitmapFile(const char* inputPath) {
+    std::string path(inputPath);
+    size_t dotPos = path.find_last_of('.');
+
+    if (dotPos != std::string::npos && dotPos + 1 < path.length()) {
+        std::string fileExtension = path.substr(dotPos);
+        if (fileExtension == ".ppm" || fileExtension == ".pnm" ||
+            fileExtension == ".pam" || fileExtension == ".bmp" ||
+            fileExtension == ".tif" || fileExtension == ".tiff") {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// P6 (maxval 255) or P7 with any depth, the header is text up to the raster
+bool parsePnm(const unsigned char* file, size_t size, Bitmap& bitmap) {
+    size_t at = 2;
+    auto skipSpace = [&]() {
+        while (at < size && (isspace(file[at]) || file[at] == '#')) {
+            if (file[at] == '#') {
+                while (at < size && file[at] != '\n')
+                    ++at;
+            } else {
+                ++at;
+            }
+        }
+    };
+    auto number = [&](std::uint64_t& value) {
+        skipSpace();
+        if (at >= size || !isdigit(file[at]))
+            return false;
+        value = 0;
+        while (at < size && isdigit(file[at]) && value < (std::uint64_t(1) << 32))
+            value = value * 10 + (file[at++] - '0');
+        return true;
+    };
+
+    std::uint64_t width = 0, height = 0, depth = 3, maxval = 0;
+    if (file[1] == '6') {
+        if (!number(width) || !number(height) || !number(maxval) || at >= size || !isspace(file[at])) {
+            std::cerr << "Error:    malformed PPM header" << std::endl;
+            return false;
+        }
+        ++at;
+    } else {
+        depth = 0;
+        for (;;) {
+            skipSpace();
+            size_t end = at;
+            while (end < size && !isspace(file[end]))
+                ++end;
+            std::string token(reinterpret_cast<const char*>(file) + at, end - at);
+            at = end;
+            if (token == "ENDHDR") {
+                while (at < size && file[at] != '\n')
+                    ++at;
+                ++at;
+                break;
+            }
+            if (token == "TUPLTYPE") {
+                while (at < size && file[at] != '\n')
+                    ++at;
+                continue;
+            }
+            std::uint64_t* field = token == "WIDTH" ? &width : token == "HEIGHT" ? &height
+                                 : token == "DEPTH" ? &depth : token == "MAXVAL" ? &maxval : nullptr;
+            if (!field || !number(*field)) {
+                std::cerr << "Error:    malformed PAM header" << std::endl;
+                return false;
+            }
+        }
+    }
+
+    if (maxval != 255 || width == 0 || height == 0 || depth == 0 || depth > 4) {
+        std::cerr << "Error:    only 8-bit PPM/PAM images are supported" << std::endl;
+        return false;
+    }
+    bitmap.format = BITMAP_PNM;
+    bitmap.width = static_cast<int>(width);
+    bitmap.height = static_cast<int>(height);
+    bitmap.channels = static_cast<int>(depth);
+    bitmap.dataOffset = at;
+    bitmap.dataLength = width * height * depth;
+    return true;
+}
+
+bool parseBmp(const unsigned char* file, size_t size, Bitmap& bitmap) {
+    if (size < 54) {
+        std::cerr << "Error:    truncated BMP header" << std::endl;
+        return false;
+    }
+    std::int32_t width = static_cast<std::int32_t>(getLE(file + 18, 4));
+    std::int32_t height = static_cast<std::int32_t>(getLE(file + 22, 4));
+    std::uint64_t bitCount = getLE(file + 28, 2), compression = getLE(file + 30, 4);
+    // BI_RGB, or BI_BITFIELDS on 32-bit images, which only describes the channel masks
+    if ((bitCount != 24 && bitCount != 32) || !(compression == 0 || (compression == 3 && bitCount == 32))) {
+        std::cerr << "Error:    only uncompressed 24/32-bit BMP images are supported" << std::endl;
+        return false;
+    }
+    if (width <= 0 || height == 0 || height == INT32_MIN) {
+        std::cerr << "Error:    malformed BMP header" << std::endl;
+        return false;
+    }
+
+    std::uint64_t rowBytes = (static_cast<std::uint64_t>(width) * bitCount + 31) / 32 * 4;
+    bitmap.format = BITMAP_BMP;
+    bitmap.width = width;
+    bitmap.height = height < 0 ? -height : height;
+    bitmap.channels = static_cast<int>(bitCount / 8);
+    bitmap.dataOffset = getLE(file + 10, 4);
+    bitmap.dataLength = rowBytes * bitmap.height;
+    return true;
+}
+
+// first IFD only, 8-bit chunky or planar samples in strips that follow each other
+bool parseTiff(const unsigned char* file, size_t size, Bitmap& bitmap) {
+    bool bigEndian = file[0] == 'M';
+    auto read = [&](std::uint64_t at, int bytes) -> std::uint64_t {
+        if (at + bytes > size)
+            return 0;
+        std::uint64_t value = 0;
+        for (int b = 0; b < bytes; ++b)
+            value |= std::uint64_t(file[at + b]) << (8 * (bigEndian ? bytes - 1 - b : b));
+        return value;
+    };
+
+    std::uint64_t ifd = read(4, 4);
+    std::uint64_t entries = read(ifd, 2);
+    if (ifd < 8 || ifd + 2 + entries * 12 > size) {
+        std::cerr << "Error:    malformed TIFF header" << std::endl;
+        return false;
+    }
+
+    // SHORT or LONG arrays, stored inline when they fit in the 4-byte value field
+    auto values = [&](std::uint64_t entry) {
+        std::uint64_t type = read(entry + 2, 2), count = read(entry + 4, 4);
+        int bytes = type == 3 ? 2 : 4;
+        std::uint64_t at = count * bytes <= 4 ? entry + 8 : read(entry + 8, 4);
+        std::vector<std::uint64_t> result;
+        for (std::uint64_t k = 0; k < count && at + (k + 1) * bytes <= size; ++k)
+            result.push_back(read(at + k * bytes, bytes));
+        return result;
+    };
+
+    std::uint64_t width = 0, height = 0, samples = 1, compression = 1;
+    std::vector<std::uint64_t> bits{ 1 }, offsets, counts;
+    bool tiles = false;
+    for (std::uint64_t k = 0; k < entries; ++k) {
+        std::uint64_t entry = ifd + 2 + k * 12;
+        std::vector<std::uint64_t> v = values(entry);
+        switch (read(entry, 2)) {
+        case 256: width = v.empty() ? 0 : v[0]; break;
+        case 257: height = v.empty() ? 0 : v[0]; break;
+        case 258: bits = v; break;
+        case 259: compression = v.empty() ? 0 : v[0]; break;
+        case 273: offsets = v; break;
+        case 277: samples = v.empty() ? 0 : v[0]; break;
+        case 279: counts = v; break;
+        case 322: tiles = true; break;
+        }
+    }
+
+    bool eightBit = !bits.empty();
+    for (auto b : bits)
+        eightBit = eightBit && b == 8;
+    if (compression != 1 || !eightBit || tiles || offsets.empty() || offsets.size() != counts.size()) {
+        std::cerr << "Error:    only uncompressed 8-bit TIFF strips are supported" << std::endl;
+        return false;
+    }
+    for (size_t k = 1; k < offsets.size(); ++k) {
+        if (offsets[k] != offsets[k - 1] + counts[k - 1]) {
+            std::cerr << "Error:    TIFF strips are not stored back to back" << std::endl;
+            return false;
+        }
+    }
+
+    bitmap.format = BITMAP_TIFF;
+    bitmap.width = static_cast<int>(width);
+    bitmap.height = static_cast<int>(height);
+    bitmap.channels = static_cast<int>(samples);
+    bitmap.dataOffset = offsets.front();
+    bitmap.dataLength = offsets.back() + counts.back() - offsets.front();
+    return true;
+}
+
+// picks the parser from the magic bytes, the extension only routes the file here
+bool parseBitmap(const unsigned char* file, size_t size, Bitmap& bitmap) {
+    bool parsed;
+    if (size >= 3 && file[0] == 'P' && (file[1] == '6' || file[1] == '7') && isspace(file[2])) {
+        parsed = parsePnm(file, size, bitmap);
+    } else if (size >= 2 && file[0] == 'B' && file[1] == 'M') {
+        parsed = parseBmp(file, size, bitmap);
+    } else if (size >= 8 && ((file[0] == 'I' && file[1] == 'I' && file[2] == 42 && file[3] == 0) ||
+                             (file[0] == 'M' && file[1] == 'M' && file[2] == 0 && file[3] == 42))) {
+        parsed = parseTiff(file, size, bitmap);
+    } else {
+        std::cerr << "Error:    not a binary PPM/PAM, BMP or TIFF image" << std::endl;
+        return false;
+    }
+    if (parsed && (bitmap.dataLength == 0 || bitmap.dataOffset + bitmap.dataLength > size)) {
+        std::cerr << "Error:    pixel data runs past the end of the file" << std::endl;
+        return false;
+    }
+    return parsed;
+}
+
+// reflink where the filesystem shares extents, copy_file_range next, plain read/write last
+bool cloneFile(const std::string& source, const std::string& target) {
+    int in = open(source.c_str(), O_RDONLY);
+    if (in < 0) {
+        return false;
+    }
+    int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    bool copied = false;
+#ifdef FICLONE
+    copied = ioctl(out, FICLONE, in) == 0;
+#endif
+#ifdef __linux__
+    if (!copied) {
+        ssize_t n;
+        while ((n = copy_file_range(in, NULL, out, NULL, size_t(1) << 30, 0)) > 0) {}
+        copied = n == 0;
+        if (!copied && lseek(out, 0, SEEK_CUR) != 0) {
+            close(in);
+            close(out);
+            return false;
+        }
+    }
+#endif
+    if (!copied) {
+        std::vector<unsigned char> chunk(STREAM_CHUNK_SIZE);
+        ssize_t n;
+        copied = true;
+        while (copied && (n = read(in, chunk.data(), chunk.size())) > 0) {
+            copied = write(out, chunk.data(), n) == n;
+        }
+        copied = copied && n == 0;
+    }
+
+    close(in);
+    return (close(out) == 0) && copied;
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+
+// Raw carrier buffers. Anything past RAW_MMAP_THRESHOLD is an anonymous
+// mapping rounded to 2 MB: MAP_HUGETLB when huge pages are reserved, otherwise
+// a regular mapping with transparent huge pages requested via madvise.
+// Released mappings stay in a process-wide pool and are handed out again to
+// the next carrier or shard of a similar size instead of being faulted in anew.
+// The pool keeps at most IDLE_PER_LIVE times the largest buffer in use idle,
+// a one-shot run holds on to its last carrier or two and nothing more.
+
+const size_t RAW_MMAP_THRESHOLD = 1 << 20;
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+const size_t IDLE_PER_LIVE = 2;
+
+struct BufferPool {
+    std::mutex lock;
+    std::multimap<size_t, void*> idle;                 // mapped size -> released mapping
+    std::unordered_map<void*, std::pair<size_t, bool>> mapped; // mapping -> size, huge pages
+    std::multiset<size_t> live;                        // sizes of the mappings handed out
+    size_t idleBytes = 0;
+    size_t reused = 0;
+    size_t hugePageBytes = 0;
+    bool hugeTlbFailed = false;   // no reserved huge pages, not tried again
+};
+
+BufferPool& bufferPool() {
+    static BufferPool pool;
+    return pool;
+}
+
+void* rawAcquire(size_t bytes) {
+    if (bytes < RAW_MMAP_THRESHOLD) {
+        void* p = malloc(bytes);
+        if (!p)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    size_t size = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    BufferPool& pool = bufferPool();
+    {
+        // an idle mapping up to twice the request is good enough
+        std::lock_guard<std::mutex> guard(pool.lock);
+        auto it = pool.idle.lower_bound(size);
+        if (it != pool.idle.end() && it->first <= 2 * size) {
+            void* p = it->second;
+            pool.idleBytes -= it->first;
+            pool.live.insert(it->first);
+            pool.idle.erase(it);
+            ++pool.reused;
+            return p;
+        }
+    }
+
+    bool huge = false;
+    void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    bool tryHuge;
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        tryHuge = !pool.hugeTlbFailed;
+    }
+    if (tryHuge) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        huge = p != MAP_FAILED;
+        if (!huge) {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            pool.hugeTlbFailed = true;
+        }
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    std::lock_guard<std::mutex> guard(pool.lock);
+    pool.mapped[p] = { size, huge };
+    pool.live.insert(size);
+    if (huge)
+        pool.hugePageBytes += size;
+    return p;
+}
+
+void rawRelease(void* p, size_t bytes) {
+    if (bytes < RAW_MMAP_THRESHOLD) {
+        free(p);
+        return;
+    }
+
+    BufferPool& pool = bufferPool();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    size_t size = pool.mapped[p].first;
+    pool.live.erase(pool.live.find(size));
+    size_t largest = pool.live.empty() ? size : std::max(size, *pool.live.rbegin());
+    if (pool.idleBytes + size <= IDLE_PER_LIVE * largest) {
+        pool.idle.emplace(size, p);
+        pool.idleBytes += size;
+        return;
+    }
+    pool.mapped.erase(p);
+    munmap(p, size);
+}
+
+// vector allocator over rawAcquire; default construction is a no-op, so resize()
+// hands out uninitialized bytes that the decoder overwrites anyway
+template <typename T>
+struct RawAllocator {
+    using value_type = T;
+
+    RawAllocator() = default;
+    template <typename U>
+    RawAllocator(const RawAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(rawAcquire(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { rawRelease(p, n * sizeof(T)); }
+
+    template <typename U>
+    void construct(U*) noexcept {}
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) { ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+
+    template <typename U>
+    bool operator==(const RawAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const RawAllocator<U>&) const { return false; }
+};
+
+using RawBytes = std::vector<unsigned char, RawAllocator<unsigned char>>;
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+
+// --cache DIR: decoded carriers are kept as <key>.raw next to a <key>.meta text
+// file, key = SHA-256 of the carrier file and its size. A hit maps the raw file
+// copy-on-write, so embedding never writes through to the cache. The .raw mtime
+// is refreshed on every hit and the oldest entries go first once the directory
+// is over its cap.
+
+const size_t DEFAULT_CACHE_BYTES = size_t(4) << 30;
+
+// writable mapping of a cache entry or bitmap carrier, unmapped with the owner.
+// Private mappings never write through, shared ones write straight into the file
+class MappedRaw {
+public:
+    MappedRaw() = default;
+    ~MappedRaw() { reset(); }
+
+    MappedRaw(const MappedRaw&) = delete;
+    MappedRaw& operator=(const MappedRaw&) = delete;
+    MappedRaw(MappedRaw&& other) noexcept { *this = std::move(other); }
+    MappedRaw& operator=(MappedRaw&& other) noexcept {
+        if (this != &other) {
+            reset();
+            std::swap(bytes, other.bytes);
+            std::swap(length, other.length);
+        }
+        return *this;
+    }
+
+    bool map(const std::string& path, bool shared = false) {
+        reset();
+        int fd = open(path.c_str(), shared ? O_RDWR : O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        bytes = static_cast<unsigned char*>(p);
+        length = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    void reset() {
+        if (bytes) {
+            munmap(bytes, length);
+        }
+        bytes = nullptr;
+        length = 0;
+    }
+
+    unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool empty() const { return bytes == nullptr; }
+
+private:
+    unsigned char* bytes = nullptr;
+    size_t length = 0;
+};
+
+// hashes the file while the next chunks are read ahead, "" when it cannot be read
+std::string cacheKey(const std::string& path) {
+    AsyncReader reader;
+    if (!reader.open(path)) {
+        return "";
+    }
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+    const unsigned char* chunk;
+    size_t bytesRead, total = 0;
+    while (reader.next(chunk, bytesRead)) {
+        EVP_DigestUpdate(ctx, chunk, bytesRead);
+        total += bytesRead;
+    }
+    if (reader.failed()) {
+        EVP_MD_CTX_free(ctx);
+        return "";
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    EVP_DigestFinal_ex(ctx, digest, &digestLength);
+    EVP_MD_CTX_free(ctx);
+
+    std::ostringstream key;
+    for (unsigned int i = 0; i < digestLength; ++i) {
+        key << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(digest[i]);
+    }
+    key << std::dec << "-" << total;
+    return key.str();
+}
+
+bool cacheLookup(const std::string& dir, const std::string& key, std::string& meta, MappedRaw& raw) {
+    std::filesystem::path base = std::filesystem::path(dir) / key;
+    std::ifstream metaFile(base.string() + ".meta");
+    if (!metaFile.is_open() || !raw.map(base.string() + ".raw")) {
+        return false;
+    }
+    std::ostringstream text;
+    text << metaFile.rdbuf();
+    meta = text.str();
+
+    // least recently used is judged by the raw file's mtime
+    std::error_code ec;
+    std::filesystem::last_write_time(base.string() + ".raw", std::filesystem::file_time_type::clock::now(), ec);
+    return true;
+}
+
+// drops the least recently used entries until the directory holds at most maxBytes
+void cacheEvict(const std::string& dir, size_t maxBytes) {
+    std::error_code ec;
+    std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+    size_t total = 0;
+    for (auto it = std::filesystem::directory_iterator(dir, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+        if (it->path().extension() != ".raw")
+            continue;
+        total += it->file_size(ec);
+        entries.emplace_back(it->last_write_time(ec), it->path());
+    }
+    std::sort(entries.begin(), entries.end());
+    for (auto& entry : entries) {
+        if (total <= maxBytes)
+            break;
+        size_t size = std::filesystem::file_size(entry.second, ec);
+        std::filesystem::remove(entry.second, ec);
+        std::filesystem::path meta = entry.second;
+        std::filesystem::remove(meta.replace_extension(".meta"), ec);
+        total -= std::min(total, size);
+    }
+}
+
+// written under a temporary name and renamed, concurrent runs never see half an entry
+bool cacheStore(const std::string& dir, const std::string& key, const std::string& meta,
+                const unsigned char* data, size_t size, size_t maxBytes) {
+    if (size > maxBytes) {
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    std::filesystem::path base = std::filesystem::path(dir) / key;
+    std::string suffix = ".tmp" + std::to_string(getpid()) + "_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    std::string metaTmp = base.string() + ".meta" + suffix, rawTmp = base.string() + ".raw" + suffix;
+    FILE* metaFile = fopen(metaTmp.c_str(), "wb");
+    AsyncWriter rawFile;
+    bool written = metaFile && rawFile.open(rawTmp) &&
+                   fwrite(meta.data(), 1, meta.size(), metaFile) == meta.size() &&
+                   rawFile.write(data, size);
+    written = (metaFile && fclose(metaFile) == 0) && written;
+    written = rawFile.close() && written;
+    if (written) {
+        std::filesystem::rename(metaTmp, base.string() + ".meta", ec);
+        written = !ec;
+    }
+    if (written) {
+        std::filesystem::rename(rawTmp, base.string() + ".raw", ec);
+        written = !ec;
+    }
+    std::filesystem::remove(metaTmp, ec);
+    std::filesystem::remove(rawTmp, ec);
+
+    cacheEvict(dir, maxBytes);
+    return written;
+}
@@ -0,0 +1,165 @@
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#define RSTEG_CRC32C_SSE42 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define RSTEG_CRC32C_ARM 1
+#endif
+
+// CRC32C (Castagnoli), reflected polynomial 0x82F63B78
+struct Crc32cTable {
+    std::uint32_t t[8][256];
+
+    Crc32cTable() {
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t crc = n;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : crc >> 1;
+            }
+            t[0][n] = crc;
+        }
+        for (std::uint32_t n = 0; n < 256; ++n) {
+            std::uint32_t crc = t[0][n];
+            for (int s = 1; s < 8; ++s) {
+                crc = t[0][crc & 0xFF] ^ (crc >> 8);
+                t[s][n] = crc;
+            }
+        }
+    }
+};
+
+const Crc32cTable& crc32cTable() {
+    static const Crc32cTable table;
+    return table;
+}
+
+// slicing-by-8 software implementation
+std::uint32_t crc32cSoftware(const unsigned char* data, size_t len, std::uint32_t crc = 0) {
+    const auto& t = crc32cTable().t;
+    crc = ~crc;
+    while (len >= 8) {
+        std::uint32_t lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<std::uint32_t>(data[3]) << 24));
+        std::uint32_t hi = data[4] | (data[5] << 8) | (data[6] << 16) | (static_cast<std::uint32_t>(data[7]) << 24);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(RSTEG_CRC32C_SSE42)
+__attribute__((target("sse4.2")))
+std::uint32_t crc32cHardware(const unsigned char* data, size_t len, std::uint32_t crc) {
+    std::uint64_t c = ~crc;
+    while (len >= 8) {
+        std::uint64_t word;
+        memcpy(&word, data, 8);
+        c = _mm_crc32_u64(c, word);
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        c = _mm_crc32_u8(static_cast<std::uint32_t>(c), *data++);
+    }
+    return ~static_cast<std::uint32_t>(c);
+}
+
+bool crc32cHardwareAvailable() {
+    static const bool available = __builtin_cpu_supports("sse4.2");
+    return available;
+}
+#elif defined(RSTEG_CRC32C_ARM)
+std::uint32_t crc32cHardware(const unsigned char* data, size_t len, std::uint32_t crc) {
+    crc = ~crc;
+    while (len >= 8) {
+        std::uint64_t word;
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return ~crc;
+}
+
+bool crc32cHardwareAvailable() {
+    return true;
+}
+#endif
+
+// dispatches to the CPU's CRC32C instruction when there is one
+std::uint32_t crc32c(const unsigned char* data, size_t len, std::uint32_t crc = 0) {
+#if defined(RSTEG_CRC32C_SSE42) || defined(RSTEG_CRC32C_ARM)
+    if (crc32cHardwareAvailable()) {
+        return crc32cHardware(data, len, crc);
+    }
+#endif
+    return crc32cSoftware(data, len, crc);
+}
+
+// Embedded streams are protected per chunk: the stream is followed by one
+// little-endian CRC32C for every (1 << chunkShift) bytes of payload.
+const unsigned char CHUNK_SHIFT = 16;
+
+size_t chunkCount(size_t payloadLength, unsigned char chunkShift) {
+    return (payloadLength + (size_t(1) << chunkShift) - 1) >> chunkShift;
+}
+
+std::vector<unsigned char> chunkChecksums(const unsigned char* data, size_t len, unsigned char chunkShift) {
+    RSTEG_TRACE_SCOPE("chunkChecksums");
+    size_t chunkSize = size_t(1) << chunkShift;
+    std::vector<unsigned char> table;
+    table.reserve(chunkCount(len, chunkShift) * 4);
+    for (size_t offset = 0; offset < len; offset += chunkSize) {
+        std::uint32_t crc = crc32c(data + offset, std::min(chunkSize, len - offset));
+        for (int i = 0; i < 4; ++i) {
+            table.push_back((crc >> (8 * i)) & 0xFF);
+        }
+    }
+    return table;
+}
+
+// checks every chunk against the table on all cores, returns the indices of corrupt chunks
+std::vector<size_t> verifyChunks(const unsigned char* data, size_t len, const unsigned char* table, unsigned char chunkShift) {
+    RSTEG_TRACE_SCOPE("verifyChunks");
+    size_t chunkSize = size_t(1) << chunkShift;
+    size_t chunks = chunkCount(len, chunkShift);
+    std::vector<char> corrupt(chunks, 0);
+
+    size_t workerCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), chunks));
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < workerCount; ++w) {
+        workers.emplace_back([&, w]() {
+            RSTEG_TRACE_SCOPE("verifyChunks/worker");
+            for (size_t c = w; c < chunks; c += workerCount) {
+                size_t offset = c * chunkSize;
+                std::uint32_t expected = table[c * 4] | (table[c * 4 + 1] << 8) | (table[c * 4 + 2] << 16) |
+                                         (static_cast<std::uint32_t>(table[c * 4 + 3]) << 24);
+                corrupt[c] = crc32c(data + offset, std::min(chunkSize, len - offset)) != expected;
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    std::vector<size_t> bad;
+    for (size_t c = 0; c < chunks; ++c) {
+        if (corrupt[c])
+            bad.push_back(c);
+    }
+    return bad;
+}
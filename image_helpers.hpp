@@ -0,0 +1,445 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifdef RSTEG_ENABLE_WEBP
+#include <webp/decode.h>
+#include <webp/encode.h>
+#endif
+
+// Lossless image carriers besides PNG. The format is sniffed from the magic
+// bytes and the stego container is written in the same format as its carrier.
+// QOI is implemented here and keeps its codec state in QoiRows, so --max-memory
+// can stream it a few rows at a time like PNG. WebP goes through libwebp
+// (lossless, exact mode) and only exists in builds with RSTEG_ENABLE_WEBP.
+
+enum ImageFormat { IMAGE_PNG, IMAGE_QOI, IMAGE_WEBP };
+
+const char* imageFormatName(ImageFormat format) {
+    switch (format) {
+    case IMAGE_QOI:
+        return "qoi";
+    case IMAGE_WEBP:
+        return "webp";
+    default:
+        return "png";
+    }
+}
+
+bool parseImageFormat(const std::string& name, ImageFormat& format) {
+    for (ImageFormat f : { IMAGE_PNG, IMAGE_QOI, IMAGE_WEBP }) {
+        if (name == imageFormatName(f)) {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+// anything that is neither QOI nor WebP is left to libpng and its error messages
+ImageFormat sniffImage(const char* filename) {
+    unsigned char magic[12] = { 0 };
+    FILE* fp = fopen(filename, "rb");
+    if (fp) {
+        size_t bytesRead = fread(magic, 1, sizeof(magic), fp);
+        fclose(fp);
+        if (bytesRead >= 4 && memcmp(magic, "qoif", 4) == 0)
+            return IMAGE_QOI;
+        if (bytesRead == 12 && memcmp(magic, "RIFF", 4) == 0 && memcmp(magic + 8, "WEBP", 4) == 0)
+            return IMAGE_WEBP;
+    }
+    return IMAGE_PNG;
+}
+
+const size_t QOI_HEADER_SIZE = 14;
+const unsigned char QOI_OP_INDEX = 0x00;
+const unsigned char QOI_OP_DIFF = 0x40;
+const unsigned char QOI_OP_LUMA = 0x80;
+const unsigned char QOI_OP_RUN = 0xc0;
+const unsigned char QOI_OP_RGB = 0xfe;
+const unsigned char QOI_OP_RGBA = 0xff;
+const unsigned char QOI_END_MARKER[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+// file handle plus the decoder / encoder state between two calls; height counts the rows still to go
+struct QoiRows {
+    FILE* fp = nullptr;
+    int width = 0;
+    int height = 0;
+    int numChannels = 0;
+    unsigned char index[64][4] = {};
+    unsigned char px[4] = { 0, 0, 0, 255 };
+    int run = 0;
+    std::vector<unsigned char> buffer;   // read ahead or not yet written bytes
+    size_t at = 0;
+    bool truncated = false;
+};
+
+inline int qoiHash(const unsigned char* px) {
+    return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+std::uint32_t getBE32(const unsigned char* in) {
+    return (std::uint32_t(in[0]) << 24) | (std::uint32_t(in[1]) << 16) | (std::uint32_t(in[2]) << 8) | in[3];
+}
+
+void putBE32(unsigned char* out, std::uint32_t value) {
+    for (int b = 0; b < 4; ++b)
+        out[b] = (value >> (24 - 8 * b)) & 0xFF;
+}
+
+bool openQoiReader(const char* filename, QoiRows& rows) {
+    rows.fp = fopen(filename, "rb");
+    if (!rows.fp) {
+        fprintf(stderr, "Error:     unable to read QOI file\n");
+        return false;
+    }
+    unsigned char header[QOI_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), rows.fp) != sizeof(header) || memcmp(header, "qoif", 4) != 0 ||
+        getBE32(header + 4) == 0 || getBE32(header + 4) > INT32_MAX || getBE32(header + 8) == 0 ||
+        getBE32(header + 8) > INT32_MAX || (header[12] != 3 && header[12] != 4)) {
+        fclose(rows.fp);
+        rows.fp = nullptr;
+        fprintf(stderr, "Error:     malformed QOI header\n");
+        return false;
+    }
+    rows.width = static_cast<int>(getBE32(header + 4));
+    rows.height = static_cast<int>(getBE32(header + 8));
+    rows.numChannels = header[12];
+    rows.buffer.resize(STREAM_CHUNK_SIZE);
+    rows.at = rows.buffer.size();
+    return true;
+}
+
+// decodes count pixels; a QOI op is at most 5 bytes, the buffer is topped up before each.
+// The state lives in locals while decoding, stores through out could alias it otherwise
+template <size_t channels>
+void decodeQoi(QoiRows& rows, unsigned char* out, size_t count) {
+    unsigned char px[4];
+    memcpy(px, rows.px, 4);
+    int run = rows.run;
+    size_t at = rows.at, size = rows.buffer.size();
+    const unsigned char* data = rows.buffer.data();
+    for (size_t i = 0; i < count; ++i, out += channels) {
+        if (run > 0) {
+            --run;
+        } else {
+            if (size - at < 5) {
+                size_t kept = size - at;
+                memmove(rows.buffer.data(), data + at, kept);
+                size_t filled = kept + fread(rows.buffer.data() + kept, 1, size - kept, rows.fp);
+                rows.truncated = rows.truncated || filled < 5;
+                std::fill(rows.buffer.begin() + filled, rows.buffer.end(), 0);
+                at = 0;
+            }
+            const unsigned char* in = data + at;
+            unsigned char op = in[0];
+            if (op == QOI_OP_RGB) {
+                px[0] = in[1];
+                px[1] = in[2];
+                px[2] = in[3];
+                at += 4;
+            } else if (op == QOI_OP_RGBA) {
+                memcpy(px, in + 1, 4);
+                at += 5;
+            } else if ((op & 0xc0) == QOI_OP_INDEX) {
+                memcpy(px, rows.index[op], 4);
+                at += 1;
+            } else if ((op & 0xc0) == QOI_OP_DIFF) {
+                px[0] += ((op >> 4) & 0x03) - 2;
+                px[1] += ((op >> 2) & 0x03) - 2;
+                px[2] += (op & 0x03) - 2;
+                at += 1;
+            } else if ((op & 0xc0) == QOI_OP_LUMA) {
+                int vg = (op & 0x3f) - 32;
+                px[0] += vg - 8 + ((in[1] >> 4) & 0x0f);
+                px[1] += vg;
+                px[2] += vg - 8 + (in[1] & 0x0f);
+                at += 2;
+            } else {
+                run = op & 0x3f;
+                at += 1;
+            }
+            memcpy(rows.index[qoiHash(px)], px, 4);
+        }
+        memcpy(out, px, channels);
+    }
+    memcpy(rows.px, px, 4);
+    rows.run = run;
+    rows.at = at;
+}
+
+bool readQoiPixels(QoiRows& rows, unsigned char* out, size_t count) {
+    if (rows.numChannels == 4)
+        decodeQoi<4>(rows, out, count);
+    else
+        decodeQoi<3>(rows, out, count);
+    if (rows.truncated) {
+        fprintf(stderr, "Error:     QOI data ends early\n");
+        return false;
+    }
+    return true;
+}
+
+void closeQoiReader(QoiRows& rows) {
+    if (rows.fp)
+        fclose(rows.fp);
+    rows.fp = nullptr;
+}
+
+bool flushQoi(QoiRows& rows) {
+    bool written = fwrite(rows.buffer.data(), 1, rows.at, rows.fp) == rows.at;
+    rows.at = 0;
+    return written;
+}
+
+bool openQoiWriter(const char* filename, QoiRows& rows) {
+    if (rows.numChannels != 3 && rows.numChannels != 4) {
+        fprintf(stderr, "Error:     unsupported number of channels.\n");
+        return false;
+    }
+    rows.fp = fopen(filename, "wb");
+    if (!rows.fp) {
+        fprintf(stderr, "Error:     failed to create output QOI\n");
+        return false;
+    }
+    rows.buffer.resize(STREAM_CHUNK_SIZE);
+    unsigned char* header = rows.buffer.data();
+    memcpy(header, "qoif", 4);
+    putBE32(header + 4, rows.width);
+    putBE32(header + 8, rows.height);
+    header[12] = static_cast<unsigned char>(rows.numChannels);
+    header[13] = 0;
+    rows.at = QOI_HEADER_SIZE;
+    return true;
+}
+
+template <size_t channels>
+bool encodeQoi(QoiRows& rows, const unsigned char* in, size_t count) {
+    unsigned char prev[4], px[4] = { 0, 0, 0, 255 };
+    memcpy(prev, rows.px, 4);
+    int run = rows.run;
+    size_t at = rows.at, size = rows.buffer.size();
+    unsigned char* data = rows.buffer.data();
+    bool written = true;
+    for (size_t i = 0; i < count; ++i, in += channels) {
+        memcpy(px, in, channels);
+        if (memcmp(px, prev, 4) == 0) {
+            if (++run == 62) {
+                data[at++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+        } else {
+            if (run > 0) {
+                data[at++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            int hash = qoiHash(px);
+            if (memcmp(rows.index[hash], px, 4) == 0) {
+                data[at++] = QOI_OP_INDEX | hash;
+            } else {
+                memcpy(rows.index[hash], px, 4);
+                if (px[3] == prev[3]) {
+                    signed char vr = px[0] - prev[0], vg = px[1] - prev[1], vb = px[2] - prev[2];
+                    signed char vgr = vr - vg, vgb = vb - vg;
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        data[at++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                    } else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+                        data[at++] = QOI_OP_LUMA | (vg + 32);
+                        data[at++] = (vgr + 8) << 4 | (vgb + 8);
+                    } else {
+                        data[at] = QOI_OP_RGB;
+                        memcpy(data + at + 1, px, 3);
+                        at += 4;
+                    }
+                } else {
+                    data[at] = QOI_OP_RGBA;
+                    memcpy(data + at + 1, px, 4);
+                    at += 5;
+                }
+            }
+            memcpy(prev, px, 4);
+        }
+        // the next pixel writes at most a pending run and a 5-byte op
+        if (size - at < 6) {
+            rows.at = at;
+            written = flushQoi(rows) && written;
+            at = 0;
+        }
+    }
+    memcpy(rows.px, prev, 4);
+    rows.run = run;
+    rows.at = at;
+    return written;
+}
+
+bool writeQoiPixels(QoiRows& rows, const unsigned char* in, size_t count) {
+    return rows.numChannels == 4 ? encodeQoi<4>(rows, in, count) : encodeQoi<3>(rows, in, count);
+}
+
+// a run still open at the last pixel is written here, then the end marker
+bool closeQoiWriter(QoiRows& rows) {
+    if (rows.buffer.size() - rows.at < 1 + sizeof(QOI_END_MARKER))
+        flushQoi(rows);
+    if (rows.run > 0)
+        rows.buffer[rows.at++] = QOI_OP_RUN | (rows.run - 1);
+    memcpy(rows.buffer.data() + rows.at, QOI_END_MARKER, sizeof(QOI_END_MARKER));
+    rows.at += sizeof(QOI_END_MARKER);
+    bool written = flushQoi(rows);
+    written = (fclose(rows.fp) == 0) && written;
+    rows.fp = nullptr;
+    return written;
+}
+
+std::pair<std::vector<int>, RawBytes> readQoi(const char* filename) {
+    RSTEG_TRACE_SCOPE("readQoi");
+    QoiRows rows;
+    if (!openQoiReader(filename, rows)) {
+        exit(1);
+    }
+    RawBytes imageData(static_cast<size_t>(rows.numChannels) * rows.width * rows.height);
+    bool decoded = readQoiPixels(rows, imageData.data(), static_cast<size_t>(rows.width) * rows.height);
+    closeQoiReader(rows);
+    if (!decoded) {
+        exit(1);
+    }
+    return std::make_pair(std::vector<int>{ rows.width, rows.height, rows.numChannels }, std::move(imageData));
+}
+
+bool writeQoi(const char* filename, const unsigned char* imageData, int width, int height, int numChannels) {
+    RSTEG_TRACE_SCOPE("writeQoi");
+    QoiRows rows;
+    rows.width = width;
+    rows.height = height;
+    rows.numChannels = numChannels;
+    if (!openQoiWriter(filename, rows)) {
+        return false;
+    }
+    bool written = writeQoiPixels(rows, imageData, static_cast<size_t>(width) * height);
+    return closeQoiWriter(rows) && written;
+}
+
+#ifdef RSTEG_ENABLE_WEBP
+bool readWebpFile(const char* filename, std::vector<unsigned char>& data, WebPBitstreamFeatures& features) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "Error:     unable to read WebP file\n");
+        return false;
+    }
+    std::vector<unsigned char> chunk(STREAM_CHUNK_SIZE);
+    size_t bytesRead;
+    data.clear();
+    while ((bytesRead = fread(chunk.data(), 1, chunk.size(), fp)) > 0) {
+        data.insert(data.end(), chunk.begin(), chunk.begin() + bytesRead);
+    }
+    fclose(fp);
+    if (WebPGetFeatures(data.data(), data.size(), &features) != VP8_STATUS_OK || features.has_animation) {
+        fprintf(stderr, "Error:     unsupported WebP file\n");
+        return false;
+    }
+    return true;
+}
+
+bool webpInfo(const char* filename, int& width, int& height, int& numChannels) {
+    std::vector<unsigned char> data;
+    WebPBitstreamFeatures features;
+    if (!readWebpFile(filename, data, features)) {
+        return false;
+    }
+    width = features.width;
+    height = features.height;
+    numChannels = features.has_alpha ? 4 : 3;
+    return true;
+}
+
+// lossy inputs decode fine as well, the container is always written lossless
+std::pair<std::vector<int>, RawBytes> readWebp(const char* filename) {
+    RSTEG_TRACE_SCOPE("readWebp");
+    std::vector<unsigned char> data;
+    WebPBitstreamFeatures features;
+    if (!readWebpFile(filename, data, features)) {
+        exit(1);
+    }
+    int numChannels = features.has_alpha ? 4 : 3;
+    size_t rowBytes = static_cast<size_t>(numChannels) * features.width;
+    RawBytes imageData(rowBytes * features.height);
+    unsigned char* decoded = numChannels == 4
+        ? WebPDecodeRGBAInto(data.data(), data.size(), imageData.data(), imageData.size(), static_cast<int>(rowBytes))
+        : WebPDecodeRGBInto(data.data(), data.size(), imageData.data(), imageData.size(), static_cast<int>(rowBytes));
+    if (!decoded) {
+        fprintf(stderr, "Error:     unable to decode WebP file\n");
+        exit(1);
+    }
+    return std::make_pair(std::vector<int>{ features.width, features.height, numChannels }, std::move(imageData));
+}
+
+int writeWebpChunk(const uint8_t* data, size_t size, const WebPPicture* picture) {
+    return fwrite(data, 1, size, static_cast<FILE*>(picture->custom_ptr)) == size;
+}
+
+// exact mode, otherwise libwebp rewrites the RGB of fully transparent pixels and the bits embedded there
+bool writeWebp(const char* filename, const unsigned char* imageData, int width, int height, int numChannels) {
+    RSTEG_TRACE_SCOPE("writeWebp");
+    WebPConfig config;
+    WebPPicture picture;
+    if (!WebPConfigInit(&config) || !WebPPictureInit(&picture)) {
+        fprintf(stderr, "Error:     libwebp version mismatch\n");
+        return false;
+    }
+    config.lossless = 1;
+    config.exact = 1;
+    picture.use_argb = 1;
+    picture.width = width;
+    picture.height = height;
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error:     failed to create output WebP\n");
+        return false;
+    }
+    picture.writer = writeWebpChunk;
+    picture.custom_ptr = fp;
+    bool written = numChannels == 4 ? WebPPictureImportRGBA(&picture, imageData, width * 4)
+                                    : WebPPictureImportRGB(&picture, imageData, width * 3);
+    written = written && WebPEncode(&config, &picture);
+    WebPPictureFree(&picture);
+    written = (fclose(fp) == 0) && written;
+    if (!written) {
+        fprintf(stderr, "Error:     WebP encoding failed\n");
+    }
+    return written;
+}
+#else
+bool webpInfo(const char*, int&, int&, int&) {
+    fprintf(stderr, "Error:     WebP carriers need a build with libwebp\n");
+    return false;
+}
+
+std::pair<std::vector<int>, RawBytes> readWebp(const char* filename) {
+    int width, height, numChannels;
+    webpInfo(filename, width, height, numChannels);
+    exit(1);
+}
+
+bool writeWebp(const char*, const unsigned char*, int, int, int) {
+    fprintf(stderr, "Error:     WebP carriers need a build with libwebp\n");
+    return false;
+}
+#endif
+
+std::pair<std::vector<int>, RawBytes> readImageAs(const char* filename, ImageFormat format) {
+    if (format == IMAGE_QOI)
+        return readQoi(filename);
+    if (format == IMAGE_WEBP)
+        return readWebp(filename);
+    return readImage(filename);
+}
+
+bool writeImageAs(const char* filename, ImageFormat format, const unsigned char* imageData, int width, int height, int numChannels) {
+    if (format == IMAGE_QOI)
+        return writeQoi(filename, imageData, width, height, numChannels);
+    if (format == IMAGE_WEBP)
+        return writeWebp(filename, imageData, width, height, numChannels);
+    return writeImage(filename, imageData, width, height, numChannels);
+}
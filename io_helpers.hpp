@@ -2,9 +2,15 @@
 #include <fstream>
 #include <cstdlib>
 #include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
 #include <vector>
 #include <cstdint>
-#include <array>
+#include "trace_helpers.hpp"
+#include "buffer_helpers.hpp"
+#include "uring_helpers.hpp"
+#include "spawn_helpers.hpp"
 
 extern "C" {
     #include <png.h>
@@ -16,100 +22,189 @@ struct VideoInfo {
     int numChannels;
     double framerate;
     std::string codec;
-    std::vector<unsigned char> rawData;
+    size_t estimatedBytes = 0;   // from the stream duration, 0 when ffprobe has none
+    std::string pixelFormat;     // frames are decoded and encoded in the stream's own format
+    size_t frameBytes = 0;       // one decoded frame in that format
+    bool keepAudio = true;       // false when enc --audio-track muxes in its own audio
+    RawBytes rawData;
 };
 
 struct AudioInfo {
     std::string codec;
     int sampleRate;
     int channels;
-    std::vector<unsigned char> rawData;
+    size_t estimatedBytes = 0;
+    RawBytes rawData;
 };
 
-// update for linux IO
+const size_t STREAM_CHUNK_SIZE = 1 << 16;
+
+// fread straight into the buffer's spare room, no intermediate chunk and no zero fill
+size_t readIntoRaw(FILE* input, RawBytes& data) {
+    size_t size = 0, bytesRead;
+    for (;;) {
+        if (data.size() < size + STREAM_CHUNK_SIZE)
+            data.resize(std::max(data.capacity(), size + STREAM_CHUNK_SIZE));
+        bytesRead = fread(data.data() + size, 1, data.size() - size, input);
+        if (bytesRead == 0)
+            break;
+        size += bytesRead;
+    }
+    data.resize(size);
+    return size;
+}
+
+// same for a child's pipe: read straight into the buffer, sized up front from the probe
+size_t readIntoRaw(int input, RawBytes& data) {
+    size_t size = 0, bytesRead;
+    for (;;) {
+        if (data.size() < size + STREAM_CHUNK_SIZE)
+            data.resize(std::max(data.capacity(), size + STREAM_CHUNK_SIZE));
+        bytesRead = readPipe(input, data.data() + size, data.size() - size);
+        size += bytesRead;
+        if (size < data.size())
+            break;
+    }
+    data.resize(size);
+    return size;
+}
+
+// "-" selects stdin / stdout so payloads can be piped through
+FILE* openPayloadStream(const std::string& path, bool write) {
+    if (path == "-") {
+        return write ? stdout : stdin;
+    }
+    return fopen(path.c_str(), write ? "wb" : "rb");
+}
+
+void closePayloadStream(FILE* stream) {
+    if (stream == stdin || stream == stdout) {
+        fflush(stream);
+        return;
+    }
+    fclose(stream);
+}
+
+// payload output: "-" goes through stdio, files through the write-behind queue
+class PayloadOutput {
+public:
+    bool open(const std::string& path) {
+        if (path == "-") {
+            stream = stdout;
+            return true;
+        }
+        return writer.open(path);
+    }
+
+    bool write(const unsigned char* data, size_t length) {
+        return stream ? fwrite(data, 1, length, stream) == length : writer.write(data, length);
+    }
+
+    bool close() {
+        return stream ? fflush(stream) == 0 : writer.close();
+    }
+
+private:
+    FILE* stream = nullptr;
+    AsyncWriter writer;
+};
+
+// reads in fixed-size chunks so pipes and other non-seekable inputs work
 bool readBinaryFile(const char* filename, std::vector<unsigned char>& data) {
-    std::ifstream inputFile(filename, std::ios::binary);
-    if (!inputFile.is_open()) {
+    FILE* inputFile = openPayloadStream(filename, false);
+    if (!inputFile) {
         std::cerr << "Error:    unable to open the file" << std::endl;
         return false;
     }
 
-    inputFile.seekg(0, std::ios::end);
-    std::streamsize fileSize = inputFile.tellg();
-    inputFile.seekg(0, std::ios::beg);
+    data.clear();
+    std::vector<unsigned char> chunk(STREAM_CHUNK_SIZE);
+    size_t bytesRead;
+    while ((bytesRead = fread(chunk.data(), 1, chunk.size(), inputFile)) > 0) {
+        data.insert(data.end(), chunk.begin(), chunk.begin() + bytesRead);
+    }
+    closePayloadStream(inputFile);
 
-    if (fileSize <= 0) {
+    if (data.empty()) {
         std::cerr << "Error:    no data to read" << std::endl;
         return false;
     }
 
-    data.resize(static_cast<size_t>(fileSize));
-    inputFile.read(reinterpret_cast<char*>(data.data()), fileSize);
+    return true;
+}
 
-    inputFile.close();
+// libpng pulls its input from the read-ahead queue, inflating overlaps the next reads
+struct PngSource {
+    AsyncReader reader;
+    const unsigned char* data = nullptr;
+    size_t left = 0;
+};
 
-    return true;
+void readPngSource(png_structp png, png_bytep out, png_size_t length) {
+    PngSource* source = static_cast<PngSource*>(png_get_io_ptr(png));
+    while (length > 0) {
+        if (source->left == 0 && !source->reader.next(source->data, source->left)) {
+            png_error(png, "unexpected end of file");
+        }
+        size_t n = std::min<size_t>(length, source->left);
+        memcpy(out, source->data, n);
+        source->data += n;
+        source->left -= n;
+        out += n;
+        length -= n;
+    }
 }
 
-std::pair<std::vector<int>, std::vector<unsigned char>> readImage(const char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) {
+std::pair<std::vector<int>, RawBytes> readImage(const char* filename) {
+    RSTEG_TRACE_SCOPE("readImage");
+    PngSource source;
+    if (!source.reader.open(filename)) {
         fprintf(stderr, "Error:     unable to read PNG file\n");
         exit(1);
     }
 
     png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png) {
-        fclose(fp);
         fprintf(stderr, "png_create_read_struct failed.\n");
         exit(1);
     }
 
     png_infop info = png_create_info_struct(png);
     if (!info) {
-        fclose(fp);
         png_destroy_read_struct(&png, NULL, NULL);
         fprintf(stderr, "png_create_info_struct failed.\n");
         exit(1);
     }
 
     if (setjmp(png_jmpbuf(png))) {
-        fclose(fp);
         png_destroy_read_struct(&png, &info, NULL);
         fprintf(stderr, "Error during png_init_io or png_read_info.\n");
         exit(1);
     }
 
-    png_init_io(png, fp);
+    png_set_read_fn(png, &source, readPngSource);
     png_read_info(png, info);
 
     int width = png_get_image_width(png, info);
     int height = png_get_image_height(png, info);
     png_byte color_type = png_get_color_type(png, info);
-    png_byte bit_depth = png_get_bit_depth(png, info);
 
     int num_channels = (color_type == PNG_COLOR_TYPE_RGB) ? 3 : 4;
 
-    std::vector<unsigned char> imageData;
-    png_bytep row = (png_bytep)malloc(num_channels * width);
-
+    // rows are decoded straight into the (uninitialized) pixel buffer
+    RawBytes imageData(static_cast<size_t>(num_channels) * width * height);
+    size_t rowBytes = static_cast<size_t>(num_channels) * width;
     for (int y = 0; y < height; y++) {
-        png_read_row(png, row, NULL);
-        for (int x = 0; x < width; x++) {
-            for (int c = 0; c < num_channels; c++) {
-                imageData.push_back(row[x * num_channels + c]);
-            }
-        }
+        png_read_row(png, imageData.data() + y * rowBytes, NULL);
     }
 
-    free(row);
-    fclose(fp);
     png_destroy_read_struct(&png, &info, NULL);
 
-    return std::make_pair(std::vector<int>{width, height, num_channels}, imageData);
+    return std::make_pair(std::vector<int>{width, height, num_channels}, std::move(imageData));
 }
 
-bool writeImage(const char* filename, const std::vector<unsigned char>& imageData, int width, int height, int numChannels) {
+bool writeImage(const char* filename, const unsigned char* imageData, int width, int height, int numChannels) {
+    RSTEG_TRACE_SCOPE("writeImage");
     FILE* fp = fopen(filename, "wb");
     if (!fp) {
         fprintf(stderr, "Error:     failed to create output PNG\n");
@@ -120,7 +215,6 @@ bool writeImage(const char* filename, const std::vector<unsigned char>& imageDat
     if (!png) {
         fclose(fp);
         fprintf(stderr, "png_create_write_struct failed.\n");
-        fclose(fp);
         return false;
     }
 
@@ -160,13 +254,9 @@ bool writeImage(const char* filename, const std::vector<unsigned char>& imageDat
     png_set_compression_strategy(png, 0);
     png_set_filter(png, 0, PNG_FILTER_NONE);
 
-    std::vector<png_byte> row(numChannels * width);
-
+    size_t rowBytes = static_cast<size_t>(numChannels) * width;
     for (int y = 0; y < height; y++) {
-        for (int x = 0; x < numChannels * width; x++) {
-            row[x] = imageData[y * numChannels * width + x];
-        }
-        png_write_row(png, row.data());
+        png_write_row(png, const_cast<png_bytep>(imageData + y * rowBytes));
     }
 
     png_write_end(png, NULL);
@@ -177,6 +267,134 @@ bool writeImage(const char* filename, const std::vector<unsigned char>& imageDat
     return true;
 }
 
+// row-at-a-time PNG access for --max-memory, same pixel layout as readImage / writeImage
+struct PngRows {
+    FILE* fp = nullptr;
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    int width = 0;
+    int height = 0;
+    int numChannels = 0;
+};
+
+bool openPngReader(const char* filename, PngRows& rows) {
+    rows.fp = fopen(filename, "rb");
+    if (!rows.fp) {
+        fprintf(stderr, "Error:     unable to read PNG file\n");
+        return false;
+    }
+
+    rows.png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    rows.info = rows.png ? png_create_info_struct(rows.png) : NULL;
+    if (!rows.info) {
+        png_destroy_read_struct(&rows.png, NULL, NULL);
+        fclose(rows.fp);
+        fprintf(stderr, "png_create_read_struct failed.\n");
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(rows.png))) {
+        png_destroy_read_struct(&rows.png, &rows.info, NULL);
+        fclose(rows.fp);
+        fprintf(stderr, "Error during png_init_io or png_read_info.\n");
+        return false;
+    }
+
+    png_init_io(rows.png, rows.fp);
+    png_read_info(rows.png, rows.info);
+
+    rows.width = png_get_image_width(rows.png, rows.info);
+    rows.height = png_get_image_height(rows.png, rows.info);
+    rows.numChannels = (png_get_color_type(rows.png, rows.info) == PNG_COLOR_TYPE_RGB) ? 3 : 4;
+
+    return true;
+}
+
+bool readPngRows(PngRows& rows, unsigned char* out, int count) {
+    if (setjmp(png_jmpbuf(rows.png))) {
+        fprintf(stderr, "Error:     failed to read PNG rows\n");
+        return false;
+    }
+    size_t rowBytes = static_cast<size_t>(rows.width) * rows.numChannels;
+    for (int y = 0; y < count; ++y) {
+        png_read_row(rows.png, out + y * rowBytes, NULL);
+    }
+    return true;
+}
+
+void closePngReader(PngRows& rows) {
+    png_destroy_read_struct(&rows.png, &rows.info, NULL);
+    fclose(rows.fp);
+}
+
+// width, height and numChannels have to be set by the caller
+bool openPngWriter(const char* filename, PngRows& rows) {
+    if (rows.numChannels != 3 && rows.numChannels != 4) {
+        fprintf(stderr, "Error:     unsupported number of channels.\n");
+        return false;
+    }
+
+    rows.fp = fopen(filename, "wb");
+    if (!rows.fp) {
+        fprintf(stderr, "Error:     failed to create output PNG\n");
+        return false;
+    }
+
+    rows.png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    rows.info = rows.png ? png_create_info_struct(rows.png) : NULL;
+    if (!rows.info) {
+        png_destroy_write_struct(&rows.png, (png_infopp)NULL);
+        fclose(rows.fp);
+        fprintf(stderr, "png_create_write_struct failed.\n");
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(rows.png))) {
+        png_destroy_write_struct(&rows.png, &rows.info);
+        fclose(rows.fp);
+        fprintf(stderr, "Error during png_init_io or png_write_info.\n");
+        return false;
+    }
+
+    png_init_io(rows.png, rows.fp);
+    png_byte color_type = rows.numChannels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGBA;
+    png_set_IHDR(rows.png, rows.info, rows.width, rows.height, 8, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(rows.png, rows.info);
+
+    png_set_compression_level(rows.png, 0);
+    png_set_compression_strategy(rows.png, 0);
+    png_set_filter(rows.png, 0, PNG_FILTER_NONE);
+
+    return true;
+}
+
+bool writePngRows(PngRows& rows, const unsigned char* data, int count) {
+    if (setjmp(png_jmpbuf(rows.png))) {
+        fprintf(stderr, "Error:     failed to write PNG rows\n");
+        return false;
+    }
+    size_t rowBytes = static_cast<size_t>(rows.width) * rows.numChannels;
+    for (int y = 0; y < count; ++y) {
+        png_write_row(rows.png, const_cast<png_bytep>(data + y * rowBytes));
+    }
+    return true;
+}
+
+// nothing set here survives a longjmp, the result is only the return value
+bool endPngRows(PngRows& rows) {
+    if (setjmp(png_jmpbuf(rows.png))) {
+        return false;
+    }
+    png_write_end(rows.png, NULL);
+    return true;
+}
+
+bool closePngWriter(PngRows& rows) {
+    bool ok = endPngRows(rows);
+    png_destroy_write_struct(&rows.png, &rows.info);
+    return (fclose(rows.fp) == 0) && ok;
+}
+
 // extract seed
 std::vector<unsigned char> decodeSeedBytes(const std::string& filePath) {
     std::vector<unsigned char> decodedSeedBytes;
@@ -207,24 +425,43 @@ std::vector<unsigned char> decodeSeedBytes(const std::string& filePath) {
     return decodedSeedBytes;
 }
 
+// bytes of one decoded frame in the pixel formats lossless carriers decode to, 0 for others
+size_t rawFrameBytes(std::string pixelFormat, size_t width, size_t height) {
+    size_t sampleBytes = 1;
+    for (const char* deep : { "10le", "12le", "16le" }) {
+        if (pixelFormat.size() > 4 && pixelFormat.compare(pixelFormat.size() - 4, 4, deep) == 0) {
+            pixelFormat.resize(pixelFormat.size() - 4);
+            sampleBytes = 2;
+        }
+    }
+    size_t luma = width * height, chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    if (pixelFormat == "yuv420p" || pixelFormat == "yuvj420p" || pixelFormat == "nv12" || pixelFormat == "nv21")
+        return sampleBytes * (luma + 2 * chromaWidth * chromaHeight);
+    if (pixelFormat == "yuv422p" || pixelFormat == "yuvj422p")
+        return sampleBytes * (luma + 2 * chromaWidth * height);
+    if (pixelFormat == "yuv444p" || pixelFormat == "yuvj444p" || pixelFormat == "gbrp" ||
+        pixelFormat == "rgb24" || pixelFormat == "bgr24")
+        return sampleBytes * 3 * luma;
+    if (pixelFormat == "gray")
+        return sampleBytes * luma;
+    if (pixelFormat == "rgba" || pixelFormat == "bgra" || pixelFormat == "argb" || pixelFormat == "abgr" ||
+        pixelFormat == "rgb0" || pixelFormat == "bgr0" || pixelFormat == "gbrap" || pixelFormat == "yuva444p")
+        return sampleBytes * 4 * luma;
+    return 0;
+}
+
 // ffmpeg/ffprobe subroutines
-VideoInfo readVideo(const char* videoFileName) {
+VideoInfo probeVideo(const char* videoFileName) {
+    RSTEG_TRACE_SCOPE("probeVideo");
     VideoInfo videoInfo;
     std::string streamCheckCmd = "ffprobe -v error -select_streams v:0 -show_entries stream=codec_name -of default=noprint_wrappers=1:nokey=1 ";
     streamCheckCmd += videoFileName;
-    std::array<char, 128> buffer;
     std::string result;
-    FILE* pipe = popen(streamCheckCmd.c_str(), "r");
-    if (!pipe) {
+    std::string videoCodec;
+    if (runCapture(streamCheckCmd, videoCodec) < 0) {
         std::cerr << "Error: Could not open pipe to ffprobe." << std::endl;
         exit(1);
     }
-    
-    std::string videoCodec;
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        videoCodec += buffer.data();
-    }
-    pclose(pipe);
 
     if (videoCodec.empty()) {
         std::cerr << "Error: No video stream found in the input file." << std::endl;
@@ -233,37 +470,25 @@ VideoInfo readVideo(const char* videoFileName) {
 
     std::string audioCheckCmd = "ffprobe -v error -select_streams a:0 -show_entries stream=codec_name -of default=noprint_wrappers=1:nokey=1 ";
     audioCheckCmd += videoFileName;
-    pipe = popen(audioCheckCmd.c_str(), "r");
-    if (!pipe) {
+    std::string audioCodec;
+    if (runCapture(audioCheckCmd, audioCodec) < 0) {
         std::cerr << "Error: Could not open pipe to ffprobe." << std::endl;
         exit(1);
     }
-    
-    std::string audioCodec;
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        audioCodec += buffer.data();
-    }
-    pclose(pipe);
 
     if (audioCodec.empty()) {
         std::cerr << "Error: Invalid video file." << std::endl;
         exit(1);
     }
 
-    std::string metadataCmd = "ffprobe -v error -select_streams v:0 -show_entries stream=codec_name,width,height,r_frame_rate -of default=noprint_wrappers=1:nokey=1 ";
+    RSTEG_TRACE_SCOPE("probeVideo/metadata");
+    std::string metadataCmd = "ffprobe -v error -select_streams v:0 -show_entries stream=codec_name,width,height,pix_fmt,r_frame_rate,duration -of default=noprint_wrappers=1:nokey=1 ";
     metadataCmd += videoFileName;
-    pipe = popen(metadataCmd.c_str(), "r");
-    if (!pipe) {
+    if (runCapture(metadataCmd, result) < 0) {
         std::cerr << "Error: Could not open pipe to ffprobe." << std::endl;
         exit(1);
     }
 
-    result.clear();
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        result += buffer.data();
-    }
-    pclose(pipe);
-
     std::istringstream iss(result);
     std::string value;
     if (std::getline(iss, value)) {
@@ -275,6 +500,15 @@ VideoInfo readVideo(const char* videoFileName) {
     if (std::getline(iss, value)) {
         videoInfo.width = std::stoi(value);
     }
+    if (std::getline(iss, value)) {
+        videoInfo.pixelFormat = value;
+    }
+    // the decoded frame size, width and height are stored the other way round
+    videoInfo.frameBytes = rawFrameBytes(videoInfo.pixelFormat, videoInfo.height, videoInfo.width);
+    if (videoInfo.frameBytes == 0) {
+        std::cerr << "Error: unsupported pixel format " << videoInfo.pixelFormat << " in " << videoFileName << std::endl;
+        exit(1);
+    }
     if (std::getline(iss, value)) {
         std::istringstream framerateStream(value);
         int numerator, denominator;
@@ -287,30 +521,210 @@ VideoInfo readVideo(const char* videoFileName) {
         }
     }
 
-    std::string rawDataCmd = "ffmpeg -i " + std::string(videoFileName) + " -f rawvideo -";
-    pipe = popen(rawDataCmd.c_str(), "rb");
-    if (!pipe) {
+    videoInfo.numChannels = 3; // Expectation
+    // sizes the decode buffer up front (an upper bound, pages past the real size are never
+    // touched), containers without a stream duration report N/A
+    if (std::getline(iss, value) && value.find_first_not_of("0123456789.") == std::string::npos && !value.empty()) {
+        double frames = std::stod(value) * videoInfo.framerate;
+        videoInfo.estimatedBytes = static_cast<size_t>(frames + 1) * videoInfo.frameBytes;
+    }
+    std::cout << "Video Codec: " << videoInfo.codec << std::endl;
+    std::cout << "Width: " << videoInfo.width << "\tHeight: " << videoInfo.height << std::endl;
+    std::cout << "Framerate: " << videoInfo.framerate << std::endl;
+
+    return videoInfo;
+}
+
+// every video decode passes frames through as stored, none duplicated or dropped to
+// a constant rate, so whole, tiled, selected and segmented decodes see the same frames
+const std::string VIDEO_DECODE_OUTPUT = " -vsync 0 -f rawvideo -";
+
+// frameFilter limits the output to some frames, e.g. select='between(n,10,12)'
+std::string videoDecodeCommand(const char* videoFileName, const std::string& frameFilter = "") {
+    std::string filter = frameFilter.empty() ? "" : " -vf \"" + frameFilter + "\"";
+    return "ffmpeg -nostdin -i " + std::string(videoFileName) + filter + VIDEO_DECODE_OUTPUT;
+}
+
+// decoded size without keeping the frames, sizes carriers for --max-memory
+size_t countDecodedBytes(const std::string& rawDataCmd) {
+    ChildPipe child;
+    if (!spawnPipe(rawDataCmd, false, child)) {
         std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
         exit(1);
     }
 
+    std::vector<unsigned char> buffer(PIPE_BUFFER_SIZE);
+    size_t total = 0, bytesRead;
+    while ((bytesRead = readPipe(child.fd, buffer.data(), buffer.size())) > 0) {
+        total += bytesRead;
+    }
+    if (waitChild(child) != 0) {
+        std::cerr << "Error: FFmpeg failed to decode the carrier." << std::endl;
+        exit(1);
+    }
+
+    return total;
+}
+
+// A video decodes as several segments of whole GOPs at once, one ffmpeg each,
+// every one writing straight into its own offset of the carrier buffer. The
+// boundaries come from a packet index scan, nothing is decoded to find them.
+// Segments seek to half a frame before their keyframe and drop what comes
+// before it, so a container index that is off by a frame cannot shift them;
+// the cost is decoding one extra GOP per segment.
+const unsigned MAX_DECODE_SEGMENTS = 8;
+const size_t MIN_SEGMENT_FRAMES = 32;
+
+struct VideoSegment {
+    double seekTime = -1;       // -ss argument, negative for the segment at the start
+    size_t firstFrame = 0;
+    size_t frames = 0;
+};
+
+// up to count segments of about equal length, cut at keyframes. Frames are numbered in
+// presentation order, the packets' pts order. False when the stream cannot be split
+bool scanVideoSegments(const char* videoFileName, unsigned count, std::vector<VideoSegment>& segments) {
+    RSTEG_TRACE_SCOPE("scanVideoSegments");
+    std::string output;
+    std::string cmd = "ffprobe -v error -show_entries format=start_time -of default=noprint_wrappers=1:nokey=1 ";
+    if (runCapture(cmd + videoFileName, output) != 0) {
+        return false;
+    }
+    double startTime = 0;
+    try {
+        if (output.compare(0, 3, "N/A") != 0)
+            startTime = std::stod(output);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    cmd = "ffprobe -v error -select_streams v:0 -show_entries packet=pts_time,flags -of csv=p=0 ";
+    if (runCapture(cmd + videoFileName, output) != 0) {
+        return false;
+    }
+    std::vector<std::pair<double, bool>> packets;
+    std::istringstream lines(output);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t comma = line.find(',');
+        if (comma == std::string::npos || line.compare(0, comma, "N/A") == 0)
+            return false;
+        packets.emplace_back(std::stod(line.substr(0, comma)), line.compare(comma + 1, 1, "K") == 0);
+    }
+    std::sort(packets.begin(), packets.end());
+    size_t total = packets.size();
+    count = static_cast<unsigned>(std::min<size_t>(count, total / MIN_SEGMENT_FRAMES));
+    if (count < 2 || !packets.front().second) {
+        return false;
+    }
+
+    segments.assign(1, VideoSegment());
+    for (size_t frame = 1; frame < total && segments.size() < count; ++frame) {
+        if (packets[frame].second && frame >= segments.size() * total / count) {
+            VideoSegment segment;
+            segment.seekTime = (packets[frame - 1].first + packets[frame].first) / 2 - startTime;
+            segment.firstFrame = frame;
+            segments.back().frames = frame - segments.back().firstFrame;
+            segments.push_back(segment);
+        }
+    }
+    segments.back().frames = total - segments.back().firstFrame;
+    return segments.size() > 1;
+}
+
+std::string videoSegmentCommand(const char* videoFileName, const VideoSegment& segment) {
+    std::ostringstream cmd;
+    cmd << "ffmpeg -nostdin -v error";
+    if (segment.seekTime >= 0)
+        cmd << " -ss " << std::fixed << std::setprecision(6) << segment.seekTime;
+    cmd << " -i " << videoFileName << " -frames:v " << segment.frames << VIDEO_DECODE_OUTPUT;
+    return cmd.str();
+}
+
+// the segments that hold the first neededBytes, decoded concurrently; false when there is
+// nothing to run concurrently or any segment came out at a length other than its frame
+// count says, the caller decodes whole then
+bool decodeVideoSegments(const char* videoFileName, VideoInfo& videoInfo, size_t neededBytes) {
+    unsigned count = std::min(MAX_DECODE_SEGMENTS, std::thread::hardware_concurrency());
+    std::vector<VideoSegment> segments;
+    size_t frameBytes = videoInfo.frameBytes;
+    if (count <= 1 || !scanVideoSegments(videoFileName, count, segments)) {
+        return false;
+    }
+    size_t scanned = segments.size();
+    while (segments.size() > 1 && segments.back().firstFrame * frameBytes >= neededBytes) {
+        segments.pop_back();
+    }
+    if (segments.size() <= 1) {
+        return false;
+    }
+    size_t totalBytes = (segments.back().firstFrame + segments.back().frames) * frameBytes;
+    std::cout << videoFileName << ":   decoding " << segments.size() << " of " << scanned << " segments" << std::endl;
+
+    RSTEG_TRACE_SCOPE("decodeVideoSegments");
     videoInfo.rawData.clear();
-    unsigned char bufferArray[4096];
-    size_t bytesRead;
-    while ((bytesRead = fread(bufferArray, 1, sizeof(bufferArray), pipe)) > 0) {
-        videoInfo.rawData.insert(videoInfo.rawData.end(), bufferArray, bufferArray + bytesRead);
+    videoInfo.rawData.resize(totalBytes);
+    std::vector<char> decoded(segments.size(), 0);
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < segments.size(); ++k) {
+        threads.emplace_back([&, k]() {
+            RSTEG_TRACE_THREAD("segment " + std::to_string(k));
+            ChildPipe child;
+            if (!spawnPipe(videoSegmentCommand(videoFileName, segments[k]), false, child)) {
+                return;
+            }
+            size_t length = segments[k].frames * frameBytes;
+            unsigned char extra;
+            bool exact = readPipe(child.fd, videoInfo.rawData.data() + segments[k].firstFrame * frameBytes, length) == length &&
+                         readPipe(child.fd, &extra, 1) == 0;
+            decoded[k] = (waitChild(child) == 0) && exact;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (std::count(decoded.begin(), decoded.end(), 0) != 0) {
+        std::cerr << "Warning:  segmented decode of " << videoFileName << " did not line up, decoding it whole" << std::endl;
+        return false;
     }
-    pclose(pipe);
+    return true;
+}
 
-    videoInfo.numChannels = 3; // Expectation
-    std::cout << "Video Codec: " << videoInfo.codec << std::endl;
-    std::cout << "Width: " << videoInfo.width << "\tHeight: " << videoInfo.height << std::endl;
-    std::cout << "Framerate: " << videoInfo.framerate << std::endl;
+// neededBytes lets dec stop at the segment that holds the last embedded position
+void decodeVideo(const char* videoFileName, VideoInfo& videoInfo, size_t neededBytes = SIZE_MAX) {
+    RSTEG_TRACE_SCOPE("decodeVideo");
+    if (decodeVideoSegments(videoFileName, videoInfo, neededBytes)) {
+        return;
+    }
+    std::string rawDataCmd = videoDecodeCommand(videoFileName);
+    ChildPipe child;
+    if (!spawnPipe(rawDataCmd, false, child)) {
+        std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
+        exit(1);
+    }
 
+    RSTEG_TRACE_SCOPE("decodeVideo/pipe_read");
+    videoInfo.rawData.clear();
+    videoInfo.rawData.reserve(videoInfo.estimatedBytes);
+    readIntoRaw(child.fd, videoInfo.rawData);
+    if (waitChild(child) != 0) {
+        std::cerr << "Error: FFmpeg failed to decode " << videoFileName << std::endl;
+        exit(1);
+    }
+}
+
+VideoInfo readVideo(const char* videoFileName) {
+    RSTEG_TRACE_SCOPE("readVideo");
+    VideoInfo videoInfo = probeVideo(videoFileName);
+    decodeVideo(videoFileName, videoInfo);
     return videoInfo;
 }
 
-bool writeVideo(const char* inputVideoFileName, const char* outputVideoFileName, const std::vector<unsigned char>& bytes, int width, int height, double framerate, std::string& vCodec) {
+// frames go in and out in the pixel format they were decoded to, a conversion would
+// lose the embedded bits. Without keepAudio only the frames are written, the audio
+// track is muxed in afterwards
+std::string videoEncodeCommand(const char* inputVideoFileName, const char* outputVideoFileName, int width, int height, double framerate,
+                               const std::string& vCodec, const std::string& pixelFormat, bool keepAudio = true) {
     std::string codec;
     if (vCodec == "hevc")
         codec = " libx265 -x265-params lossless=1 ";
@@ -323,55 +737,57 @@ bool writeVideo(const char* inputVideoFileName, const char* outputVideoFileName,
     else
         codec = " ffv1 ";
     
-    std::string cmd = "ffmpeg -y -f rawvideo -s ";
+    std::string cmd = "ffmpeg -y -f rawvideo -pix_fmt " + pixelFormat + " -s ";
     cmd += std::to_string(width) + "x" + std::to_string(height);
     cmd += " -r " + std::to_string(framerate) + " -i - ";
     cmd += "-i " + std::string(inputVideoFileName);
-    cmd += " -map 0:v -map 1:a ";
-    cmd += " -c:v " + codec;
-    cmd += "-c:a copy -copyts ";
+    cmd += keepAudio ? " -map 0:v -map 1:a " : " -map 0:v -an ";
+    cmd += " -c:v " + codec + "-pix_fmt " + pixelFormat + " ";
+    cmd += keepAudio ? "-c:a copy -copyts " : "-copyts ";
     cmd += " -map_metadata 1 ";
     cmd += " -shortest ";
     cmd += outputVideoFileName;
+    return cmd;
+}
+
+bool writeVideo(const char* inputVideoFileName, const char* outputVideoFileName, const unsigned char* bytes, size_t size, int width, int height, double framerate,
+                std::string& vCodec, const std::string& pixelFormat, bool keepAudio = true) {
+    RSTEG_TRACE_SCOPE("writeVideo");
+    std::string cmd = videoEncodeCommand(inputVideoFileName, outputVideoFileName, width, height, framerate, vCodec, pixelFormat, keepAudio);
     std::cout << cmd << std::endl;
-    FILE* pipe = popen(cmd.c_str(), "wb");
-    if (!pipe) {
+    ChildPipe child;
+    if (!spawnPipe(cmd, true, child)) {
         std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
         return false;
     }
-    try {
-        fwrite(bytes.data(), 1, bytes.size(), pipe);
-    } catch (...) {
-        std::cerr << "Error: Failed to initialize ffmpeg." << std::endl;
-        return false;
+    // the carrier is not touched again before ffmpeg exits, its pages go to the pipe as they are
+    bool written;
+    {
+        RSTEG_TRACE_SCOPE("writeVideo/pipe_write");
+        written = splicePipe(child.fd, bytes, size);
     }
 
-    int status = _pclose(pipe);
-    if (status == -1) {
-        std::cerr << "Error: FFmpeg process failed to terminate." << std::endl;
-        exit(EXIT_FAILURE);
+    RSTEG_TRACE_SCOPE("writeVideo/ffmpeg_wait");
+    int status = waitChild(child);
+    if (!written || status != 0) {
+        std::cerr << "Error: FFmpeg failed to encode " << outputVideoFileName << " (exit status " << status << ")" << std::endl;
+        return false;
     }
 
     return true;
 }
 
-AudioInfo readAudio(const char* audioFileName) {
+AudioInfo probeAudio(const char* audioFileName) {
+    RSTEG_TRACE_SCOPE("probeAudio");
     AudioInfo audioInfo;
-    std::string cmd = "ffprobe -v error -select_streams a:0 -show_entries stream=codec_name,sample_rate,channels -of default=noprint_wrappers=1:nokey=1 ";
+    std::string cmd = "ffprobe -v error -select_streams a:0 -show_entries stream=codec_name,sample_rate,channels,duration -of default=noprint_wrappers=1:nokey=1 ";
     cmd += audioFileName;
-    std::array<char, 128> buffer;
     std::string result;
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
+    if (runCapture(cmd, result) < 0) {
         std::cerr << "Error: Could not open pipe to ffprobe." << std::endl;
         exit(1);
     }
 
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        result += buffer.data();
-    }
-    pclose(pipe);
-
     std::istringstream iss(result);
     std::string value;
     if (std::getline(iss, value)) {
@@ -383,67 +799,103 @@ AudioInfo readAudio(const char* audioFileName) {
     if (std::getline(iss, value)) {
         audioInfo.channels = std::stoi(value);
     }
+    if (std::getline(iss, value) && value.find_first_not_of("0123456789.") == std::string::npos && !value.empty()) {
+        audioInfo.estimatedBytes = static_cast<size_t>(std::stod(value) * audioInfo.sampleRate + 1) * audioInfo.channels * 2;
+    }
+
+    std::cout << "Audio Codec: " << audioInfo.codec << std::endl;
+    std::cout << "Sample Rate: " << audioInfo.sampleRate << "\tChannels: " << audioInfo.channels << std::endl;
+
+    return audioInfo;
+}
 
-    std::string rawDataCmd = "ffmpeg -i " + std::string(audioFileName) + " -f s16le -acodec pcm_s16le -";
-    pipe = popen(rawDataCmd.c_str(), "rb");
-    if (!pipe) {
+std::string audioDecodeCommand(const char* audioFileName) {
+    return "ffmpeg -nostdin -i " + std::string(audioFileName) + " -f s16le -acodec pcm_s16le -";
+}
+
+void decodeAudio(const char* audioFileName, AudioInfo& audioInfo) {
+    RSTEG_TRACE_SCOPE("decodeAudio");
+    std::string rawDataCmd = audioDecodeCommand(audioFileName);
+    ChildPipe child;
+    if (!spawnPipe(rawDataCmd, false, child)) {
         std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
         exit(1);
     }
 
+    RSTEG_TRACE_SCOPE("decodeAudio/pipe_read");
     audioInfo.rawData.clear();
-    unsigned char bufferArray[4096];
-    size_t bytesRead;
-    while ((bytesRead = fread(bufferArray, 1, sizeof(bufferArray), pipe)) > 0) {
-        audioInfo.rawData.insert(audioInfo.rawData.end(), bufferArray, bufferArray + bytesRead);
+    audioInfo.rawData.reserve(audioInfo.estimatedBytes);
+    readIntoRaw(child.fd, audioInfo.rawData);
+    if (waitChild(child) != 0) {
+        std::cerr << "Error: FFmpeg failed to decode " << audioFileName << std::endl;
+        exit(1);
     }
-    pclose(pipe);
-
-    std::cout << "Audio Codec: " << audioInfo.codec << std::endl;
-    std::cout << "Sample Rate: " << audioInfo.sampleRate << "\tChannels: " << audioInfo.channels << std::endl;
+}
 
+AudioInfo readAudio(const char* audioFileName) {
+    RSTEG_TRACE_SCOPE("readAudio");
+    AudioInfo audioInfo = probeAudio(audioFileName);
+    decodeAudio(audioFileName, audioInfo);
     return audioInfo;
 }
 
-bool writeAudio(const char* inputFile, const char* outputAudioFileName, const std::vector<unsigned char>& bytes, int sampleRate, int channels, std::string& codec) {
-    std::string codecOption; std::string fileName = std::string(outputAudioFileName);
+// lossless codecs only, .m4a for alac (aac carriers too), .wav for pcm and .flac for the rest
+std::string audioExtension(const std::string& codec) {
+    if (codec == "aac" || codec == "alac")
+        return ".m4a";
+    if (codec == "pcm_s16le")
+        return ".wav";
+    return ".flac";
+}
+
+// the output extension follows the codec, e.g. out.wav for pcm and out.flac for flac
+std::string audioEncodeCommand(const char* inputFile, const char* outputAudioFileName, int sampleRate, int channels, const std::string& codec) {
+    std::string fileName = std::string(outputAudioFileName);
     size_t dotPos = fileName.find_last_of('.');
-    fileName = fileName.substr(0, dotPos);
-    if (codec == "aac" || codec == "alac") {
-        codecOption = " alac ";
-        fileName += ".m4a";
-    } else if (codec == "pcm_s16le") {
-        codecOption = " pcm_s16le ";
-        fileName += ".wav";
-    }
-     else {
-        fileName += ".flac";
-        codecOption = " flac ";
-    }
+    std::string extension = audioExtension(codec);
+    fileName = fileName.substr(0, dotPos) + extension;
+    std::string codecOption = extension == ".m4a" ? " alac " : extension == ".wav" ? " pcm_s16le " : " flac ";
     
     std::string cmd = "ffmpeg -y -f s16le -ar " + std::to_string(sampleRate) + " -ac " + std::to_string(channels);
     cmd += " -i - -i " + std::string(inputFile);
     cmd += " -map 0:a -c:a " + codecOption + " -map_metadata 1 ";
     cmd += fileName;
+    return cmd;
+}
+
+bool writeAudio(const char* inputFile, const char* outputAudioFileName, const unsigned char* bytes, size_t size, int sampleRate, int channels, std::string& codec) {
+    RSTEG_TRACE_SCOPE("writeAudio");
+    std::string cmd = audioEncodeCommand(inputFile, outputAudioFileName, sampleRate, channels, codec);
     std::cout << cmd << std::endl;
 
-    FILE* pipe = popen(cmd.c_str(), "wb");
-    if (!pipe) {
+    ChildPipe child;
+    if (!spawnPipe(cmd, true, child)) {
         std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
         return false;
     }
-    try {
-        fwrite(bytes.data(), 1, bytes.size(), pipe);
-    } catch (...) {
-        std::cerr << "Error: Failed to initialize ffmpeg." << std::endl;
-        return false;
+    bool written;
+    {
+        RSTEG_TRACE_SCOPE("writeAudio/pipe_write");
+        written = splicePipe(child.fd, bytes, size);
     }
 
-    int status = pclose(pipe);
-    if (status == -1) {
-        std::cerr << "Error: FFmpeg process failed to terminate." << std::endl;
+    RSTEG_TRACE_SCOPE("writeAudio/ffmpeg_wait");
+    int status = waitChild(child);
+    if (!written || status != 0) {
+        std::cerr << "Error: FFmpeg failed to encode " << outputAudioFileName << " (exit status " << status << ")" << std::endl;
         return false;
     }
 
     return true;
 }
+
+// video of one file and audio of another into one container, both streams are copied as they are
+bool muxTracks(const std::string& videoFileName, const std::string& audioFileName, const std::string& outputFileName) {
+    RSTEG_TRACE_SCOPE("muxTracks");
+    std::string cmd = "ffmpeg -nostdin -v error -y -i " + videoFileName + " -i " + audioFileName;
+    cmd += " -map 0:v -map 1:a -c copy -map_metadata 0 " + outputFileName;
+    std::cout << cmd << std::endl;
+
+    std::string output;
+    return runCapture(cmd, output) == 0;
+}
@@ -1,120 +1,136 @@
-#include <random>
-#include <bitset>
-
-void encode_lsb(std::vector<unsigned char>& iData, std::vector<unsigned char>& fileData, std::vector<int>& positions) {
-	int b = 0;
-    int c = 1;
-    int shift = 6;
-    bool err = false;
-
-    std::vector<unsigned char>copyofData = fileData;
-    std::vector<unsigned char>checkbits;
-    unsigned char currentByte = 0x00;
-
-    std::cout << "encoding file ..." << std::endl;
-
-	for (auto position : positions)
-	{
-		unsigned char val = iData[position];
-
-        if(b>=fileData.size()) {
-            std::cerr << "Error:    past eof error" << std::endl;
-            break;
-        }
-
-		if (c % 5 == 0) {
-			for (auto checkbit : checkbits) {
-				unsigned char tmp1 = checkbit;
-				currentByte |= ((tmp1 & 0x03) << shift);
-				shift -= 2;
-			}
-
-            std::bitset<16> x(currentByte);
-            std::bitset<16> y(copyofData[b]);
-
-            if(currentByte != copyofData[b]) {
-                std::cout << "Error:    encoding expected:  " << x << "     got: " << y << std::endl;
-                err = true;
-            }
-
-            ++b;
-            c = 1;
-            shift = 6;
-            checkbits.clear();
-            currentByte = 0x00;
-		}
-
-		val &= 0xFC;
-		auto tmp = fileData[b];
-		val |= ((tmp & 0xc0) >> 6);
-
-        unsigned char dataToWrite = static_cast<unsigned char>((tmp & 0xc0) >> 6);
-
-		checkbits.push_back(val);
-
-		fileData[b] <<= 2;
-
-		++c;
-            
-		iData[position] = val;
- 	}
-}
-
-std::vector<unsigned char> decode_file(std::vector<unsigned char>& iFile, std::vector<int>& positions) {
-
-    std::cout << "decoding file ..." << std::endl;
-
-    std::vector<unsigned char> data;
-    unsigned char currentByte = 0x00;
-    int shift = 6; int b = 0; int n = 0; int corrupt = 0;
-
-    for (auto position : positions) {
-
-        unsigned char val = iFile[position];
-            
-        unsigned char tmp = val;
-
-        currentByte |= ((tmp & 0x03) << shift);
-
-        shift -= 2;
-        ++n;
-
-        if (shift < 0) {
-            data.push_back(currentByte);
-            currentByte = 0x00;
-            shift = 6;
-        }
-    }
-
-    return data;
-}
-
-std::vector<int> entropyChannel(std::uint64_t seed) {
-    if (seed == 0) {
-        std::cerr << "Error: bad seed" << std::endl;
-        exit(1);
-    }
-
-    std::cout << "Generating entropy ..." << std::endl;
-
-    int numPos = 0;
-    int pos_len = seed % 10;
-    seed /= 10;
-    for (int i = 0; i < pos_len; ++i) {
-        numPos += (seed % 10) * static_cast<int>(pow(10, i));
-        seed /= 10;
-    }
-
-    if (numPos <= 0) {
-        std::cerr << "Error: bad entropy" << std::endl;
-        exit(1);
-    }
-
-    std::vector<int> pos(numPos);
-    std::iota(pos.begin(), pos.end(), 0);
-    std::seed_seq seedSeq{ static_cast<unsigned int>(seed) };
-    std::mt19937_64 gen(seedSeq);
-    std::shuffle(pos.begin(), pos.end(), gen);
-
-    return pos;
-}
+#include <random>
+#include <bitset>
+#include "prng_helpers.hpp"
+
+// carrier bytes are prefetched this many positions ahead of the embed and extract
+// loops, enough to cover a miss whatever the layout
+const std::uint64_t PREFETCH_DISTANCE = 32;
+
+// 2 bits per position, most significant pair first
+void encode_lsb(unsigned char* iData, const std::vector<unsigned char>& fileData, const PositionTable& positions) {
+    RSTEG_TRACE_SCOPE("encode_lsb");
+    std::cout << "encoding file ..." << std::endl;
+
+    std::uint64_t count = positions.size();
+    if (count > fileData.size() * std::uint64_t(4)) {
+        std::cerr << "Error:    past eof error" << std::endl;
+        count = fileData.size() * std::uint64_t(4);
+    }
+
+    withPositions(positions, [&](const auto& pos) {
+        for (std::uint64_t i = 0; i < count; ++i) {
+            if (i + PREFETCH_DISTANCE < count)
+                __builtin_prefetch(&iData[pos[i + PREFETCH_DISTANCE]], 1);
+            unsigned char bits = (fileData[i >> 2] >> (6 - 2 * (i & 3))) & 0x03;
+            unsigned char& val = iData[pos[i]];
+            val = (val & 0xFC) | bits;
+        }
+    });
+}
+
+void encode_lsb(RawBytes& iData, const std::vector<unsigned char>& fileData, const PositionTable& positions) {
+    encode_lsb(iData.data(), fileData, positions);
+}
+
+// opt-in post-pass over an embedded carrier, returns the number of bad bytes
+size_t verify_lsb(const unsigned char* iData, const std::vector<unsigned char>& fileData, const PositionTable& positions) {
+    RSTEG_TRACE_SCOPE("verify_lsb");
+    std::cout << "verifying embedded bytes ..." << std::endl;
+
+    size_t errors = 0;
+    size_t count = std::min<std::uint64_t>(positions.size() / 4, fileData.size());
+    withPositions(positions, [&](const auto& pos) {
+        for (size_t b = 0; b < count; ++b) {
+            unsigned char currentByte = 0x00;
+            for (size_t k = 0; k < 4; ++k) {
+                currentByte |= (iData[pos[b * 4 + k]] & 0x03) << (6 - 2 * k);
+            }
+
+            if (currentByte != fileData[b]) {
+                if (errors < 16) {
+                    std::bitset<16> x(fileData[b]);
+                    std::bitset<16> y(currentByte);
+                    std::cout << "Error:    encoding expected:  " << x << "     got: " << y << std::endl;
+                }
+                ++errors;
+            }
+        }
+    });
+
+    return errors;
+}
+
+// a trailing partial group of positions does not make a byte
+std::vector<unsigned char> decode_file(const unsigned char* iFile, const PositionTable& positions) {
+    RSTEG_TRACE_SCOPE("decode_file");
+
+    std::cout << "decoding file ..." << std::endl;
+
+    std::vector<unsigned char> data(positions.size() / 4);
+    withPositions(positions, [&](const auto& pos) {
+        std::uint64_t ahead = PREFETCH_DISTANCE / 4;
+        for (size_t b = 0; b < data.size(); ++b) {
+            const auto* group = &pos[b * 4];
+            if (b + ahead < data.size()) {
+                for (int k = 0; k < 4; ++k)
+                    __builtin_prefetch(&iFile[group[ahead * 4 + k]]);
+            }
+            data[b] = static_cast<unsigned char>(((iFile[group[0]] & 0x03) << 6) | ((iFile[group[1]] & 0x03) << 4)
+                                                 | ((iFile[group[2]] & 0x03) << 2) | (iFile[group[3]] & 0x03));
+        }
+    });
+
+    return data;
+}
+
+std::vector<unsigned char> decode_file(const RawBytes& iFile, const PositionTable& positions) {
+    return decode_file(iFile.data(), positions);
+}
+
+// containers before trailer version 2 packed the position count into the seed:
+// random value, then the decimal digits of numPos, then their count. Strips the
+// count off the seed and returns it, 0 if the seed does not carry one
+std::uint64_t unpackSeed(std::uint64_t& seed) {
+    std::uint64_t numPos = 0, scale = 1;
+    int pos_len = seed % 10;
+    seed /= 10;
+    for (int i = 0; i < pos_len; ++i) {
+        numPos += (seed % 10) * scale;
+        scale *= 10;
+        seed /= 10;
+    }
+    return numPos;
+}
+
+// generator defaults to the legacy backend, dec passes the id and layout from the trailer
+PositionTable entropyChannel(std::uint64_t seed, std::uint64_t numPos, unsigned char generator = GEN_MT19937,
+                             bool blockLayout = false) {
+    RSTEG_TRACE_SCOPE("entropyChannel");
+    if (seed == 0) {
+        std::cerr << "Error: bad seed" << std::endl;
+        exit(1);
+    }
+
+    std::cout << "Generating entropy ..." << std::endl;
+
+    if (numPos == 0) {
+        std::cerr << "Error: bad entropy" << std::endl;
+        exit(1);
+    }
+
+    PositionTable table;
+    if (numPos > POSITION_NARROW_LIMIT)
+        table.wide.resize(numPos);
+    else
+        table.narrow.resize(numPos);
+
+    RSTEG_TRACE_SCOPE("entropyChannel/shuffle");
+    if (blockLayout) {
+        blockShufflePositions(table, seed, generator);
+    } else {
+        withPositions(table, [](auto& pos) { std::iota(pos.begin(), pos.end(), 0); });
+        shufflePositions(table, seed, generator);
+    }
+
+    return table;
+}
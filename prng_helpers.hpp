@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <openssl/evp.h>
+
+// Position generators. The id is stored in the trailer (byte 7) so a container
+// always decodes with the generator it was written with. Only GEN_MT19937 goes
+// through std::shuffle, whose output is up to the standard library; the other
+// backends use the Fisher-Yates below and produce the same order on every build.
+enum PositionGenerator : unsigned char {
+    GEN_MT19937 = 0,      // seed_seq + mt19937_64 + std::shuffle, containers before the generator id
+    GEN_XOSHIRO256 = 1,   // xoshiro256** seeded through splitmix64
+    GEN_AES_CTR = 2,      // AES-128-CTR keystream, key = SHA-256 of the seed
+    GEN_FEISTEL = 3,      // keyed Feistel permutation, any position computable on its own
+    GEN_COUNT
+};
+
+const unsigned char DEFAULT_GENERATOR = GEN_XOSHIRO256;
+
+const char* generatorName(unsigned char generator) {
+    switch (generator) {
+    case GEN_MT19937:
+        return "mt19937";
+    case GEN_XOSHIRO256:
+        return "xoshiro256";
+    case GEN_AES_CTR:
+        return "aes-ctr";
+    case GEN_FEISTEL:
+        return "feistel";
+    default:
+        return "unknown";
+    }
+}
+
+bool parseGenerator(const std::string& name, unsigned char& generator) {
+    for (unsigned char g = 0; g < GEN_COUNT; ++g) {
+        if (name == generatorName(g)) {
+            generator = g;
+            return true;
+        }
+    }
+    return false;
+}
+
+class Xoshiro256 {
+public:
+    explicit Xoshiro256(std::uint64_t seed) {
+        for (auto& word : s) {
+            seed += 0x9E3779B97F4A7C15ULL;
+            std::uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    std::uint64_t next() {
+        std::uint64_t result = rotl(s[1] * 5, 7) * 9;
+        std::uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+private:
+    static std::uint64_t rotl(std::uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    std::uint64_t s[4];
+};
+
+// keystream is produced a block of words at a time, the CTR counter lives in the context
+class AesCtrStream {
+public:
+    static const size_t BLOCK_WORDS = 1024;
+
+    explicit AesCtrStream(std::uint64_t seed) : ctx(EVP_CIPHER_CTX_new()) {
+        unsigned char seedBytes[8], digest[32], iv[16] = { 0 };
+        for (int b = 0; b < 8; ++b) {
+            seedBytes[b] = (seed >> (8 * b)) & 0xFF;
+        }
+        unsigned int digestLength = 0;
+        EVP_Digest(seedBytes, sizeof(seedBytes), digest, &digestLength, EVP_sha256(), NULL);
+        EVP_EncryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, digest, iv);
+    }
+
+    ~AesCtrStream() { EVP_CIPHER_CTX_free(ctx); }
+
+    AesCtrStream(const AesCtrStream&) = delete;
+    AesCtrStream& operator=(const AesCtrStream&) = delete;
+
+    std::uint64_t next() {
+        if (used == BLOCK_WORDS) {
+            refill();
+        }
+        const unsigned char* p = keystream + 8 * used++;
+        std::uint64_t value = 0;
+        for (int b = 7; b >= 0; --b) {
+            value = (value << 8) | p[b];
+        }
+        return value;
+    }
+
+private:
+    void refill() {
+        static const unsigned char zeros[8 * BLOCK_WORDS] = { 0 };
+        int length = 0;
+        EVP_EncryptUpdate(ctx, keystream, &length, zeros, sizeof(zeros));
+        used = 0;
+    }
+
+    EVP_CIPHER_CTX* ctx;
+    unsigned char keystream[8 * BLOCK_WORDS];
+    size_t used = BLOCK_WORDS;
+};
+
+// Position tables hold 32-bit entries while the count fits in 31 bits and
+// 64-bit entries beyond that, so carriers past 2 GB are addressable without
+// doubling the table for everything smaller. The top bit of an entry is never
+// part of a position, invertPositions uses it as a visited mark.
+const std::uint64_t POSITION_NARROW_LIMIT = std::uint64_t(1) << 31;
+
+struct PositionTable {
+    std::vector<std::uint32_t> narrow;
+    std::vector<std::uint64_t> wide;
+
+    bool isWide() const { return !wide.empty(); }
+    std::uint64_t size() const { return isWide() ? wide.size() : narrow.size(); }
+    std::uint64_t operator[](std::uint64_t i) const { return isWide() ? wide[i] : narrow[i]; }
+    size_t entryBytes() const { return isWide() ? sizeof(std::uint64_t) : sizeof(std::uint32_t); }
+};
+
+size_t positionEntryBytes(std::uint64_t numPos) {
+    return numPos > POSITION_NARROW_LIMIT ? sizeof(std::uint64_t) : sizeof(std::uint32_t);
+}
+
+// hot loops are written once against the entry type and run on whichever vector is in use
+template <typename Table, typename Fn>
+auto withPositions(Table& table, Fn&& fn) {
+    return table.isWide() ? fn(table.wide) : fn(table.narrow);
+}
+
+// Permutation of [0, n) that is evaluated per index instead of shuffled, what
+// dec --range needs to find the positions of a few stream bytes. A balanced
+// Feistel network over the next even power of two, round keys from xoshiro256**,
+// cycle-walking until the result falls back into [0, n) (under 4 steps on average).
+class FeistelPermutation {
+public:
+    static const int ROUNDS = 6;
+
+    FeistelPermutation(std::uint64_t seed, std::uint64_t n) : n(n) {
+        int bits = 2;
+        while (bits < 64 && (std::uint64_t(1) << bits) < n) {
+            ++bits;
+        }
+        halfBits = (bits + 1) / 2;
+        mask = (std::uint64_t(1) << halfBits) - 1;
+        Xoshiro256 gen(seed);
+        for (auto& key : keys) {
+            key = gen.next();
+        }
+    }
+
+    std::uint64_t operator()(std::uint64_t i) const {
+        do {
+            i = permute(i);
+        } while (i >= n);
+        return i;
+    }
+
+private:
+    std::uint64_t permute(std::uint64_t x) const {
+        std::uint64_t left = x >> halfBits, right = x & mask;
+        for (int r = 0; r < ROUNDS; ++r) {
+            std::uint64_t z = (right ^ keys[r]) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            std::uint64_t next = left ^ ((z ^ (z >> 31)) & mask);
+            left = right;
+            right = next;
+        }
+        return (left << halfBits) | right;
+    }
+
+    std::uint64_t n;
+    int halfBits;
+    std::uint64_t mask;
+    std::uint64_t keys[ROUNDS];
+};
+
+bool seekableGenerator(unsigned char generator) {
+    return generator == GEN_FEISTEL;
+}
+
+// unbiased draw in [0, range) from the top 32 bits, Lemire's multiply-shift with rejection
+template <typename Gen>
+std::uint32_t boundedDraw(Gen& gen, std::uint32_t range) {
+    std::uint64_t m = (gen.next() >> 32) * range;
+    std::uint32_t low = static_cast<std::uint32_t>(m);
+    if (low < range) {
+        std::uint32_t threshold = static_cast<std::uint32_t>(-range) % range;
+        while (low < threshold) {
+            m = (gen.next() >> 32) * range;
+            low = static_cast<std::uint32_t>(m);
+        }
+    }
+    return static_cast<std::uint32_t>(m >> 32);
+}
+
+// 64x64 -> 128 bit product split into halves, without relying on __int128
+void multiply64(std::uint64_t a, std::uint64_t b, std::uint64_t& high, std::uint64_t& low) {
+    std::uint64_t aLow = a & 0xFFFFFFFF, aHigh = a >> 32;
+    std::uint64_t bLow = b & 0xFFFFFFFF, bHigh = b >> 32;
+    std::uint64_t ll = aLow * bLow, lh = aLow * bHigh, hl = aHigh * bLow, hh = aHigh * bHigh;
+    std::uint64_t mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+    low = (mid << 32) | (ll & 0xFFFFFFFF);
+    high = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+}
+
+// same draw over the full 64-bit output, only used for ranges past 2^32
+template <typename Gen>
+std::uint64_t boundedDraw64(Gen& gen, std::uint64_t range) {
+    std::uint64_t high, low;
+    multiply64(gen.next(), range, high, low);
+    if (low < range) {
+        std::uint64_t threshold = (0 - range) % range;
+        while (low < threshold) {
+            multiply64(gen.next(), range, high, low);
+        }
+    }
+    return high;
+}
+
+// tables up to 2^32 entries shuffle exactly as they did with 32-bit positions
+template <typename Pos, typename Gen>
+void fisherYates(Pos* pos, std::uint64_t n, Gen& gen) {
+    std::uint64_t i = n;
+    for (; i > 0xFFFFFFFFULL; --i) {
+        std::swap(pos[i - 1], pos[boundedDraw64(gen, i)]);
+    }
+    for (; i > 1; --i) {
+        std::swap(pos[i - 1], pos[boundedDraw(gen, static_cast<std::uint32_t>(i))]);
+    }
+}
+
+template <typename Pos, typename Gen>
+void fisherYates(std::vector<Pos>& pos, Gen& gen) {
+    fisherYates(pos.data(), pos.size(), gen);
+}
+
+// state each backend carries next to the position table, for rsteg_bench
+size_t generatorStateBytes(unsigned char generator) {
+    switch (generator) {
+    case GEN_MT19937:
+        return sizeof(std::mt19937_64);
+    case GEN_XOSHIRO256:
+        return sizeof(Xoshiro256);
+    case GEN_AES_CTR:
+        return sizeof(AesCtrStream);
+    case GEN_FEISTEL:
+        return sizeof(FeistelPermutation);
+    default:
+        return 0;
+    }
+}
+
+void shufflePositions(PositionTable& table, std::uint64_t seed, unsigned char generator) {
+    withPositions(table, [&](auto& pos) {
+        switch (generator) {
+        case GEN_XOSHIRO256: {
+            Xoshiro256 gen(seed);
+            fisherYates(pos, gen);
+            break;
+        }
+        case GEN_AES_CTR: {
+            AesCtrStream gen(seed);
+            fisherYates(pos, gen);
+            break;
+        }
+        case GEN_FEISTEL: {
+            FeistelPermutation perm(seed, pos.size());
+            for (size_t i = 0; i < pos.size(); ++i) {
+                pos[i] = static_cast<typename std::decay_t<decltype(pos)>::value_type>(perm(i));
+            }
+            break;
+        }
+        default: {
+            std::seed_seq seedSeq{ static_cast<unsigned int>(seed) };
+            std::mt19937_64 gen(seedSeq);
+            std::shuffle(pos.begin(), pos.end(), gen);
+            break;
+        }
+        }
+    });
+}
+
+// Block layout (--layout block, trailer flag bit 0). Positions are a keyed order
+// of LAYOUT_BLOCK_SIZE blocks, one 4 KB page of carrier each, and a keyed
+// shuffle inside every block; a tail shorter than a block is shuffled on its
+// own at the end. Every 4096 consecutive positions stay in one page, so the
+// embed and extract loops touch one page at a time instead of missing the
+// cache and TLB on every access.
+const std::uint64_t LAYOUT_BLOCK_SIZE = 4096;
+
+// independent key per block for the seekable generator, splitmix64 of seed and block
+std::uint64_t blockSeed(std::uint64_t seed, std::uint64_t block) {
+    std::uint64_t z = seed + (block + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// block layout of the Feistel generator, any position computable on its own.
+// The permutation of the last block used is kept, neighbouring indices reuse it
+class FeistelBlockLayout {
+public:
+    FeistelBlockLayout(std::uint64_t seed, std::uint64_t n)
+        : seed(seed), n(n), blocks(n / LAYOUT_BLOCK_SIZE), order(seed, std::max<std::uint64_t>(blocks, 1)),
+          inner(blockSeed(seed, 0), LAYOUT_BLOCK_SIZE) {}
+
+    std::uint64_t operator()(std::uint64_t i) {
+        std::uint64_t block = i / LAYOUT_BLOCK_SIZE;
+        if (block != current) {
+            std::uint64_t size = block < blocks ? LAYOUT_BLOCK_SIZE : n - blocks * LAYOUT_BLOCK_SIZE;
+            inner = FeistelPermutation(blockSeed(seed, block), size);
+            current = block;
+        }
+        std::uint64_t base = block < blocks ? order(block) * LAYOUT_BLOCK_SIZE : block * LAYOUT_BLOCK_SIZE;
+        return base + inner(i % LAYOUT_BLOCK_SIZE);
+    }
+
+private:
+    std::uint64_t seed;
+    std::uint64_t n;
+    std::uint64_t blocks;
+    FeistelPermutation order;
+    FeistelPermutation inner;
+    std::uint64_t current = UINT64_MAX;
+};
+
+// the other generators shuffle the block order with the seed, then every block
+// in stream order from one generator keyed with blockSeed(seed, UINT64_MAX)
+void blockShufflePositions(PositionTable& table, std::uint64_t seed, unsigned char generator) {
+    std::uint64_t numPos = table.size(), blocks = numPos / LAYOUT_BLOCK_SIZE;
+    if (generator == GEN_FEISTEL) {
+        FeistelBlockLayout layout(seed, numPos);
+        withPositions(table, [&](auto& pos) {
+            using Pos = typename std::decay_t<decltype(pos)>::value_type;
+            for (std::uint64_t i = 0; i < numPos; ++i) {
+                pos[i] = static_cast<Pos>(layout(i));
+            }
+        });
+        return;
+    }
+
+    PositionTable order;
+    order.narrow.resize(blocks);
+    std::iota(order.narrow.begin(), order.narrow.end(), 0);
+    shufflePositions(order, seed, generator);
+
+    std::uint64_t innerSeed = blockSeed(seed, UINT64_MAX);
+    withPositions(table, [&](auto& pos) {
+        using Pos = typename std::decay_t<decltype(pos)>::value_type;
+        for (std::uint64_t b = 0; b < blocks; ++b) {
+            Pos base = static_cast<Pos>(std::uint64_t(order.narrow[b]) * LAYOUT_BLOCK_SIZE);
+            for (std::uint64_t j = 0; j < LAYOUT_BLOCK_SIZE; ++j) {
+                pos[b * LAYOUT_BLOCK_SIZE + j] = base + static_cast<Pos>(j);
+            }
+        }
+        for (std::uint64_t i = blocks * LAYOUT_BLOCK_SIZE; i < numPos; ++i) {
+            pos[i] = static_cast<Pos>(i);
+        }
+
+        auto shuffleBlocks = [&](auto& gen) {
+            for (std::uint64_t start = 0; start < numPos; start += LAYOUT_BLOCK_SIZE) {
+                fisherYates(pos.data() + start, std::min(LAYOUT_BLOCK_SIZE, numPos - start), gen);
+            }
+        };
+        if (generator == GEN_AES_CTR) {
+            AesCtrStream gen(innerSeed);
+            shuffleBlocks(gen);
+        } else if (generator == GEN_XOSHIRO256) {
+            Xoshiro256 gen(innerSeed);
+            shuffleBlocks(gen);
+        } else {
+            std::seed_seq seedSeq{ static_cast<unsigned int>(innerSeed) };
+            std::mt19937_64 gen(seedSeq);
+            for (std::uint64_t start = 0; start < numPos; start += LAYOUT_BLOCK_SIZE) {
+                std::shuffle(pos.begin() + start, pos.begin() + std::min(numPos, start + LAYOUT_BLOCK_SIZE), gen);
+            }
+        }
+    });
+}
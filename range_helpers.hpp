@@ -0,0 +1,66 @@
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// dec --range OFFSET:LEN. The plaintext range widens to whole CBC blocks plus
+// the block before them (their IV), every shard's share of that widens to the
+// checksum chunks covering it, and only the carrier bytes holding those chunks
+// and their table entries are read.
+
+struct ByteSpan {
+    std::uint64_t begin = 0;
+    std::uint64_t end = 0;
+
+    std::uint64_t size() const { return end > begin ? end - begin : 0; }
+};
+
+// OFFSET:LEN, both plain bytes or with a K/M/G suffix
+bool parseByteRange(const std::string& text, std::uint64_t& offset, std::uint64_t& length) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string offsetText = text.substr(0, colon);
+    size_t value = 0;
+    if (offsetText == "0") {
+        offset = 0;
+    } else if (parseMemorySize(offsetText, value)) {
+        offset = value;
+    } else {
+        return false;
+    }
+    if (!parseMemorySize(text.substr(colon + 1), value)) {
+        return false;
+    }
+    length = value;
+    return true;
+}
+
+// ciphertext needed for plaintext [offset, offset + length): the covering blocks and the one before
+ByteSpan cipherSpanFor(std::uint64_t offset, std::uint64_t length, std::uint64_t cipherLength) {
+    std::uint64_t end = std::min(offset + length, cipherLength);
+    std::uint64_t firstBlock = offset / AES_BLOCK_SIZE, lastBlock = (end - 1) / AES_BLOCK_SIZE;
+    ByteSpan span;
+    span.begin = firstBlock ? (firstBlock - 1) * AES_BLOCK_SIZE : 0;
+    span.end = (lastBlock + 1) * AES_BLOCK_SIZE;
+    return span;
+}
+
+// whole checksum chunks around [begin, end) of a shard's payload, AES blocks when it has no table
+ByteSpan chunkSpanFor(std::uint64_t begin, std::uint64_t end, std::uint64_t payloadLength, unsigned char chunkShift) {
+    std::uint64_t chunkSize = chunkShift ? std::uint64_t(1) << chunkShift : AES_BLOCK_SIZE;
+    ByteSpan span;
+    span.begin = begin / chunkSize * chunkSize;
+    span.end = std::min((end + chunkSize - 1) / chunkSize * chunkSize, payloadLength);
+    return span;
+}
+
+// ffmpeg select expression for runs of frame numbers, e.g. select='between(n,4,6)+between(n,9,9)'
+std::string frameSelectFilter(const std::vector<std::pair<std::uint64_t, std::uint64_t>>& runs) {
+    std::string filter = "select='";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        filter += (i ? "+between(n," : "between(n,") + std::to_string(runs[i].first) + "," + std::to_string(runs[i].second) + ")";
+    }
+    return filter + "'";
+}
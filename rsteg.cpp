@@ -1,30 +1,44 @@
 #include <iomanip>
 #include <algorithm>
 #include <chrono>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <filesystem>
 #include "io_helpers.hpp"
+#include "image_helpers.hpp"
 #include "lsb_rand.hpp"
 #include "aes_helpers.hpp"
+#include "trailer_helpers.hpp"
+#include "stats_helpers.hpp"
+#include "tile_helpers.hpp"
+#include "range_helpers.hpp"
+#include "cache_helpers.hpp"
+#include "bitmap_helpers.hpp"
 
-const std::uint64_t MIN = std::numeric_limits<std::uint16_t>::max();
-const std::uint64_t MAX = std::numeric_limits<std::uint32_t>::max();
+RunStats runStats;
 
-std::uint64_t generateSeed(int numPos) {
+// the position count travels in the trailer, so all 64 bits are seed
+std::uint64_t generateSeed() {
     auto now = std::chrono::high_resolution_clock::now();
     auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
     std::mt19937_64 rng(static_cast<std::uint64_t>(nanoseconds));
-    std::uniform_int_distribution<std::uint64_t> distribution(MIN, MAX);
-    std::uint64_t seedVal = distribution(rng);
-    int size = static_cast<uint32_t>(log10(numPos) + 1);
-
-    std::stringstream Stream;
-    Stream << seedVal << numPos << size;
-    std::uint64_t f_seed;
-    Stream >> f_seed;
+    std::uniform_int_distribution<std::uint64_t> distribution(1, std::numeric_limits<std::uint64_t>::max());
+    std::uint64_t f_seed = distribution(rng);
     std::cout << "using seed:   " << f_seed << std::endl;
 
     return f_seed;
 }
 
+bool hasFlag(int argc, char** argv, const std::string& flag) {
+    for (int i = 2; i < argc; ++i) {
+        if (flag == argv[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
 // Parse args
 bool parseArgs(int& argc, char** argv, std::vector<int>& index) {
     std::vector<std::string> args(argv, argv + argc);
@@ -44,6 +58,9 @@ bool parseArgs(int& argc, char** argv, std::vector<int>& index) {
         std::cout << "+-------+-------------------------------------------------------------------+\n";
         std::cout << "| enc   | encrypt file and embed in container                               |\n";
         std::cout << "| dec   | extract from container and decrypt files                          |\n";
+        std::cout << "| update| replace the payload of a stego container in place                 |\n";
+        std::cout << "|       |     rewrites only the positions whose bits change, keys as enc    |\n";
+        std::cout << "| probe | detect stego containers from their trailer [ files / dirs ]      |\n";
         std::cout << "+------------------+--------------------------------------------------------+\n";
         std::cout << "| Key-derivation   | Description                                            |\n";
         std::cout << "+------------------+--------------------------------------------------------+\n";
@@ -57,9 +74,11 @@ bool parseArgs(int& argc, char** argv, std::vector<int>& index) {
         std::cout << "|  -i     | container file path                                             |\n";
         std::cout << "|         |     - input container path [ mode : enc ]                       |\n";
         std::cout << "|         |     - stego container path [ mode : dec ]                       |\n";
+        std::cout << "|         |     - repeat -i to shard the payload across several containers  |\n";
         std::cout << "|         |                                                                 |\n";
         std::cout << "|         | supported containers                                            |\n";
-        std::cout << "|         | [ .png  .avi .mov .mkv .mp4 .webm .m2ts .wav .flac .alac ]      |\n";
+        std::cout << "|         | [ .png .qoi .webp .avi .mov .mkv .mp4 .webm .m2ts .wav .flac ]  |\n";
+        std::cout << "|         | [ .ppm .pam .bmp .tif ] uncompressed, embedded in place         |\n";
         std::cout << "|         |                                                                 |\n";
         std::cout << "|         |                                                                 |\n";
         std::cout << "|  -o     | output path [ optional ]                                        |\n";
@@ -67,8 +86,29 @@ bool parseArgs(int& argc, char** argv, std::vector<int>& index) {
         std::cout << "|         |     - default [ mode : dec ]  file.[ embed file extension ]     |\n";
         std::cout << "|         |                                                                 |\n";
         std::cout << "|  -m     | path to file [ .txt / most archival formats supported ]         |\n";
+        std::cout << "|         |     - use - to read the file from stdin [ mode : enc ]          |\n";
+        std::cout << "|         |     - -o - writes the file to stdout    [ mode : dec ]          |\n";
         std::cout << "|  -rk    | path to openssl generated EC public key                         |\n";
+        std::cout << "|         |     - repeat -rk to address several recipients  [ mode : enc ]  |\n";
         std::cout << "|  -pk    | path to openssl generated EC private key                        |\n";
+        std::cout << "| --prng  | position generator [ xoshiro256 / aes-ctr / mt19937 /           |\n";
+        std::cout << "|         |     feistel (seekable, fastest --range) ]       [ mode : enc ]  |\n";
+        std::cout << "| --layout| position layout [ shuffle / block ], block keeps runs of        |\n";
+        std::cout << "|         |     4096 positions in one page of the carrier   [ mode : enc ]  |\n";
+        std::cout << "| --check | re-read every embedded byte after encoding      [ mode : enc ]  |\n";
+        std::cout << "| --verify| extract and decrypt the payload from memory while the output    |\n";
+        std::cout << "|         |     is written, --verify-output re-decodes it   [ mode : enc ]  |\n";
+        std::cout << "|--audio- | also embed into the audio track of video carriers, both streams |\n";
+        std::cout << "| track   |     are encoded side by side and muxed          [ mode : enc ]  |\n";
+        std::cout << "|--recover| keep the intact chunks of a damaged container   [ mode : dec ]  |\n";
+        std::cout << "| --range | extract payload bytes OFFSET:LEN only           [ mode : dec ]  |\n";
+        std::cout << "|--max-   | cap data buffers, e.g. 512M; carriers stream through tiles      |\n";
+        std::cout << "| memory  |     and shards run one at a time                                |\n";
+        std::cout << "| --stats | write per-stage timing, bytes and peak RSS as JSON [ file / - ] |\n";
+        std::cout << "| --quiet | no progress output on stdout                                    |\n";
+        std::cout << "| --trace | write a Chrome trace of the pipeline [ needs -DRSTEG_TRACE=ON ] |\n";
+        std::cout << "| --cache | keep decoded carriers in a directory, reused by content hash    |\n";
+        std::cout << "|         |     --cache-max caps it, default 4G             [ mode : enc ]  |\n";
         std::cout << "+---------+-----------------------------------------------------------------+\n";
 
         return false;
@@ -77,11 +117,18 @@ bool parseArgs(int& argc, char** argv, std::vector<int>& index) {
     if (strcmp(argv[1], "enc") == 0) {
         if (argc < 10) {
             std::cerr << "usage: rsteg enc\n" << std::endl;
-            std::cerr << "          -i      [ container ]" << std::endl;
+            std::cerr << "          -i      [ container ] ( repeat for sharding )" << std::endl;
             std::cerr << "          -m      [ embed file ]" << std::endl;
-            std::cerr << "          -rk     [ recipient's public key ]" << std::endl;
+            std::cerr << "          -rk     [ recipient's public key ] ( repeat for several recipients )" << std::endl;
             std::cerr << "          -pk     [ sender's private key ]" << std::endl;
-            std::cerr << "OPTIONAL: -o      [ output file ]\n" << std::endl;
+            std::cerr << "OPTIONAL: -o      [ output file ]" << std::endl;
+            std::cerr << "          --prng  [ xoshiro256 / aes-ctr / mt19937 / feistel ]" << std::endl;
+            std::cerr << "          --layout [ shuffle / block ]" << std::endl;
+            std::cerr << "          --max-memory [ budget, e.g. 512M ]" << std::endl;
+            std::cerr << "          --cache [ directory ] --cache-max [ size, default 4G ]" << std::endl;
+            std::cerr << "          --audio-track ( embed into the audio of video carriers as well )" << std::endl;
+            std::cerr << "          --check ( verify the embedded bytes )" << std::endl;
+            std::cerr << "          --verify ( extract and decrypt in memory ) --verify-output ( re-decode the output )\n" << std::endl;
             std::cerr << "rsteg --help for more information" << std::endl;
 
             return false;
@@ -104,10 +151,13 @@ bool parseArgs(int& argc, char** argv, std::vector<int>& index) {
     else if (strcmp(argv[1], "dec") == 0) {
         if (argc < 8) {
             std::cerr << "usage: rsteg dec\n" << std::endl;
-            std::cerr << "          -i      [ container ]" << std::endl;
+            std::cerr << "          -i      [ container ] ( repeat for every shard )" << std::endl;
             std::cerr << "          -rk     [ sender's public key ]" << std::endl;
             std::cerr << "          -pk     [ recipient's private key ]" << std::endl;
-            std::cerr << "OPTIONAL: -o      [ output file ]\n" << std::endl;
+            std::cerr << "OPTIONAL: -o      [ output file ]" << std::endl;
+            std::cerr << "          --max-memory [ budget, e.g. 512M ]" << std::endl;
+            std::cerr << "          --range [ OFFSET:LEN, e.g. 1M:64K ]" << std::endl;
+            std::cerr << "          --recover ( write the intact chunks of a damaged container )\n" << std::endl;
             std::cerr << "rsteg --help for more information" << std::endl;
 
             return false;
@@ -127,6 +177,39 @@ bool parseArgs(int& argc, char** argv, std::vector<int>& index) {
         }
     }
 
+    else if (strcmp(argv[1], "update") == 0) {
+        if (argc < 10) {
+            std::cerr << "usage: rsteg update\n" << std::endl;
+            std::cerr << "          -i      [ stego container ] ( repeat for every shard, rewritten in place )" << std::endl;
+            std::cerr << "          -m      [ new embed file ]" << std::endl;
+            std::cerr << "          -rk     [ recipient's public key ]" << std::endl;
+            std::cerr << "          -pk     [ sender's private key ]" << std::endl;
+            std::cerr << "OPTIONAL: --check ( verify the embedded bytes )\n" << std::endl;
+            std::cerr << "rsteg --help for more information" << std::endl;
+
+            return false;
+        }
+
+        auto findArgIndex = [&](const std::string& option) {
+            auto it = std::find(args.begin(), args.end(), option);
+            return it != args.end() ? std::distance(args.begin(), it) : -1;
+        };
+
+        index.push_back(findArgIndex("-i"));
+        index.push_back(findArgIndex("-m"));
+        index.push_back(findArgIndex("-rk"));
+        index.push_back(findArgIndex("-pk"));
+    }
+
+    else if (strcmp(argv[1], "probe") == 0) {
+        if (argc < 3) {
+            std::cerr << "usage: rsteg probe [ file / directory ] ...\n" << std::endl;
+            std::cerr << "rsteg --help for more information" << std::endl;
+
+            return false;
+        }
+    }
+
     // Check for invalid or duplicate arguments
     for (size_t i = 0; i < index.size(); ++i) {
         if (index[i] == -1 || std::count(index.begin(), index.end(), index[i]) > 1) {
@@ -230,238 +313,2058 @@ bool isAudioFile(const char* inputPath) {
     return false;
 }
 
-int main(int argc, char** argv) {
-    OpenSSL_add_all_algorithms();
-    ERR_load_crypto_strings();
+enum CarrierType { IMAGE_CARRIER, VIDEO_CARRIER, AUDIO_CARRIER, BITMAP_CARRIER };
 
-    std::vector<int> index;
-    if (!parseArgs(argc, argv, index)){
-        return 1;
+struct Carrier {
+    std::string path;
+    CarrierType type = IMAGE_CARRIER;
+    std::pair<std::vector<int>, RawBytes> image;
+    ImageFormat imageFormat = IMAGE_PNG;
+    VideoInfo video;
+    AudioInfo audio;
+    size_t rawSize = 0;
+    MappedRaw cached;   // --cache hit, replaces the decoded buffer
+    Bitmap bitmap;
+    MappedRaw mapped;   // bitmap carriers: the whole input file, or the output once enc cloned it
+
+    RawBytes& rawData() {
+        if (type == VIDEO_CARRIER)
+            return video.rawData;
+        if (type == AUDIO_CARRIER)
+            return audio.rawData;
+        return image.second;
     }
 
-    if (strcmp(argv[1], "enc") == 0)
-    {
-        std::string inputPath = argv[++index[0]];
-        std::string inputFile = argv[++index[1]];
-        std::string publicKey = argv[++index[2]];
-        std::string privateKey = argv[++index[3]];
-        std::string outputPath = (argc == 12) ?
-            (argv[++index[4]] + (std::string(argv[index[4]]).find_last_of('.') == std::string::npos ?
-            inputPath.substr(inputPath.find_last_of('.')) : "")) :
-            ("./out" + (inputPath.find_last_of('.') != std::string::npos ? 
-            inputPath.substr(inputPath.find_last_of('.')) : ""));
-
-        std::pair<std::vector<int>, std::vector<unsigned char>> image;
-        VideoInfo video; short vflag = 0;
-        AudioInfo audio; short aflag = 0;
-        
-        if (isVideoFile(inputPath.c_str())) {
-            video = readVideo(inputPath.c_str()); vflag = 1;
-        }
-        else if (isAudioFile(inputPath.c_str())) {
-            audio = readAudio(inputPath.c_str()); aflag = 1;
+    unsigned char* rawBytes() {
+        if (type == BITMAP_CARRIER)
+            return mapped.data() + bitmap.dataOffset;
+        return cached.empty() ? rawData().data() : cached.data();
+    }
+};
+
+// maps the whole file and locates its pixel region, shared mappings write into the file
+bool mapBitmap(Carrier& carrier, const std::string& path, bool shared) {
+    carrier.type = BITMAP_CARRIER;
+    if (!carrier.mapped.map(path, shared)) {
+        std::cerr << "Error:    unable to map " << path << std::endl;
+        return false;
+    }
+    if (!parseBitmap(carrier.mapped.data(), carrier.mapped.size(), carrier.bitmap)) {
+        carrier.mapped.reset();
+        return false;
+    }
+    carrier.rawSize = carrier.bitmap.dataLength;
+    return true;
+}
+
+// enc output for a bitmap carrier: a copy of the input without the trailer an
+// earlier run may have left after the pixel data
+bool copyBitmap(const Carrier& carrier, const std::string& outputPath) {
+    std::error_code ec;
+    if (!std::filesystem::equivalent(carrier.path, outputPath, ec) && !cloneFile(carrier.path, outputPath)) {
+        std::cerr << "Error:    unable to copy " << carrier.path << " to " << outputPath << std::endl;
+        return false;
+    }
+    StegoTrailer previous;
+    std::uint64_t size = std::filesystem::file_size(outputPath, ec);
+    std::uint64_t dataEnd = carrier.bitmap.dataOffset + carrier.bitmap.dataLength;
+    if (readTrailer(outputPath, previous) && size >= dataEnd + TRAILER_SIZE + previous.extraLength) {
+        std::filesystem::resize_file(outputPath, size - TRAILER_SIZE - previous.extraLength, ec);
+    }
+    return !ec;
+}
+
+// what a cache hit needs instead of ffprobe / the PNG header, one "key value" per line
+std::string carrierMeta(const Carrier& carrier) {
+    std::ostringstream meta;
+    meta << std::setprecision(17);
+    if (carrier.type == VIDEO_CARRIER) {
+        meta << "type video\nwidth " << carrier.video.width << "\nheight " << carrier.video.height << "\nchannels "
+             << carrier.video.numChannels << "\nframerate " << carrier.video.framerate << "\ncodec " << carrier.video.codec
+             << "\npixfmt " << carrier.video.pixelFormat << "\n";
+    } else if (carrier.type == AUDIO_CARRIER) {
+        meta << "type audio\nrate " << carrier.audio.sampleRate << "\nchannels " << carrier.audio.channels
+             << "\ncodec " << carrier.audio.codec << "\n";
+    } else {
+        meta << "type image\nformat " << imageFormatName(carrier.imageFormat) << "\nwidth " << carrier.image.first[0]
+             << "\nheight " << carrier.image.first[1] << "\nchannels " << carrier.image.first[2] << "\n";
+    }
+    meta << "raw " << carrier.rawSize << "\n";
+    return meta.str();
+}
+
+bool parseCarrierMeta(const std::string& meta, Carrier& carrier) {
+    std::map<std::string, std::string> fields;
+    std::istringstream lines(meta);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t space = line.find(' ');
+        if (space != std::string::npos)
+            fields[line.substr(0, space)] = line.substr(space + 1);
+    }
+    try {
+        if (fields["type"] == "video") {
+            carrier.type = VIDEO_CARRIER;
+            carrier.video.width = std::stoi(fields["width"]);
+            carrier.video.height = std::stoi(fields["height"]);
+            carrier.video.numChannels = std::stoi(fields["channels"]);
+            carrier.video.framerate = std::stod(fields["framerate"]);
+            carrier.video.codec = fields["codec"];
+            // entries from before the pixel format was kept are decoded again
+            carrier.video.pixelFormat = fields["pixfmt"];
+            carrier.video.frameBytes = rawFrameBytes(carrier.video.pixelFormat, carrier.video.height, carrier.video.width);
+            if (carrier.video.frameBytes == 0)
+                return false;
+        } else if (fields["type"] == "audio") {
+            carrier.type = AUDIO_CARRIER;
+            carrier.audio.sampleRate = std::stoi(fields["rate"]);
+            carrier.audio.channels = std::stoi(fields["channels"]);
+            carrier.audio.codec = fields["codec"];
+        } else if (fields["type"] == "image") {
+            carrier.type = IMAGE_CARRIER;
+            if (fields.count("format") && !parseImageFormat(fields["format"], carrier.imageFormat))
+                return false;
+            carrier.image.first = { std::stoi(fields["width"]), std::stoi(fields["height"]), std::stoi(fields["channels"]) };
         } else {
-            std::cout << inputPath;
-            image = readImage(inputPath.c_str());
+            return false;
+        }
+        return std::stoull(fields["raw"]) == carrier.cached.size();
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// with --cache a hit replaces probe and decode by a copy-on-write mapping, a miss stores the decode.
+// A video may come back cut after the segment holding neededBytes, such decodes are never cached
+Carrier readCarrier(const std::string& inputPath, const std::string& cacheDir = "", size_t cacheBytes = DEFAULT_CACHE_BYTES,
+                    size_t neededBytes = SIZE_MAX) {
+    Carrier carrier;
+    carrier.path = inputPath;
+    std::error_code ec;
+    std::string key;
+    // bitmaps are mapped where they are, nothing to decode or cache
+    if (!cacheDir.empty() && !isBitmapFile(inputPath.c_str())) {
+        StageTimer timer(runStats, "cache_lookup");
+        key = cacheKey(inputPath);
+        std::string meta;
+        if (!key.empty() && cacheLookup(cacheDir, key, meta, carrier.cached)) {
+            if (parseCarrierMeta(meta, carrier)) {
+                std::cout << inputPath << ":   decoded carrier from cache" << std::endl;
+                carrier.rawSize = carrier.cached.size();
+                runStats.addBytes(runStats.bytesIn, std::filesystem::file_size(inputPath, ec));
+                runStats.addBytes(runStats.carrierBytes, carrier.rawSize);
+                runStats.addBytes(runStats.cacheHits, 1);
+                return carrier;
+            }
+            carrier.cached.reset();
+            carrier.type = IMAGE_CARRIER;
         }
+    }
 
-        std::vector<unsigned char> fileContents;
-        if(!readBinaryFile(inputFile.c_str(), fileContents)){
-            std::cerr << "Error:    unable to read embed file" << std::endl;
-            return 1;
+    if (isVideoFile(inputPath.c_str())) {
+        carrier.type = VIDEO_CARRIER;
+        {
+            StageTimer timer(runStats, "probe");
+            carrier.video = probeVideo(inputPath.c_str());
+        }
+        StageTimer timer(runStats, "decode");
+        decodeVideo(inputPath.c_str(), carrier.video, key.empty() ? neededBytes : SIZE_MAX);
+    }
+    else if (isAudioFile(inputPath.c_str())) {
+        carrier.type = AUDIO_CARRIER;
+        {
+            StageTimer timer(runStats, "probe");
+            carrier.audio = probeAudio(inputPath.c_str());
         }
+        StageTimer timer(runStats, "decode");
+        decodeAudio(inputPath.c_str(), carrier.audio);
+    }
+    else if (isBitmapFile(inputPath.c_str())) {
+        std::cout << inputPath << std::endl;
+        StageTimer timer(runStats, "map");
+        if (!mapBitmap(carrier, inputPath, false)) {
+            exit(1);
+        }
+    } else {
+        std::cout << inputPath << std::endl;
+        StageTimer timer(runStats, "decode");
+        carrier.imageFormat = sniffImage(inputPath.c_str());
+        carrier.image = readImageAs(inputPath.c_str(), carrier.imageFormat);
+    }
 
-        unsigned char messageKey[32];
-        unsigned char iv[16]; 
-        std::vector<unsigned char> sec = computeSharedSecret(privateKey, publicKey);
-        deriveAesKeyAndIv(sec, messageKey, iv);
-        std::vector<unsigned char> encryptedBytes(fileContents.size());
-        int encryptedByteslength = encrypt(fileContents, static_cast<int>(fileContents.size()), messageKey, iv, encryptedBytes);
+    if (carrier.type != BITMAP_CARRIER)
+        carrier.rawSize = carrier.rawData().size();
+    runStats.addBytes(runStats.bytesIn, std::filesystem::file_size(inputPath, ec));
+    runStats.addBytes(runStats.carrierBytes, carrier.rawSize);
 
-        /*  //  debug block
-        std::cout << "AES-256 encrypted bytes: " << std::endl;
-        bool first = true;
-        for (auto ch : encryptedBytes) {
-            if (!first) {
-                std::cout << ' ';
-            }
-            std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned int>(static_cast<unsigned char>(ch));
-            first = false;
-        }
-        std::cout << std::dec << std::endl;  */
+    if (!key.empty()) {
+        StageTimer timer(runStats, "cache_store");
+        if (!cacheStore(cacheDir, key, carrierMeta(carrier), carrier.rawBytes(), carrier.rawSize, cacheBytes))
+            std::cerr << "Warning:  " << inputPath << " was not cached" << std::endl;
+    }
+    return carrier;
+}
 
-        // Calculate size for encoding
-        int numPos = (static_cast<long>(encryptedBytes.size()) * 8) / (4 * 2) * 4; // this works but how ??
+const size_t BITMAP_TILE_UNIT = 1 << 12;
 
-        std::cout << std::fixed << std::setprecision(1) << "minimum required container size:   " << static_cast<double>(numPos)/1024.0 << " KB" << std::endl; 
+// tiles hold whole PNG rows, frames, blocks of 1024 samples or bitmap pages
+size_t tileUnit(const Carrier& carrier) {
+    if (carrier.type == BITMAP_CARRIER)
+        return BITMAP_TILE_UNIT;
+    if (carrier.type == VIDEO_CARRIER)
+        return carrier.video.frameBytes;
+    if (carrier.type == AUDIO_CARRIER)
+        return static_cast<size_t>(carrier.audio.channels) * 2 * 1024;
+    return static_cast<size_t>(carrier.image.first[0]) * carrier.image.first[2];
+}
 
-        if (numPos > image.second.size() && numPos > video.rawData.size() && numPos > audio.rawData.size()) {
-            std::cerr << "Error:    insufficient container size" << std::endl;
-            return 1;
-        }
+// frames or sample blocks a probed duration may overstate, a container rounds it up
+const size_t DURATION_MARGIN_UNITS = 4;
 
-        std::cout << "file size:    " << std::fixed << std::setprecision(1) << static_cast<double>(encryptedBytes.size())/1024.0 << " KB" << std::endl;
-        if (vflag == 1) {
-            std::cout << "container size:   " << std::fixed << std::setprecision(1) << static_cast<double>(video.rawData.size())/1024.0 << " KB" << std::endl;
-        } else if  (aflag == 1) {
-            std::cout << "container size:   " << std::fixed << std::setprecision(1) << static_cast<double>(audio.rawData.size())/1024.0 << " KB" << std::endl;
+// raw size from the probed duration less the margin, without decoding anything. The
+// embed checks the positions against the bytes that actually come out. Containers
+// without a duration are counted in a decoding pass that keeps nothing
+size_t durationCapacity(const Carrier& carrier) {
+    size_t unit = tileUnit(carrier);
+    size_t estimated = carrier.type == VIDEO_CARRIER ? carrier.video.estimatedBytes : carrier.audio.estimatedBytes;
+    if (estimated / unit > 2 * DURATION_MARGIN_UNITS)
+        return (estimated / unit - DURATION_MARGIN_UNITS) * unit;
+    return countDecodedBytes(carrier.type == VIDEO_CARRIER ? videoDecodeCommand(carrier.path.c_str())
+                                                           : audioDecodeCommand(carrier.path.c_str()));
+}
+
+// metadata only, for --max-memory. Video and audio are sized from their duration when
+// countRaw is set, otherwise rawSize stays unknown (SIZE_MAX)
+Carrier probeCarrier(const std::string& inputPath, bool countRaw) {
+    StageTimer timer(runStats, "probe");
+    Carrier carrier;
+    carrier.path = inputPath;
+    carrier.rawSize = SIZE_MAX;
+    if (isVideoFile(inputPath.c_str())) {
+        carrier.type = VIDEO_CARRIER;
+        carrier.video = probeVideo(inputPath.c_str());
+        if (countRaw)
+            carrier.rawSize = durationCapacity(carrier);
+    }
+    else if (isAudioFile(inputPath.c_str())) {
+        carrier.type = AUDIO_CARRIER;
+        carrier.audio = probeAudio(inputPath.c_str());
+        if (countRaw)
+            carrier.rawSize = durationCapacity(carrier);
+    }
+    else if (isBitmapFile(inputPath.c_str())) {
+        std::cout << inputPath << std::endl;
+        if (!mapBitmap(carrier, inputPath, false)) {
+            exit(1);
+        }
+        carrier.mapped.reset();
+    } else {
+        std::cout << inputPath << std::endl;
+        carrier.imageFormat = sniffImage(inputPath.c_str());
+        int width, height, numChannels;
+        if (carrier.imageFormat == IMAGE_WEBP) {
+            if (!webpInfo(inputPath.c_str(), width, height, numChannels)) {
+                exit(1);
+            }
+        } else if (carrier.imageFormat == IMAGE_QOI) {
+            QoiRows rows;
+            if (!openQoiReader(inputPath.c_str(), rows)) {
+                exit(1);
+            }
+            width = rows.width, height = rows.height, numChannels = rows.numChannels;
+            closeQoiReader(rows);
         } else {
-            std::cout << "container size:   " << std::fixed << std::setprecision(1) << static_cast<double>(image.second.size())/1024.0 << " KB" << std::endl;
+            PngRows rows;
+            if (!openPngReader(inputPath.c_str(), rows)) {
+                exit(1);
+            }
+            width = rows.width, height = rows.height, numChannels = rows.numChannels;
+            closePngReader(rows);
         }
+        carrier.image.first = { width, height, numChannels };
+        carrier.rawSize = static_cast<size_t>(width) * height * numChannels;
+    }
 
-        std::uint64_t Seed = generateSeed(numPos);      
-        if (Seed != 0) {
-            unsigned char seedBytes[sizeof(Seed)];
-            for (long long unsigned int i = 0; i < sizeof(Seed); ++i) {
-                seedBytes[i] = (Seed >> (8 * i)) & 0xFF;
-            }
+    std::error_code ec;
+    runStats.addBytes(runStats.bytesIn, std::filesystem::file_size(inputPath, ec));
+    if (carrier.rawSize != SIZE_MAX)
+        runStats.addBytes(runStats.carrierBytes, carrier.rawSize);
+    return carrier;
+}
 
-            unsigned char encryptedSeed[AES_BLOCK_SIZE];
-            int encryptedSeedLength = encrypt_seed(seedBytes, sizeof(seedBytes), messageKey, iv, encryptedSeed);
+// the first audio track of a video as a carrier of its own, see --audio-track
+Carrier probeAudioTrack(const std::string& inputPath) {
+    StageTimer timer(runStats, "probe");
+    Carrier carrier;
+    carrier.path = inputPath;
+    carrier.type = AUDIO_CARRIER;
+    carrier.rawSize = SIZE_MAX;
+    carrier.audio = probeAudio(inputPath.c_str());
+    if (carrier.audio.codec.empty()) {
+        std::cerr << "Error:    " << inputPath << " has no audio track" << std::endl;
+        exit(1);
+    }
+    return carrier;
+}
 
-            std::cout << "AES-256 encrypted seed bytes:     ";
-            for (int i = 0; i < encryptedSeedLength; ++i) {
-                if (i != 0) {
-                    std::cout << ' ';
-                }
-                std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(encryptedSeed[i]);
-            }
-            std::cout << std::dec << std::endl;
+// audio is not decoded whole outside --max-memory either: recordings stream through
+// tiles of AUDIO_STREAM_UNITS blocks with the decoder and encoder running side by side
+const size_t AUDIO_STREAM_UNITS = 256;
 
-            auto start = std::chrono::high_resolution_clock::now();
-            std::vector<int> pos = entropyChannel(Seed);
-            auto stop = std::chrono::high_resolution_clock::now();
+// streamed audio is sized from its duration, it is decoded once, while it is embedded
+Carrier probeAudioStream(const std::string& inputPath, bool videoTrack = false) {
+    Carrier carrier = videoTrack ? probeAudioTrack(inputPath) : probeCarrier(inputPath, false);
+    carrier.rawSize = durationCapacity(carrier);
+    runStats.addBytes(runStats.carrierBytes, carrier.rawSize);
+    return carrier;
+}
 
-            auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-            std::cout << "generated encoding sequence in " << std::setprecision(2) << static_cast<double>(duration.count()) << " s" << std::endl; 
+// sequential access to a carrier's raw bytes, decoder or encoder side
+struct CarrierTiles {
+    CarrierType type = IMAGE_CARRIER;
+    ImageFormat imageFormat = IMAGE_PNG;
+    ChildPipe child;            // ffmpeg decoder or encoder
+    PngRows png;
+    QoiRows qoi;
+    int fd = -1;                // bitmaps are read and written in place
+    std::uint64_t offset = 0;
+    std::uint64_t end = 0;
+};
 
-            if (vflag == 1) {
-                encode_lsb(video.rawData, encryptedBytes, pos);
-            } else if (aflag == 1) {
-                encode_lsb(audio.rawData, encryptedBytes, pos);
-            } else {
-                encode_lsb(image.second, encryptedBytes, pos);
-            }
+// WebP has no row access, tiled runs need one of the other image formats
+bool tileableImage(const Carrier& carrier) {
+    if (carrier.type == IMAGE_CARRIER && carrier.imageFormat == IMAGE_WEBP) {
+        std::cerr << "Error:    WebP carriers cannot be processed with --max-memory" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-            std::vector<unsigned char> encodedSeedBytes;
-            for (int i = 0; i < encryptedSeedLength; ++i) {
-                encodedSeedBytes.push_back(encryptedSeed[i]);
-            }
-            encodedSeedBytes.push_back(encryptedSeedLength);
+bool openTileReader(const Carrier& carrier, CarrierTiles& tiles) {
+    tiles.type = carrier.type;
+    tiles.imageFormat = carrier.imageFormat;
+    if (!tileableImage(carrier))
+        return false;
+    if (carrier.type == IMAGE_CARRIER && carrier.imageFormat == IMAGE_QOI)
+        return openQoiReader(carrier.path.c_str(), tiles.qoi);
+    if (carrier.type == IMAGE_CARRIER)
+        return openPngReader(carrier.path.c_str(), tiles.png);
+    if (carrier.type == BITMAP_CARRIER) {
+        tiles.fd = open(carrier.path.c_str(), O_RDONLY);
+        tiles.offset = carrier.bitmap.dataOffset;
+        tiles.end = carrier.bitmap.dataOffset + carrier.bitmap.dataLength;
+        return tiles.fd >= 0;
+    }
 
-            if (vflag == 1) {
-                if(!writeVideo(inputPath.c_str(), outputPath.c_str(), video.rawData, video.height, video.width, video.framerate, video.codec)) {
-                    std::cerr << "Error: failed to write to container" << std::endl;
-                    return 1;
-                }
-            }
-            else if (aflag == 1) {
-                if(!writeAudio(inputPath.c_str(), outputPath.c_str(), audio.rawData, audio.sampleRate, audio.channels, audio.codec)) {
-                    std::cerr << "Error: failed to write to container" << std::endl;
-                    return 1;
-                }
-            }
-             else {
-                if(!writeImage(outputPath.c_str(), image.second, image.first[0], image.first[1], image.first[2])) {
-                    std::cerr << "Error: failed to write to container" << std::endl;
-                    return 1;
-                }
-            }
+    std::string cmd = carrier.type == VIDEO_CARRIER ? videoDecodeCommand(carrier.path.c_str()) : audioDecodeCommand(carrier.path.c_str());
+    if (!spawnPipe(cmd, false, tiles.child)) {
+        std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
+        return false;
+    }
+    return true;
+}
 
-            // write the seed
-            std::ofstream outputFile(outputPath.c_str(), std::ios::out | std::ios::app | std::ios::binary);
-            if (outputFile.is_open()) {
-                outputFile.write(reinterpret_cast<char*>(encodedSeedBytes.data()), encodedSeedBytes.size());
-                outputFile.close();
-                std::cout << "seed written to container." << std::endl;
-            } else {
-                std::cerr << "Error: failed to embed seed bytes." << std::endl;
-            }
+// fills up to size bytes, less only at the end of the carrier
+size_t readTile(CarrierTiles& tiles, unsigned char* buffer, size_t size) {
+    if (tiles.type == IMAGE_CARRIER && tiles.imageFormat == IMAGE_QOI) {
+        size_t rowBytes = static_cast<size_t>(tiles.qoi.width) * tiles.qoi.numChannels;
+        int rows = static_cast<int>(std::min<size_t>(size / rowBytes, tiles.qoi.height));
+        tiles.qoi.height -= rows;
+        return readQoiPixels(tiles.qoi, buffer, static_cast<size_t>(rows) * tiles.qoi.width) ? rows * rowBytes : 0;
+    }
+    if (tiles.type == IMAGE_CARRIER) {
+        size_t rowBytes = static_cast<size_t>(tiles.png.width) * tiles.png.numChannels;
+        // height counts the rows still to read
+        int rows = static_cast<int>(std::min<size_t>(size / rowBytes, tiles.png.height));
+        tiles.png.height -= rows;
+        return readPngRows(tiles.png, buffer, rows) ? rows * rowBytes : 0;
+    }
+    if (tiles.type == BITMAP_CARRIER) {
+        ssize_t length = pread(tiles.fd, buffer, std::min<std::uint64_t>(size, tiles.end - tiles.offset), tiles.offset);
+        tiles.offset += std::max<ssize_t>(length, 0);
+        return std::max<ssize_t>(length, 0);
+    }
 
-            std::cout << "successfully created embedded container:\t" << outputPath << std::endl;
+    return readPipe(tiles.child.fd, buffer, size);
+}
 
-        } else {
-            std::cerr << "Error: unhandled exception" << std::endl;
-            return 1;
-        }
+void closeTileReader(CarrierTiles& tiles) {
+    if (tiles.type == IMAGE_CARRIER && tiles.imageFormat == IMAGE_QOI)
+        closeQoiReader(tiles.qoi);
+    else if (tiles.type == IMAGE_CARRIER)
+        closePngReader(tiles.png);
+    else if (tiles.type == BITMAP_CARRIER)
+        close(tiles.fd);
+    else
+        waitChild(tiles.child);
+}
 
-    } else if (strcmp(argv[1], "dec") == 0) {
-        const char* inputPath = argv[++index[0]];
-        const char* publicKey = argv[++index[1]];
-        const char* privateKey = argv[++index[2]];
-        std::string outputPath = argc == 10 ? argv[++index[3]] : "./file";
-        std::vector<unsigned char> encryptedSeed = decodeSeedBytes(inputPath);
+bool openTileWriter(const Carrier& carrier, const std::string& outputPath, CarrierTiles& tiles) {
+    tiles.type = carrier.type;
+    tiles.imageFormat = carrier.imageFormat;
+    if (!tileableImage(carrier))
+        return false;
+    if (carrier.type == IMAGE_CARRIER && carrier.imageFormat == IMAGE_QOI) {
+        tiles.qoi.width = carrier.image.first[0];
+        tiles.qoi.height = carrier.image.first[1];
+        tiles.qoi.numChannels = carrier.image.first[2];
+        return openQoiWriter(outputPath.c_str(), tiles.qoi);
+    }
+    if (carrier.type == IMAGE_CARRIER) {
+        tiles.png.width = carrier.image.first[0];
+        tiles.png.height = carrier.image.first[1];
+        tiles.png.numChannels = carrier.image.first[2];
+        return openPngWriter(outputPath.c_str(), tiles.png);
+    }
+    if (carrier.type == BITMAP_CARRIER) {
+        if (!copyBitmap(carrier, outputPath))
+            return false;
+        tiles.fd = open(outputPath.c_str(), O_WRONLY);
+        tiles.offset = carrier.bitmap.dataOffset;
+        return tiles.fd >= 0;
+    }
 
-        unsigned char messageKey[32];
-        unsigned char iv[16]; 
-        std::vector<unsigned char> sec = computeSharedSecret(privateKey, publicKey);
-        deriveAesKeyAndIv(sec, messageKey, iv);
+    std::string cmd = carrier.type == VIDEO_CARRIER
+        ? videoEncodeCommand(carrier.path.c_str(), outputPath.c_str(), carrier.video.height, carrier.video.width, carrier.video.framerate, carrier.video.codec, carrier.video.pixelFormat, carrier.video.keepAudio)
+        : audioEncodeCommand(carrier.path.c_str(), outputPath.c_str(), carrier.audio.sampleRate, carrier.audio.channels, carrier.audio.codec);
+    std::cout << cmd << std::endl;
+    if (!spawnPipe(cmd, true, tiles.child)) {
+        std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
+        return false;
+    }
+    return true;
+}
 
-        std::cout << "extracted seed:   ";
-        for (size_t i = 0; i < encryptedSeed.size(); ++i) {
-            if (i != 0) {
-                std::cout << ' ';
+bool writeTile(CarrierTiles& tiles, const unsigned char* buffer, size_t size) {
+    if (tiles.type == IMAGE_CARRIER && tiles.imageFormat == IMAGE_QOI)
+        return writeQoiPixels(tiles.qoi, buffer, size / tiles.qoi.numChannels);
+    if (tiles.type == IMAGE_CARRIER) {
+        size_t rowBytes = static_cast<size_t>(tiles.png.width) * tiles.png.numChannels;
+        return writePngRows(tiles.png, buffer, static_cast<int>(size / rowBytes));
+    }
+    if (tiles.type == BITMAP_CARRIER) {
+        bool written = pwrite(tiles.fd, buffer, size, tiles.offset) == static_cast<ssize_t>(size);
+        tiles.offset += size;
+        return written;
+    }
+    // tile buffers are refilled right away, they are copied rather than spliced
+    return writePipe(tiles.child.fd, buffer, size);
+}
+
+bool closeTileWriter(CarrierTiles& tiles) {
+    if (tiles.type == IMAGE_CARRIER && tiles.imageFormat == IMAGE_QOI)
+        return closeQoiWriter(tiles.qoi);
+    if (tiles.type == IMAGE_CARRIER)
+        return closePngWriter(tiles.png);
+    if (tiles.type == BITMAP_CARRIER)
+        return close(tiles.fd) == 0;
+    return waitChild(tiles.child) == 0;
+}
+
+// Runs process over every tile in carrier order. A decode thread fills the next buffers
+// while the current tile is processed, and with a writer an encode thread flushes the
+// previous one, so the decoder and encoder pipes are never waiting on each other.
+// process returns false to stop reading; false when a tile could not be written
+bool pipeTiles(CarrierTiles& reader, CarrierTiles* writer, size_t tileBytes,
+               const std::function<bool(unsigned char*, size_t, size_t)>& process) {
+    std::vector<RawBytes> buffers;
+    TileQueue free, filled, processed;
+    for (unsigned b = 0; b < TILE_BUFFERS; ++b) {
+        buffers.emplace_back(tileBytes);
+        free.push(b, 0);
+    }
+
+    std::thread decoder([&]() {
+        RSTEG_TRACE_THREAD("tile decode");
+        unsigned b;
+        size_t length;
+        while (free.pop(b, length)) {
+            length = readTile(reader, buffers[b].data(), tileBytes);
+            filled.push(b, length);
+            if (length == 0)
+                break;
+        }
+        filled.close();
+    });
+    std::atomic<bool> written{ true };
+    std::thread encoder;
+    if (writer) {
+        encoder = std::thread([&]() {
+            RSTEG_TRACE_THREAD("tile encode");
+            unsigned b;
+            size_t length;
+            while (processed.pop(b, length)) {
+                if (written && !writeTile(*writer, buffers[b].data(), length))
+                    written = false;
+                free.push(b, 0);
             }
-            std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(encryptedSeed[i]);
+        });
+    }
+
+    unsigned b;
+    size_t length, offset = 0;
+    while (written && filled.pop(b, length) && length > 0) {
+        bool more = process(buffers[b].data(), offset, length);
+        offset += length;
+        if (writer)
+            processed.push(b, length);
+        else
+            free.push(b, 0);
+        if (!more)
+            break;
+    }
+    processed.close();
+    if (encoder.joinable())
+        encoder.join();
+    free.close();
+    decoder.join();
+    return written;
+}
+
+// every tile is decoded, embedded, optionally checked and flushed once
+bool embedTiled(const Carrier& carrier, const std::string& outputPath, const std::vector<unsigned char>& stream,
+                const PositionTable& inverse, size_t tileBytes, bool check) {
+    CarrierTiles reader, writer;
+    if (!openTileReader(carrier, reader)) {
+        return false;
+    }
+    if (!openTileWriter(carrier, outputPath, writer)) {
+        closeTileReader(reader);
+        return false;
+    }
+
+    std::cout << "embedding in " << tileBytes / 1024 << " KB tiles ..." << std::endl;
+    size_t end = 0, errors = 0;
+    bool written = pipeTiles(reader, &writer, tileBytes, [&](unsigned char* tile, size_t offset, size_t length) {
+        embedTile(tile, offset, length, inverse, stream);
+        if (check)
+            errors += verifyTile(tile, offset, length, inverse, stream);
+        end = offset + length;
+        return true;
+    });
+    closeTileReader(reader);
+    written = closeTileWriter(writer) && written;
+
+    if (!written) {
+        std::cerr << "Error: failed to write to container" << std::endl;
+        return false;
+    }
+    // sized from a probed duration, the decoder may still come up short of the positions
+    if (end < inverse.size()) {
+        std::cerr << "Error:    " << carrier.path << " decoded to " << end << " bytes, its positions need " << inverse.size() << std::endl;
+        return false;
+    }
+    if (errors != 0) {
+        std::cerr << "Error:    " << errors << " embedded bit pairs do not match" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// reading stops at the last tile that carries positions
+std::vector<unsigned char> extractTiled(const Carrier& carrier, const PositionTable& inverse, size_t tileBytes) {
+    std::vector<unsigned char> stream(inverse.size() / 4, 0);
+    CarrierTiles reader;
+    if (!openTileReader(carrier, reader)) {
+        return {};
+    }
+
+    std::cout << "extracting from " << tileBytes / 1024 << " KB tiles ..." << std::endl;
+    size_t end = 0;
+    pipeTiles(reader, nullptr, tileBytes, [&](unsigned char* tile, size_t offset, size_t length) {
+        extractTile(tile, offset, length, inverse, stream);
+        end = offset + length;
+        return end < inverse.size();
+    });
+    closeTileReader(reader);
+
+    if (end < inverse.size()) {
+        std::cerr << "Error:    container is shorter than its embedded stream" << std::endl;
+        return {};
+    }
+    return stream;
+}
+
+// beyond this many runs of frames the select expression costs more than decoding through
+const size_t MAX_SELECT_RUNS = 256;
+const size_t SAMPLE_TILE_BYTES = 4 << 20;
+
+// carrier bytes at sorted, unique offsets. Decoding stops after the last one,
+// video carriers only decode the frames that hold one
+bool sampleCarrier(const Carrier& carrier, const std::vector<std::uint64_t>& offsets, std::vector<unsigned char>& values) {
+    RSTEG_TRACE_SCOPE("sampleCarrier");
+    values.resize(offsets.size());
+    if (carrier.type == BITMAP_CARRIER) {
+        // random access, only the pages holding an offset are read
+        MappedRaw file;
+        if (!file.map(carrier.path)) {
+            std::cerr << "Error:    unable to map " << carrier.path << std::endl;
+            return false;
+        }
+        if (!offsets.empty() && offsets.back() >= carrier.bitmap.dataLength) {
+            std::cerr << "Error:    container is shorter than its embedded stream" << std::endl;
+            return false;
         }
-        std::cout << std::dec << std::endl;
+        for (size_t k = 0; k < offsets.size(); ++k) {
+            values[k] = file.data()[carrier.bitmap.dataOffset + offsets[k]];
+        }
+        return true;
+    }
+    if (carrier.type == IMAGE_CARRIER && carrier.imageFormat == IMAGE_WEBP) {
+        // decoded whole, there is no row access
+        RawBytes pixels = readWebp(carrier.path.c_str()).second;
+        if (!offsets.empty() && offsets.back() >= pixels.size()) {
+            std::cerr << "Error:    container is shorter than its embedded stream" << std::endl;
+            return false;
+        }
+        for (size_t k = 0; k < offsets.size(); ++k) {
+            values[k] = pixels[offsets[k]];
+        }
+        return true;
+    }
 
-        std::uint64_t decryptedSeed = 0;
-        if(decrypt_seed(encryptedSeed.data(), static_cast<int>(encryptedSeed.size()), messageKey, iv, reinterpret_cast<unsigned char*>(&decryptedSeed)) < 0) {
-            std::cerr << "Error:    failed to decrypt seed" << std::endl;
-            return 1;
+    size_t unit = tileUnit(carrier);
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> runs;
+    if (carrier.type == VIDEO_CARRIER) {
+        for (auto offset : offsets) {
+            std::uint64_t frame = offset / unit;
+            if (!runs.empty() && frame <= runs.back().second + 1)
+                runs.back().second = frame;
+            else
+                runs.emplace_back(frame, frame);
         }
+    }
+    bool selectFrames = !runs.empty() && runs.size() <= MAX_SELECT_RUNS;
 
-        std::pair<std::vector<int>, std::vector<unsigned char>> stegoImage;
-        std::vector<int> pos;
-        int length = strlen(inputPath); VideoInfo video; int vflag = 0;
-        AudioInfo audio; int aflag = 0;
-        if (isVideoFile(inputPath)) {
-            video = readVideo(inputPath); vflag = 1;
+    CarrierTiles reader;
+    if (selectFrames) {
+        reader.type = VIDEO_CARRIER;
+        if (!spawnPipe(videoDecodeCommand(carrier.path.c_str(), frameSelectFilter(runs)), false, reader.child)) {
+            std::cerr << "Error: Could not open pipe to FFmpeg." << std::endl;
+            return false;
         }
-        else if (isAudioFile(inputPath)) {
-            audio = readAudio(inputPath); aflag = 1;
-        } else {
-            stegoImage = readImage(inputPath);
+    } else if (!openTileReader(carrier, reader)) {
+        return false;
+    }
+
+    RawBytes tile(selectFrames ? unit : std::max(unit, SAMPLE_TILE_BYTES / unit * unit));
+    size_t next = 0, length;
+    auto pick = [&](std::uint64_t base, size_t length) {
+        while (next < offsets.size() && offsets[next] < base + length) {
+            values[next] = tile[offsets[next] - base];
+            ++next;
+        }
+    };
+    if (selectFrames) {
+        // selected frames come out in order, one unit each
+        for (auto& run : runs) {
+            for (std::uint64_t frame = run.first; frame <= run.second; ++frame) {
+                if (readTile(reader, tile.data(), unit) != unit) {
+                    break;
+                }
+                pick(frame * unit, unit);
+            }
+        }
+    } else {
+        std::uint64_t base = 0;
+        while (next < offsets.size() && (length = readTile(reader, tile.data(), tile.size())) > 0) {
+            pick(base, length);
+            base += length;
         }
+    }
+    closeTileReader(reader);
+
+    if (next < offsets.size()) {
+        std::cerr << "Error:    container is shorter than its embedded stream" << std::endl;
+        return false;
+    }
+    return true;
+}
 
-        std::cout << "decrypted seed:   " << decryptedSeed << std::endl;
+// multi-recipient containers carry the message key wrapped in a key table, every shard
+// holds the same one. Without the flag the key comes straight from the pair's secret
+bool resolveMessageKey(const std::string& inputPath, const std::vector<unsigned char>& sharedSecret,
+                       unsigned char* messageKey, unsigned char* iv) {
+    StegoTrailer trailer;
+    if (!readTrailer(inputPath, trailer) || !(trailer.flags & TRAILER_FLAG_KEY_TABLE)) {
+        deriveAesKeyAndIv(sharedSecret, messageKey, iv);
+        return true;
+    }
 
-        auto start = std::chrono::high_resolution_clock::now();
-        pos = entropyChannel(decryptedSeed);
-        auto stop = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::seconds>(stop - start);
-        std::cout << "generated encoding sequence in " << std::setprecision(2) << static_cast<double>(duration.count()) << " s" << std::endl; 
-        std::vector<unsigned char> extractedBytes;
-        if (vflag == 1) {
-            extractedBytes = decode_file(video.rawData, pos);
-        }
-        else if (aflag == 1) {
-            extractedBytes = decode_file(audio.rawData, pos);
+    std::vector<unsigned char> keyTable;
+    bool found = readTrailerExtra(inputPath, trailer, keyTable);
+    keyTable.resize(keyTableLength(trailer));
+    if (!found || !unwrapMessageKey(sharedSecret, keyTable, messageKey, iv)) {
+        std::cerr << "Error:    " << inputPath << " is not addressed to this key pair" << std::endl;
+        return false;
+    }
+    std::cout << "message key unwrapped from a table of " << keyTable.size() / KEY_TABLE_ENTRY_SIZE << " recipients" << std::endl;
+    return true;
+}
+
+// payload bytes [begin, end) of one shard, read through whole checksum chunks that are
+// verified before anything is returned
+bool readShardRange(const std::string& inputPath, const StegoTrailer& trailer, std::uint64_t seed, std::uint64_t begin,
+                    std::uint64_t end, unsigned char* out) {
+    std::uint64_t numPos = embeddedLength(trailer) * 4;
+    ByteSpan chunks = chunkSpanFor(begin, end, trailer.payloadLength, trailer.chunkShift);
+    ByteSpan table;
+    if (trailer.chunkShift != 0) {
+        table.begin = trailer.payloadLength + 4 * (chunks.begin >> trailer.chunkShift);
+        table.end = trailer.payloadLength + 4 * chunkCount(chunks.end, trailer.chunkShift);
+    }
+    std::uint64_t streamBytes = chunks.size() + table.size();
+    auto streamIndex = [&](std::uint64_t j) { return j < chunks.size() ? chunks.begin + j : table.begin + j - chunks.size(); };
+
+    // carrier offset of every bit pair, seekable generators skip the full table
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> bitPositions(streamBytes * 4);
+    {
+        StageTimer timer(runStats, "position_generation");
+        bool blockLayout = trailer.flags & TRAILER_FLAG_BLOCK_LAYOUT;
+        if (seekableGenerator(trailer.generator) && blockLayout) {
+            FeistelBlockLayout layout(seed, numPos);
+            for (std::uint64_t k = 0; k < bitPositions.size(); ++k) {
+                bitPositions[k] = { layout(streamIndex(k / 4) * 4 + k % 4), k };
+            }
+        } else if (seekableGenerator(trailer.generator)) {
+            FeistelPermutation perm(seed, numPos);
+            for (std::uint64_t k = 0; k < bitPositions.size(); ++k) {
+                bitPositions[k] = { perm(streamIndex(k / 4) * 4 + k % 4), k };
+            }
         } else {
-            extractedBytes = decode_file(stegoImage.second, pos);
-        }      
+            std::cout << generatorName(trailer.generator) << " is not seekable, generating every position" << std::endl;
+            PositionTable pos = entropyChannel(seed, numPos, trailer.generator, blockLayout);
+            for (std::uint64_t k = 0; k < bitPositions.size(); ++k) {
+                bitPositions[k] = { pos[streamIndex(k / 4) * 4 + k % 4], k };
+            }
+        }
+        std::sort(bitPositions.begin(), bitPositions.end());
+    }
 
-        std::vector<unsigned char> finalMessageBytes(extractedBytes.size());
-        if(decrypt(extractedBytes, static_cast<int>(extractedBytes.size()), messageKey, iv, finalMessageBytes) < 0) {
-            std::cerr << "Error:    unable to decrypt extracted file" << std::endl;
-            return 1;
+    std::vector<unsigned char> stream(streamBytes, 0);
+    {
+        StageTimer timer(runStats, "extract");
+        Carrier carrier = probeCarrier(inputPath, false);
+        std::vector<std::uint64_t> offsets(bitPositions.size());
+        for (size_t k = 0; k < bitPositions.size(); ++k) {
+            offsets[k] = bitPositions[k].first;
         }
+        std::vector<unsigned char> values;
+        if (!sampleCarrier(carrier, offsets, values)) {
+            return false;
+        }
+        for (size_t k = 0; k < bitPositions.size(); ++k) {
+            std::uint64_t bit = bitPositions[k].second;
+            stream[bit / 4] |= (values[k] & 0x03) << (6 - 2 * (bit % 4));
+        }
+    }
+    runStats.addBytes(runStats.embeddedBytes, streamBytes);
 
-        std::string outFile = outputPath + getFileExtension(finalMessageBytes);
-        std::ofstream outputFile(outFile, std::ios::binary);
- 
-        if (outputFile.is_open()) {
-            outputFile.write(reinterpret_cast<const char*>(finalMessageBytes.data()), finalMessageBytes.size());
-            outputFile.close();
-            std::cout << "reconstructed the file:   " << outFile << std::endl;
-        } else {
-            std::cerr << "Error: cannot reconstruct file" << std::endl;
+    if (trailer.chunkShift != 0) {
+        StageTimer timer(runStats, "verify");
+        std::vector<size_t> corrupt = verifyChunks(stream.data(), chunks.size(), stream.data() + chunks.size(), trailer.chunkShift);
+        for (auto chunk : corrupt) {
+            std::uint64_t first = chunks.begin + (std::uint64_t(chunk) << trailer.chunkShift);
+            std::cerr << "Error:    corrupt chunk in " << inputPath << ":   bytes " << first << " - "
+                      << std::min(first + (std::uint64_t(1) << trailer.chunkShift), trailer.payloadLength) - 1 << std::endl;
+        }
+        if (!corrupt.empty()) {
             return false;
         }
+    }
 
-    } else {
-        std::cerr << "rsteg --help for more information" << std::endl;
+    std::copy(stream.begin() + (begin - chunks.begin), stream.begin() + (end - chunks.begin), out);
+    return true;
+}
+
+// dec --range: cost follows the size of the range, not of the payload
+int extractRange(const std::vector<std::string>& inputPaths, unsigned char* messageKey, unsigned char* iv,
+                 std::uint64_t offset, std::uint64_t length, const std::string& outputPath) {
+    size_t shardCount = inputPaths.size();
+    std::vector<StegoTrailer> trailers(shardCount);
+    std::vector<size_t> slots(shardCount, SIZE_MAX);
+    std::vector<std::uint64_t> seeds(shardCount, 0);
+    for (size_t i = 0; i < shardCount; ++i) {
+        StageTimer timer(runStats, "probe");
+        const char* inputPath = inputPaths[i].c_str();
+        StegoTrailer& trailer = trailers[i];
+        if (!readTrailer(inputPath, trailer)) {
+            std::cerr << "Error:    --range needs a container with a trailer, " << inputPath << " has none" << std::endl;
+            return 1;
+        }
+        if (trailer.generator >= GEN_COUNT || (trailer.flags & ~TRAILER_KNOWN_FLAGS)) {
+            std::cerr << "Error:    " << inputPath << " uses an unknown position generator or layout, update rsteg" << std::endl;
+            return 1;
+        }
+        if (trailer.flags & TRAILER_FLAG_AUDIO_TRACK) {
+            std::cerr << "Error:    " << inputPath << " has a shard in its audio track, --range cannot read it" << std::endl;
+            return 1;
+        }
+        if (trailer.shardCount != shardCount || trailer.shardIndex >= shardCount || slots[trailer.shardIndex] != SIZE_MAX) {
+            std::cerr << "Error:    " << inputPath << " is shard " << trailer.shardIndex + 1 << " of " << trailer.shardCount
+                      << ", got " << shardCount << " container(s)" << std::endl;
+            return 1;
+        }
+        slots[trailer.shardIndex] = i;
+
+        unsigned char seedBytes[AES_BLOCK_SIZE];
+        if (decrypt_seed(trailer.encryptedSeed.data(), static_cast<int>(trailer.encryptedSeed.size()), messageKey, iv, seedBytes) < 8) {
+            std::cerr << "Error:    failed to decrypt seed" << std::endl;
+            return 1;
+        }
+        for (int b = 7; b >= 0; --b) {
+            seeds[i] = (seeds[i] << 8) | seedBytes[b];
+        }
+        if (trailer.version < 2 && unpackSeed(seeds[i]) != embeddedLength(trailer) * 4) {
+            std::cerr << "Error:    " << inputPath << " trailer does not match the seed" << std::endl;
+            return 1;
+        }
+    }
+
+    std::uint64_t cipherLength = 0;
+    for (auto& trailer : trailers) {
+        cipherLength += trailer.payloadLength;
+    }
+    if (offset >= cipherLength || length == 0) {
+        std::cerr << "Error:    range starts past the end of the payload" << std::endl;
+        return 1;
+    }
+
+    // shards in slot order, each contributes its overlap with the ciphertext span
+    ByteSpan span = cipherSpanFor(offset, length, cipherLength);
+    std::vector<unsigned char> ciphertext(span.size());
+    std::uint64_t shardBegin = 0;
+    for (size_t slot = 0; slot < shardCount; ++slot) {
+        size_t i = slots[slot];
+        std::uint64_t shardEnd = shardBegin + trailers[i].payloadLength;
+        std::uint64_t begin = std::max(span.begin, shardBegin), end = std::min(span.end, shardEnd);
+        if (begin < end && !readShardRange(inputPaths[i], trailers[i], seeds[i], begin - shardBegin, end - shardBegin,
+                                           ciphertext.data() + (begin - span.begin))) {
+            return 1;
+        }
+        shardBegin = shardEnd;
+    }
+
+    // the block before the range is its IV, the final block still carries the padding
+    std::vector<unsigned char> plaintext;
+    bool first = span.begin == 0;
+    std::uint64_t plainBegin = first ? 0 : span.begin + AES_BLOCK_SIZE;
+    {
+        StageTimer timer(runStats, "decrypt");
+        if (!decryptBlocks(ciphertext.data() + (first ? 0 : AES_BLOCK_SIZE), ciphertext.size() - (first ? 0 : AES_BLOCK_SIZE),
+                           first ? iv : ciphertext.data(), messageKey, plaintext)) {
+            std::cerr << "Error:    unable to decrypt extracted range" << std::endl;
+            return 1;
+        }
+    }
+    std::uint64_t plainLength = std::numeric_limits<std::uint64_t>::max();
+    if (span.end == cipherLength) {
+        unsigned char padding = plaintext.empty() ? 0 : plaintext.back();
+        if (padding == 0 || padding > AES_BLOCK_SIZE || padding > plaintext.size() ||
+            !std::all_of(plaintext.end() - padding, plaintext.end(), [padding](unsigned char b) { return b == padding; })) {
+            std::cerr << "Error:    unable to decrypt extracted range" << std::endl;
+            return 1;
+        }
+        plainLength = cipherLength - padding;
+    }
+    if (offset >= plainLength) {
+        std::cerr << "Error:    range starts past the end of the payload" << std::endl;
+        return 1;
+    }
+    std::uint64_t end = std::min(offset + length, plainLength);
+    std::vector<unsigned char> range(plaintext.begin() + (offset - plainBegin), plaintext.begin() + (end - plainBegin));
+
+    // only a range from the start still has the magic bytes to name the file by
+    std::string outFile = outputPath == "-" || offset != 0 ? outputPath : outputPath + getFileExtension(range);
+    StageTimer timer(runStats, "write");
+    PayloadOutput output;
+    if (!output.open(outFile) || !output.write(range.data(), range.size()) || !output.close()) {
+        std::cerr << "Error: cannot reconstruct file" << std::endl;
+        return 1;
+    }
+    runStats.payloadBytes = runStats.bytesOut = range.size();
+    std::cout << "extracted bytes " << offset << " - " << end - 1 << " to:   " << outFile << std::endl;
+    return 0;
+}
+
+bool writeCarrier(Carrier& carrier, const std::string& outputPath) {
+    // bitmaps were embedded into the output mapping, unmapping is the write
+    if (carrier.type == BITMAP_CARRIER) {
+        carrier.mapped.reset();
+        return true;
+    }
+    if (carrier.type == VIDEO_CARRIER) {
+        return writeVideo(carrier.path.c_str(), outputPath.c_str(), carrier.rawBytes(), carrier.rawSize, carrier.video.height, carrier.video.width, carrier.video.framerate, carrier.video.codec, carrier.video.pixelFormat, carrier.video.keepAudio);
+    }
+    else if (carrier.type == AUDIO_CARRIER) {
+        return writeAudio(carrier.path.c_str(), outputPath.c_str(), carrier.rawBytes(), carrier.rawSize, carrier.audio.sampleRate, carrier.audio.channels, carrier.audio.codec);
+    }
+    return writeImageAs(outputPath.c_str(), carrier.imageFormat, carrier.rawBytes(), carrier.image.first[0], carrier.image.first[1], carrier.image.first[2]);
+}
+
+// enc --verify: the shard is extracted from the carrier still in memory, with the
+// position table it was embedded with, and copied into the reassembled ciphertext
+bool verifyShard(const std::string& inputPath, const unsigned char* raw, const PositionTable& pos,
+                 const std::vector<unsigned char>& stream, size_t shardLength, unsigned char* ciphertext) {
+    std::vector<unsigned char> extracted;
+    {
+        StageTimer timer(runStats, "verify_extract");
+        extracted = decode_file(raw, pos);
+    }
+    if (extracted != stream) {
+        std::cerr << "Error:    verification failed, " << inputPath << " does not extract to its stream" << std::endl;
+        return false;
+    }
+    std::copy(extracted.begin(), extracted.begin() + shardLength, ciphertext);
+    return true;
+}
+
+// --verify-output: the written container is decoded again, up to the last position and
+// for videos only the frames holding one, lossy or altered encodes show up here
+bool verifyWritten(const std::string& outputPath, const PositionTable& pos, const std::vector<unsigned char>& stream) {
+    StageTimer timer(runStats, "verify_output");
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> bitPositions(pos.size());
+    withPositions(pos, [&](const auto& p) {
+        for (std::uint64_t k = 0; k < bitPositions.size(); ++k) {
+            bitPositions[k] = { p[k], k };
+        }
+    });
+    std::sort(bitPositions.begin(), bitPositions.end());
+
+    std::vector<std::uint64_t> offsets(bitPositions.size());
+    for (size_t k = 0; k < bitPositions.size(); ++k) {
+        offsets[k] = bitPositions[k].first;
+    }
+    std::vector<unsigned char> values;
+    if (!sampleCarrier(probeCarrier(outputPath, false), offsets, values)) {
+        return false;
+    }
+    std::vector<unsigned char> extracted(stream.size(), 0);
+    for (size_t k = 0; k < bitPositions.size(); ++k) {
+        std::uint64_t bit = bitPositions[k].second;
+        extracted[bit / 4] |= (values[k] & 0x03) << (6 - 2 * (bit % 4));
+    }
+
+    size_t errors = 0;
+    for (size_t b = 0; b < stream.size(); ++b) {
+        errors += extracted[b] != stream[b];
+    }
+    if (errors != 0) {
+        std::cerr << "Error:    verification failed, " << errors << " stream bytes differ in the written " << outputPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// the reassembled ciphertext of every shard is decrypted as dec would and the plaintext
+// digest compared with the one taken while encrypting
+bool verifyPayload(const std::vector<unsigned char>& ciphertext, unsigned char* messageKey, unsigned char* iv,
+                   const unsigned char* digest) {
+    StageTimer timer(runStats, "verify_decrypt");
+    EVP_MD_CTX* md = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+    bool decrypted = decryptStream(ciphertext, messageKey, iv, [&](const unsigned char* data, size_t len) {
+        return EVP_DigestUpdate(md, data, len) == 1;
+    });
+    unsigned char recovered[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(md, recovered, &length);
+    EVP_MD_CTX_free(md);
+
+    if (!decrypted || memcmp(recovered, digest, length) != 0) {
+        std::cerr << "Error:    verification failed, the embedded payload does not decrypt to the input" << std::endl;
+        return false;
+    }
+    std::cout << "verified: the embedded payload decrypts to the input" << std::endl;
+    return true;
+}
+
+// Rewrites one shard of an update: only the positions whose bit pair differs
+// between the embedded stream and the new one are touched. Bitmaps are patched
+// through a shared mapping of the container itself, every other carrier is
+// re-encoded next to it and renamed over it, seed, trailer and key table kept.
+bool updateShard(const std::string& inputPath, const StegoTrailer& trailer, std::uint64_t seed,
+                 std::vector<unsigned char> stream, bool checkEmbedding) {
+    {
+        StageTimer timer(runStats, "checksum");
+        if (trailer.chunkShift != 0) {
+            std::vector<unsigned char> checksums = chunkChecksums(stream.data(), stream.size(), trailer.chunkShift);
+            stream.insert(stream.end(), checksums.begin(), checksums.end());
+        }
+    }
+    std::vector<unsigned char> keyTable;
+    if (trailer.extraLength != 0 && !readTrailerExtra(inputPath, trailer, keyTable)) {
+        std::cerr << "Error:    unable to read the variable trailer data of " << inputPath << std::endl;
+        return false;
+    }
+
+    Carrier carrier;
+    carrier.path = inputPath;
+    if (isBitmapFile(inputPath.c_str())) {
+        StageTimer timer(runStats, "map");
+        if (!mapBitmap(carrier, inputPath, true)) {
+            return false;
+        }
+    } else {
+        carrier = readCarrier(inputPath);
+    }
+    std::uint64_t numPos = stream.size() * std::uint64_t(4);
+    if (numPos > carrier.rawSize) {
+        std::cerr << "Error:    " << inputPath << " is shorter than its embedded stream" << std::endl;
+        return false;
+    }
+
+    PositionTable pos;
+    {
+        StageTimer timer(runStats, "position_generation");
+        pos = entropyChannel(seed, numPos, trailer.generator, trailer.flags & TRAILER_FLAG_BLOCK_LAYOUT);
+    }
+    std::vector<unsigned char> previous;
+    {
+        StageTimer timer(runStats, "extract");
+        previous = decode_file(carrier.rawBytes(), pos);
+    }
+
+    std::uint64_t changedBytes = 0, changedPositions = 0;
+    {
+        StageTimer timer(runStats, "embed");
+        unsigned char* raw = carrier.rawBytes();
+        withPositions(pos, [&](const auto& p) {
+            for (size_t b = 0; b < stream.size(); ++b) {
+                if (previous[b] == stream[b])
+                    continue;
+                ++changedBytes;
+                for (int k = 0; k < 4; ++k) {
+                    unsigned char bits = (stream[b] >> (6 - 2 * k)) & 0x03;
+                    unsigned char& val = raw[p[b * 4 + k]];
+                    if ((val & 0x03) != bits) {
+                        val = (val & 0xFC) | bits;
+                        ++changedPositions;
+                    }
+                }
+            }
+        });
+    }
+    runStats.addBytes(runStats.embeddedBytes, changedBytes);
+    std::cout << inputPath << ":   " << changedPositions << " of " << numPos << " positions rewritten, "
+              << changedBytes << " of " << stream.size() << " stream bytes changed" << std::endl;
+
+    if (checkEmbedding) {
+        StageTimer timer(runStats, "verify");
+        if (verify_lsb(carrier.rawBytes(), stream, pos) != 0) {
+            std::cerr << "Error:    embedding check failed for " << inputPath << std::endl;
+            return false;
+        }
+    }
+    if (changedPositions == 0 || carrier.type == BITMAP_CARRIER) {
+        carrier.mapped.reset();
+        return true;
+    }
+
+    // re-encoded under a hidden name with the same extension, the muxer goes by it
+    StageTimer timer(runStats, "encode_write");
+    std::filesystem::path target(inputPath);
+    std::string updatePath = (target.parent_path() / ("." + target.filename().string())).string();
+    std::error_code ec;
+    if (!writeCarrier(carrier, updatePath) || !appendTrailer(updatePath, trailer, keyTable)) {
+        std::cerr << "Error:    failed to write to container" << std::endl;
+        std::filesystem::remove(updatePath, ec);
+        return false;
+    }
+    std::filesystem::rename(updatePath, inputPath, ec);
+    if (ec) {
+        std::cerr << "Error:    unable to replace " << inputPath << std::endl;
+        std::filesystem::remove(updatePath, ec);
+        return false;
+    }
+    runStats.addBytes(runStats.bytesOut, std::filesystem::file_size(inputPath, ec));
+    return true;
+}
+
+// rsteg update: the new payload is encrypted with the container's own message key and
+// has to come out at the same ciphertext length, so seeds, positions and the chunk
+// table layout stay as they are. CBC chains every block into the next, the stream
+// changes from the first modified 16-byte block on and is identical before it
+int updateContainers(const std::vector<std::string>& inputPaths, const std::string& inputFile, unsigned char* messageKey,
+                     unsigned char* iv, bool checkEmbedding) {
+    size_t shardCount = inputPaths.size();
+    std::vector<StegoTrailer> trailers(shardCount);
+    std::vector<size_t> slots(shardCount, SIZE_MAX);
+    std::vector<std::uint64_t> seeds(shardCount, 0);
+    std::uint64_t cipherLength = 0;
+    for (size_t i = 0; i < shardCount; ++i) {
+        StageTimer timer(runStats, "probe");
+        const char* inputPath = inputPaths[i].c_str();
+        StegoTrailer& trailer = trailers[i];
+        if (!readTrailer(inputPath, trailer) || trailer.version < 2) {
+            std::cerr << "Error:    update needs a container with a version 2 trailer, " << inputPath << " has none" << std::endl;
+            return 1;
+        }
+        if (trailer.generator >= GEN_COUNT || (trailer.flags & ~TRAILER_KNOWN_FLAGS)) {
+            std::cerr << "Error:    " << inputPath << " uses an unknown position generator or layout, update rsteg" << std::endl;
+            return 1;
+        }
+        if (trailer.flags & TRAILER_FLAG_AUDIO_TRACK) {
+            std::cerr << "Error:    " << inputPath << " has a shard in its audio track, update cannot rewrite it" << std::endl;
+            return 1;
+        }
+        if (trailer.shardCount != shardCount || trailer.shardIndex >= shardCount || slots[trailer.shardIndex] != SIZE_MAX) {
+            std::cerr << "Error:    " << inputPath << " is shard " << trailer.shardIndex + 1 << " of " << trailer.shardCount
+                      << ", got " << shardCount << " container(s)" << std::endl;
+            return 1;
+        }
+        slots[trailer.shardIndex] = i;
+        cipherLength += trailer.payloadLength;
+
+        unsigned char seedBytes[AES_BLOCK_SIZE];
+        if (decrypt_seed(trailer.encryptedSeed.data(), static_cast<int>(trailer.encryptedSeed.size()), messageKey, iv, seedBytes) < 8) {
+            std::cerr << "Error:    failed to decrypt seed" << std::endl;
+            return 1;
+        }
+        for (int b = 7; b >= 0; --b) {
+            seeds[i] = (seeds[i] << 8) | seedBytes[b];
+        }
+    }
+
+    std::vector<unsigned char> encryptedBytes;
+    long long payloadLength;
+    {
+        StageTimer timer(runStats, "encrypt");
+        payloadLength = encryptFile(inputFile, messageKey, iv, encryptedBytes);
+    }
+    if (payloadLength == 0) {
+        std::cerr << "Error:    " << inputFile << " is empty, there is nothing to embed" << std::endl;
+        return 1;
+    }
+    if (payloadLength < 0) {
+        std::cerr << "Error:    unable to read embed file" << std::endl;
+        return 1;
+    }
+    runStats.payloadBytes = payloadLength;
+    runStats.bytesIn += payloadLength;
+    if (encryptedBytes.size() != cipherLength) {
+        std::cerr << "Error:    the new payload encrypts to " << encryptedBytes.size() << " bytes, the container(s) hold "
+                  << cipherLength << ", run enc again" << std::endl;
+        return 1;
+    }
+
+    std::uint64_t shardOffset = 0;
+    for (size_t slot = 0; slot < shardCount; ++slot) {
+        size_t i = slots[slot];
+        std::vector<unsigned char> stream(encryptedBytes.begin() + shardOffset,
+                                          encryptedBytes.begin() + shardOffset + trailers[i].payloadLength);
+        shardOffset += trailers[i].payloadLength;
+        if (!updateShard(inputPaths[i], trailers[i], seeds[i], std::move(stream), checkEmbedding)) {
+            return 1;
+        }
+    }
+    std::cout << "updated " << shardCount << " container(s)" << std::endl;
+    return 0;
+}
+
+// every occurrence of a repeatable option, e.g. -i a.png -i b.mkv
+std::vector<std::string> collectArgValues(int argc, char** argv, const std::string& option) {
+    std::vector<std::string> values;
+    for (int i = 2; i + 1 < argc; ++i) {
+        if (option == argv[i]) {
+            values.push_back(argv[++i]);
+        }
+    }
+    return values;
+}
+
+std::string fileExtensionOf(const std::string& path) {
+    size_t slashPos = path.find_last_of("/\\");
+    size_t dotPos = path.find_last_of('.');
+    if (dotPos == std::string::npos || (slashPos != std::string::npos && dotPos < slashPos))
+        return "";
+    return path.substr(dotPos);
+}
+
+// out.png for a single container, out_0.png out_1.mkv ... when sharding
+std::string shardOutputPath(const std::string& outputArg, const std::string& inputPath, size_t shardIndex, size_t shardCount) {
+    std::string ext = fileExtensionOf(outputArg);
+    if (shardCount == 1) {
+        return ext.empty() ? outputArg + fileExtensionOf(inputPath) : outputArg;
+    }
+    std::string stem = outputArg.substr(0, outputArg.size() - ext.size());
+    return stem + "_" + std::to_string(shardIndex) + fileExtensionOf(inputPath);
+}
+
+// --audio-track writes both streams next to the container, out.rsteg-video.mp4 and
+// out.rsteg-audio.m4a, and muxes them into it once both are encoded
+std::string trackOutputPath(const std::string& outputPath, const std::string& track, const std::string& ext) {
+    std::string stem = outputPath.substr(0, outputPath.size() - fileExtensionOf(outputPath).size());
+    return stem + ".rsteg-" + track + ext;
+}
+
+// the audio track is re-encoded losslessly in a codec the output container can hold
+bool audioTrackCodec(const std::string& outputPath, std::string& codec) {
+    std::string ext = fileExtensionOf(outputPath);
+    if (ext == ".mp4" || ext == ".mov") {
+        codec = "alac";
+    } else if (ext == ".mkv") {
+        codec = "flac";
+    } else if (ext == ".avi") {
+        codec = "pcm_s16le";
+    } else {
+        std::cerr << "Error:    " << outputPath << " cannot hold a lossless audio track, use .mkv, .mp4, .mov or .avi" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// split the ciphertext proportionally to what every carrier can hold (4 positions per byte)
+bool computeShardSizes(size_t totalBytes, const std::vector<size_t>& capacities, std::vector<size_t>& sizes) {
+    size_t totalCapacity = 0;
+    for (auto capacity : capacities) {
+        totalCapacity += capacity;
+    }
+    if (totalBytes > totalCapacity || totalBytes < capacities.size()) {
+        return false;
+    }
+
+    sizes.assign(capacities.size(), 0);
+    size_t assigned = 0;
+    for (size_t i = 0; i < capacities.size(); ++i) {
+        sizes[i] = static_cast<size_t>(static_cast<long double>(totalBytes) * capacities[i] / totalCapacity);
+        assigned += sizes[i];
+    }
+    for (size_t i = 0; i < capacities.size() && assigned < totalBytes; ++i) {
+        size_t extra = std::min(capacities[i] - sizes[i], totalBytes - assigned);
+        sizes[i] += extra;
+        assigned += extra;
+    }
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (sizes[i] == 0) {
+            if (capacities[i] == 0)
+                return false;
+            // steal one byte from the largest shard so every carrier holds data
+            auto largest = std::max_element(sizes.begin(), sizes.end());
+            --(*largest);
+            sizes[i] = 1;
+        }
+    }
+    return true;
+}
+
+// classify files from their last TRAILER_SIZE bytes only, directories are walked recursively
+int probeContainers(const std::vector<std::string>& paths) {
+    size_t found = 0, scanned = 0;
+    auto probeOne = [&](const std::string& path) {
+        StegoTrailer trailer;
+        ++scanned;
+        if (!readTrailer(path, trailer)) {
+            std::cout << path << ":   -\n";
+            return;
+        }
+        ++found;
+        std::cout << path << ":   rsteg v" << static_cast<int>(trailer.version)
+                  << "  payload " << trailer.payloadLength << " B"
+                  << "  density " << static_cast<int>(trailer.bitDensity) << " bit"
+                  << "  prng " << generatorName(trailer.generator)
+                  << ((trailer.flags & TRAILER_FLAG_BLOCK_LAYOUT) ? "  layout block" : "")
+                  << ((trailer.flags & TRAILER_FLAG_KEY_TABLE) ? "  recipients " + std::to_string(keyTableLength(trailer) / KEY_TABLE_ENTRY_SIZE) : "")
+                  << ((trailer.flags & TRAILER_FLAG_AUDIO_TRACK) ? "  audio track" : "")
+                  << "  shard " << trailer.shardIndex + 1 << "/" << trailer.shardCount << "\n";
+    };
+
+    for (const auto& path : paths) {
+        std::error_code ec;
+        if (std::filesystem::is_directory(path, ec)) {
+            for (auto it = std::filesystem::recursive_directory_iterator(path, std::filesystem::directory_options::skip_permission_denied, ec);
+                 it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+                if (ec)
+                    break;
+                if (it->is_regular_file(ec))
+                    probeOne(it->path().string());
+            }
+        } else {
+            probeOne(path);
+        }
+    }
+
+    std::cout << found << " of " << scanned << " file(s) carry a rsteg trailer" << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    OpenSSL_add_all_algorithms();
+    ERR_load_crypto_strings();
+
+    std::vector<int> index;
+    if (!parseArgs(argc, argv, index)){
+        return 1;
+    }
+
+    if (strcmp(argv[1], "probe") == 0) {
+        return probeContainers(std::vector<std::string>(argv + 2, argv + argc));
+    }
+
+    // --stats writes one JSON record per run, --quiet drops the progress output
+    std::vector<std::string> statsArg = collectArgValues(argc, argv, "--stats");
+    std::string statsPath = statsArg.empty() ? "" : statsArg.front();
+    if (hasFlag(argc, argv, "--quiet")) {
+        std::cout.setstate(std::ios::failbit);
+    }
+    if (statsPath == "-" && collectArgValues(argc, argv, "-o") == std::vector<std::string>{ "-" }) {
+        std::cerr << "Error:    --stats - and -o - both need stdout" << std::endl;
+        return 1;
+    }
+
+    // --trace dumps every span as Chrome trace JSON, open it in chrome://tracing or Perfetto
+    std::vector<std::string> traceArg = collectArgValues(argc, argv, "--trace");
+    std::string tracePath = traceArg.empty() ? "" : traceArg.front();
+    if (!tracePath.empty() && !TRACE_COMPILED_IN) {
+        std::cerr << "Warning:  tracing is not compiled in, configure with -DRSTEG_TRACE=ON" << std::endl;
+        tracePath.clear();
+    }
+    RSTEG_TRACE_THREAD("main");
+
+    // --max-memory streams carriers through tiles and runs the shards one after another
+    std::vector<std::string> memoryArg = collectArgValues(argc, argv, "--max-memory");
+    size_t memoryBudget = 0;
+    if (!memoryArg.empty() && !parseMemorySize(memoryArg.front(), memoryBudget)) {
+        std::cerr << "Error:    invalid --max-memory " << memoryArg.front() << std::endl;
+        return 1;
+    }
+    bool tiled = memoryBudget != 0;
+
+    // dec --range OFFSET:LEN extracts part of the payload without decoding the rest
+    std::vector<std::string> rangeArg = collectArgValues(argc, argv, "--range");
+    std::uint64_t rangeOffset = 0, rangeLength = 0;
+    if (!rangeArg.empty() && (strcmp(argv[1], "dec") != 0 || !parseByteRange(rangeArg.front(), rangeOffset, rangeLength))) {
+        std::cerr << "Error:    invalid --range " << rangeArg.front() << ", expected OFFSET:LEN [ mode : dec ]" << std::endl;
+        return 1;
+    }
+
+    if (strcmp(argv[1], "enc") == 0)
+    {
+        std::vector<std::string> inputPaths = collectArgValues(argc, argv, "-i");
+        std::vector<std::string> recipientKeys = collectArgValues(argc, argv, "-rk");
+        std::string inputFile = argv[index[1] + 1];
+        std::string publicKey = argv[index[2] + 1];
+        std::string privateKey = argv[index[3] + 1];
+        std::string outputArg = (index.size() == 5) ? argv[index[4] + 1] : "./out";
+        bool checkEmbedding = hasFlag(argc, argv, "--check");
+        // --verify extracts and decrypts from the embedded carrier while the output is written,
+        // --verify-output also decodes the written container again. Tiled runs have no carrier
+        // in memory and check every tile instead
+        bool verifyOutput = hasFlag(argc, argv, "--verify-output") && !tiled;
+        bool verify = (hasFlag(argc, argv, "--verify") || verifyOutput) && !tiled;
+        if (tiled && (hasFlag(argc, argv, "--verify") || hasFlag(argc, argv, "--verify-output"))) {
+            std::cerr << "Warning:  --verify cannot extract from tiled carriers, checking every tile's embedded bytes instead" << std::endl;
+            checkEmbedding = true;
+        }
+        std::vector<std::string> prngArg = collectArgValues(argc, argv, "--prng");
+        unsigned char generator = DEFAULT_GENERATOR;
+        if (!prngArg.empty() && !parseGenerator(prngArg.front(), generator)) {
+            std::cerr << "Error:    unknown position generator " << prngArg.front() << std::endl;
+            return 1;
+        }
+        // --layout block keeps runs of positions inside one page of the carrier
+        std::vector<std::string> layoutArg = collectArgValues(argc, argv, "--layout");
+        if (!layoutArg.empty() && layoutArg.front() != "shuffle" && layoutArg.front() != "block") {
+            std::cerr << "Error:    unknown position layout " << layoutArg.front() << std::endl;
+            return 1;
+        }
+        bool blockLayout = !layoutArg.empty() && layoutArg.front() == "block";
+        // --cache keeps decoded carriers on disk for the next run, --cache-max caps the directory
+        std::vector<std::string> cacheArg = collectArgValues(argc, argv, "--cache");
+        std::vector<std::string> cacheMaxArg = collectArgValues(argc, argv, "--cache-max");
+        std::string cacheDir = cacheArg.empty() || tiled ? "" : cacheArg.front();
+        size_t cacheBytes = DEFAULT_CACHE_BYTES;
+        if (!cacheMaxArg.empty() && !parseMemorySize(cacheMaxArg.front(), cacheBytes)) {
+            std::cerr << "Error:    invalid --cache-max " << cacheMaxArg.front() << std::endl;
+            return 1;
+        }
+        if (outputArg == "-") {
+            std::cerr << "Error:    the stego container has to be written to a file" << std::endl;
+            return 1;
+        }
+
+        // --audio-track makes the audio track of every video one more shard carrier, embedded
+        // and encoded on its own worker beside the frames. pairedShard links the two streams
+        // of such a container, the track shards follow the input files
+        size_t fileCount = inputPaths.size();
+        std::vector<size_t> pairedShard(fileCount, SIZE_MAX);
+        std::vector<std::string> trackFiles(fileCount);
+        std::vector<std::string> trackCodecs(fileCount);
+        for (size_t i = 0; hasFlag(argc, argv, "--audio-track") && i < fileCount; ++i) {
+            if (!isVideoFile(inputPaths[i].c_str()))
+                continue;
+            std::string outputPath = shardOutputPath(outputArg, inputPaths[i], i, fileCount);
+            std::string codec;
+            if (!audioTrackCodec(outputPath, codec)) {
+                return 1;
+            }
+            pairedShard[i] = inputPaths.size();
+            pairedShard.push_back(i);
+            inputPaths.push_back(inputPaths[i]);
+            trackFiles[i] = trackOutputPath(outputPath, "video", fileExtensionOf(outputPath));
+            trackFiles.push_back(trackOutputPath(outputPath, "audio", audioExtension(codec)));
+            trackCodecs.push_back(codec);
+        }
+        size_t shardCount = inputPaths.size();
+        runStats.mode = "enc";
+        runStats.threads = tiled ? 1 : shardCount;
+
+        if (shardCount > std::numeric_limits<std::uint16_t>::max()) {
+            std::cerr << "Error:    too many containers" << std::endl;
+            return 1;
+        }
+
+        // decode every carrier on its own worker, tiled runs and streamed audio only probe
+        // them here. --cache wants the decoded audio, it keeps the whole-carrier path
+        std::vector<Carrier> carriers(shardCount);
+        std::vector<char> streamed(shardCount, tiled);
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < shardCount; ++i) {
+            bool track = i >= fileCount;
+            streamed[i] = tiled || track || (cacheDir.empty() && isAudioFile(inputPaths[i].c_str()));
+            bool paired = !track && pairedShard[i] != SIZE_MAX;
+            workers.emplace_back([&carriers, &inputPaths, &cacheDir, &streamed, &trackCodecs, i, track, paired, tiled, shardCount, cacheBytes]() {
+                RSTEG_TRACE_THREAD("read " + std::to_string(i));
+                if (track) {
+                    carriers[i] = probeAudioStream(inputPaths[i], true);
+                    carriers[i].audio.codec = trackCodecs[i];
+                    return;
+                }
+                carriers[i] = tiled ? probeCarrier(inputPaths[i], shardCount > 1)
+                            : streamed[i] ? probeAudioStream(inputPaths[i]) : readCarrier(inputPaths[i], cacheDir, cacheBytes);
+                // the stego audio track replaces the original, the video pass leaves it out
+                carriers[i].video.keepAudio = !paired;
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        if (verify && std::count(streamed.begin(), streamed.end(), 1) != 0) {
+            std::cerr << "Warning:  --verify cannot extract from streamed audio carriers, checking the embedded bytes instead" << std::endl;
+            checkEmbedding = true;
+            verify = verifyOutput = false;
+        }
+
+        // several -rk: one random message key, wrapped for every recipient in the key table
+        unsigned char messageKey[32];
+        unsigned char iv[16]; 
+        std::vector<unsigned char> keyTable;
+        {
+            StageTimer timer(runStats, "key_derivation");
+            if (recipientKeys.size() == 1) {
+                std::vector<unsigned char> sec = computeSharedSecret(privateKey, publicKey);
+                deriveAesKeyAndIv(sec, messageKey, iv);
+            } else {
+                if (!randomMessageKey(messageKey, iv)) {
+                    std::cerr << "Error:    unable to generate a message key" << std::endl;
+                    return 1;
+                }
+                for (const auto& recipientKey : recipientKeys) {
+                    std::vector<unsigned char> entry = wrapMessageKey(computeSharedSecret(privateKey, recipientKey), messageKey, iv);
+                    keyTable.insert(keyTable.end(), entry.begin(), entry.end());
+                }
+            }
+        }
+
+        // the payload is streamed through the cipher, -m - reads it from stdin
+        std::vector<unsigned char> encryptedBytes;
+        unsigned char plainDigest[EVP_MAX_MD_SIZE];
+        long long payloadLength;
+        {
+            StageTimer timer(runStats, "encrypt");
+            payloadLength = encryptFile(inputFile, messageKey, iv, encryptedBytes, verify ? plainDigest : nullptr);
+        }
+        if (payloadLength == 0) {
+            std::cerr << "Error:    " << inputFile << " is empty, there is nothing to embed" << std::endl;
+            return 1;
+        }
+        if (payloadLength < 0) {
+            std::cerr << "Error:    unable to read embed file" << std::endl;
+            return 1;
+        }
+        runStats.payloadBytes = payloadLength;
+        runStats.bytesIn += payloadLength;
+
+        /*  //  debug block
+        std::cout << "AES-256 encrypted bytes: " << std::endl;
+        bool first = true;
+        for (auto ch : encryptedBytes) {
+            if (!first) {
+                std::cout << ' ';
+            }
+            std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned int>(static_cast<unsigned char>(ch));
+            first = false;
+        }
+        std::cout << std::dec << std::endl;  */
+
+        // Calculate size for encoding
+        std::uint64_t numPos = static_cast<std::uint64_t>(encryptedBytes.size()) * 4;
+
+        std::cout << std::fixed << std::setprecision(1) << "minimum required container size:   " << static_cast<double>(numPos)/1024.0 << " KB" << std::endl; 
+
+        std::vector<size_t> capacities;
+        double containerSize = 0;
+        for (auto& carrier : carriers) {
+            // every chunk of payload costs 4 more bytes of checksum table
+            size_t capacity = carrier.rawSize / 4;
+            capacities.push_back(capacity - std::min(capacity, 4 * chunkCount(capacity, CHUNK_SHIFT)));
+            containerSize += static_cast<double>(carrier.rawSize);
+        }
+
+        std::vector<size_t> shardSizes;
+        if (encryptedBytes.size() < capacities.size()) {
+            std::cerr << "Error:    payload smaller than carrier count, " << encryptedBytes.size() << " encrypted bytes for "
+                      << capacities.size() << " carriers and every shard needs one" << std::endl;
+            return 1;
+        }
+        if (!computeShardSizes(encryptedBytes.size(), capacities, shardSizes)) {
+            std::cerr << "Error:    insufficient container size" << std::endl;
+            return 1;
+        }
+
+        std::cout << "file size:    " << std::fixed << std::setprecision(1) << static_cast<double>(encryptedBytes.size())/1024.0 << " KB" << std::endl;
+        if (carriers.front().rawSize != SIZE_MAX)
+            std::cout << "container size:   " << std::fixed << std::setprecision(1) << containerSize/1024.0 << " KB" << std::endl;
+
+        // fail before anything is decoded if a shard cannot fit the budget
+        std::vector<size_t> tileSizes(shardCount, 0);
+        for (size_t i = 0; !tiled && i < shardCount; ++i) {
+            if (streamed[i])
+                tileSizes[i] = AUDIO_STREAM_UNITS * tileUnit(carriers[i]);
+        }
+        for (size_t i = 0; tiled && i < shardCount; ++i) {
+            size_t streamBytes = shardSizes[i] + 4 * chunkCount(shardSizes[i], CHUNK_SHIFT);
+            size_t fixedBytes = encryptedBytes.size() + tiledFixedBytes(streamBytes);
+            tileSizes[i] = tileSizeFor(memoryBudget, fixedBytes, tileUnit(carriers[i]), carriers[i].rawSize);
+            if (tileSizes[i] == 0) {
+                std::cerr << "Error:    --max-memory is below the " << (fixedBytes + TILE_BUFFERS * tileUnit(carriers[i])) / (1024 * 1024) + 1
+                          << " MB needed for " << inputPaths[i] << std::endl;
+                return 1;
+            }
+        }
+
+        // embed every shard concurrently, one worker per carrier; tiled runs go one at a time.
+        // With --verify the extracted shards are reassembled here, the last one decrypts them
+        std::vector<int> status(shardCount, 0);
+        std::vector<StegoTrailer> trailers(shardCount);
+        std::vector<unsigned char> extractedCipher(verify ? encryptedBytes.size() : 0);
+        std::atomic<size_t> pendingShards{ shardCount };
+        size_t shardOffset = 0;
+        for (size_t i = 0; i < shardCount; ++i) {
+            std::vector<unsigned char> shard(encryptedBytes.begin() + shardOffset, encryptedBytes.begin() + shardOffset + shardSizes[i]);
+            size_t shardStart = shardOffset;
+            shardOffset += shardSizes[i];
+
+            workers.emplace_back([&, i, shard, shardStart]() mutable {
+                RSTEG_TRACE_THREAD("shard " + std::to_string(i));
+                std::string outputPath = pairedShard[i] != SIZE_MAX ? trackFiles[i] : shardOutputPath(outputArg, inputPaths[i], i, fileCount);
+
+                // embedded stream: ciphertext shard followed by its chunk checksums
+                size_t shardLength = shard.size();
+                std::vector<unsigned char> stream = std::move(shard);
+                {
+                    StageTimer timer(runStats, "checksum");
+                    std::vector<unsigned char> checksums = chunkChecksums(stream.data(), shardLength, CHUNK_SHIFT);
+                    stream.insert(stream.end(), checksums.begin(), checksums.end());
+                }
+                runStats.addBytes(runStats.embeddedBytes, stream.size());
+
+                std::uint64_t Seed = generateSeed();
+                if (Seed == 0) {
+                    std::cerr << "Error: unhandled exception" << std::endl;
+                    return;
+                }
+
+                unsigned char seedBytes[sizeof(Seed)];
+                for (long long unsigned int b = 0; b < sizeof(Seed); ++b) {
+                    seedBytes[b] = (Seed >> (8 * b)) & 0xFF;
+                }
+
+                unsigned char encryptedSeed[AES_BLOCK_SIZE];
+                int encryptedSeedLength = encrypt_seed(seedBytes, sizeof(seedBytes), messageKey, iv, encryptedSeed);
+
+                auto start = std::chrono::high_resolution_clock::now();
+                PositionTable pos;
+                {
+                    StageTimer timer(runStats, "position_generation");
+                    pos = entropyChannel(Seed, stream.size() * std::uint64_t(4), generator, blockLayout);
+                }
+                auto stop = std::chrono::high_resolution_clock::now();
+
+                std::chrono::duration<double, std::milli> duration = stop - start;
+                std::cout << "generated encoding sequence in " << std::setprecision(2) << duration.count() << " ms" << std::endl; 
+
+                if (streamed[i]) {
+                    StageTimer timer(runStats, "embed_write");
+                    invertPositions(pos);
+                    if (!embedTiled(carriers[i], outputPath, stream, pos, tileSizes[i], checkEmbedding)) {
+                        std::cerr << "Error:    embedding failed for " << inputPaths[i] << std::endl;
+                        std::error_code ec;
+                        std::filesystem::remove(outputPath, ec);
+                        return;
+                    }
+                } else {
+                    // bitmaps are embedded straight into a copy of the carrier file
+                    if (carriers[i].type == BITMAP_CARRIER) {
+                        StageTimer timer(runStats, "copy");
+                        if (!copyBitmap(carriers[i], outputPath) || !mapBitmap(carriers[i], outputPath, true)) {
+                            return;
+                        }
+                    }
+                    {
+                        StageTimer timer(runStats, "embed");
+                        encode_lsb(carriers[i].rawBytes(), stream, pos);
+                    }
+                    if (checkEmbedding) {
+                        StageTimer timer(runStats, "verify");
+                        if (verify_lsb(carriers[i].rawBytes(), stream, pos) != 0) {
+                            std::cerr << "Error:    embedding check failed for " << inputPaths[i] << std::endl;
+                            return;
+                        }
+                    }
+                }
+
+                // extraction reads the carrier while the encoder does, it is not modified any more
+                std::future<bool> verified;
+                if (verify) {
+                    verified = std::async(std::launch::async, [&]() {
+                        RSTEG_TRACE_THREAD("verify " + std::to_string(i));
+                        return verifyShard(inputPaths[i], carriers[i].rawBytes(), pos, stream, shardLength,
+                                           extractedCipher.data() + shardStart);
+                    });
+                }
+
+                StegoTrailer trailer;
+                trailer.generator = generator;
+                trailer.flags = (blockLayout ? TRAILER_FLAG_BLOCK_LAYOUT : 0) | (keyTable.empty() ? 0 : TRAILER_FLAG_KEY_TABLE);
+                trailer.version = trailerVersionFor(trailer.flags);
+                trailer.payloadLength = shardLength;
+                trailer.chunkShift = CHUNK_SHIFT;
+                trailer.shardIndex = static_cast<std::uint16_t>(i);
+                trailer.shardCount = static_cast<std::uint16_t>(shardCount);
+                trailer.encryptedSeed.assign(encryptedSeed, encryptedSeed + encryptedSeedLength);
+
+                {
+                    StageTimer timer(runStats, "encode_write");
+                    // the bitmap write unmaps the carrier the extraction reads from
+                    if (verified.valid() && carriers[i].type == BITMAP_CARRIER) {
+                        verified.wait();
+                    }
+                    if (!streamed[i] && !writeCarrier(carriers[i], outputPath)) {
+                        std::cerr << "Error: failed to write to container" << std::endl;
+                        return;
+                    }
+
+                    // the streams of an --audio-track container get their trailer once they are muxed
+                    if (pairedShard[i] != SIZE_MAX) {
+                        trailers[i] = trailer;
+                        status[i] = 1;
+                        return;
+                    }
+
+                    // write the seed
+                    if (appendTrailer(outputPath, trailer, keyTable)) {
+                        std::cout << "seed written to container." << std::endl;
+                    } else {
+                        std::cerr << "Error: failed to embed seed bytes." << std::endl;
+                        return;
+                    }
+                }
+                std::error_code ec;
+                runStats.addBytes(runStats.bytesOut, std::filesystem::file_size(outputPath, ec));
+
+                if (verify) {
+                    if (!verified.get() || (verifyOutput && !verifyWritten(outputPath, pos, stream))) {
+                        return;
+                    }
+                    if (--pendingShards == 0 && !verifyPayload(extractedCipher, messageKey, iv, plainDigest)) {
+                        return;
+                    }
+                }
+
+                std::cout << "successfully created embedded container:\t" << outputPath << std::endl;
+                status[i] = 1;
+            });
+            if (tiled) {
+                workers.back().join();
+            }
+        }
+        for (auto& worker : workers) {
+            if (worker.joinable())
+                worker.join();
+        }
+
+        // both streams are copied into the container as they were encoded, the audio
+        // shard's trailer follows the key table in the video shard's variable data
+        for (size_t i = 0; i < fileCount; ++i) {
+            size_t track = pairedShard[i];
+            if (track == SIZE_MAX)
+                continue;
+            std::string outputPath = shardOutputPath(outputArg, inputPaths[i], i, fileCount);
+            bool muxed = status[i] && status[track];
+            if (muxed) {
+                StageTimer timer(runStats, "mux");
+                muxed = muxTracks(trackFiles[i], trackFiles[track], outputPath);
+            }
+            std::error_code ec;
+            std::filesystem::remove(trackFiles[i], ec);
+            std::filesystem::remove(trackFiles[track], ec);
+
+            std::vector<unsigned char> extra = keyTable;
+            std::vector<unsigned char> trackTrailer = serializeTrailer(trailers[track]);
+            extra.insert(extra.end(), trackTrailer.begin(), trackTrailer.end());
+            trailers[i].flags |= TRAILER_FLAG_AUDIO_TRACK;
+            trailers[i].version = trailerVersionFor(trailers[i].flags);
+            if (!muxed || !appendTrailer(outputPath, trailers[i], extra)) {
+                std::cerr << "Error:    unable to mux the video and audio streams of " << outputPath << std::endl;
+                status[i] = 0;
+                continue;
+            }
+            runStats.addBytes(runStats.bytesOut, std::filesystem::file_size(outputPath, ec));
+            std::cout << "successfully created embedded container:\t" << outputPath << std::endl;
+        }
+
+        if (std::count(status.begin(), status.end(), 1) != static_cast<long>(shardCount)) {
+            return 1;
+        }
+
+    } else if (strcmp(argv[1], "update") == 0) {
+        std::vector<std::string> inputPaths = collectArgValues(argc, argv, "-i");
+        std::string inputFile = argv[index[1] + 1];
+        const char* publicKey = argv[index[2] + 1];
+        const char* privateKey = argv[index[3] + 1];
+        runStats.mode = "update";
+
+        // the sender's pair secret is the recipient's, it opens the key table as well
+        unsigned char messageKey[32];
+        unsigned char iv[16];
+        {
+            StageTimer timer(runStats, "key_derivation");
+            std::vector<unsigned char> sec = computeSharedSecret(privateKey, publicKey);
+            if (!resolveMessageKey(inputPaths.front(), sec, messageKey, iv)) {
+                return 1;
+            }
+        }
+
+        int status = updateContainers(inputPaths, inputFile, messageKey, iv, hasFlag(argc, argv, "--check"));
+        if (status != 0) {
+            return status;
+        }
+    } else if (strcmp(argv[1], "dec") == 0 && !rangeArg.empty()) {
+        std::vector<std::string> inputPaths = collectArgValues(argc, argv, "-i");
+        const char* publicKey = argv[index[1] + 1];
+        const char* privateKey = argv[index[2] + 1];
+        std::string outputPath = index.size() == 4 ? argv[index[3] + 1] : "./file";
+        runStats.mode = "dec";
+
+        if (outputPath == "-") {
+            std::ios::iostate quietState = std::cout.rdstate();
+            std::cout.rdbuf(std::cerr.rdbuf());
+            std::cout.setstate(quietState);
+        }
+
+        unsigned char messageKey[32];
+        unsigned char iv[16];
+        {
+            StageTimer timer(runStats, "key_derivation");
+            std::vector<unsigned char> sec = computeSharedSecret(privateKey, publicKey);
+            if (!resolveMessageKey(inputPaths.front(), sec, messageKey, iv)) {
+                return 1;
+            }
+        }
+
+        int status = extractRange(inputPaths, messageKey, iv, rangeOffset, rangeLength, outputPath);
+        if (status != 0) {
+            return status;
+        }
+
+    } else if (strcmp(argv[1], "dec") == 0) {
+        std::vector<std::string> inputPaths = collectArgValues(argc, argv, "-i");
+        const char* publicKey = argv[index[1] + 1];
+        const char* privateKey = argv[index[2] + 1];
+        std::string outputPath = index.size() == 4 ? argv[index[3] + 1] : "./file";
+        bool recover = hasFlag(argc, argv, "--recover");
+
+        // an --audio-track container holds one more shard in its audio track, it is
+        // extracted on a worker of its own like any other carrier
+        std::vector<char> audioTrack(inputPaths.size(), 0);
+        for (size_t i = 0, fileCount = inputPaths.size(); i < fileCount; ++i) {
+            StegoTrailer trailer;
+            if (readTrailer(inputPaths[i], trailer) && (trailer.flags & TRAILER_FLAG_AUDIO_TRACK)) {
+                inputPaths.push_back(inputPaths[i]);
+                audioTrack.push_back(1);
+            }
+        }
+        size_t shardCount = inputPaths.size();
+        runStats.mode = "dec";
+        runStats.threads = tiled ? 1 : shardCount;
+
+        // -o - streams the payload to stdout, keep the progress output off it
+        bool toStdout = outputPath == "-";
+        if (toStdout) {
+            std::ios::iostate quietState = std::cout.rdstate();
+            std::cout.rdbuf(std::cerr.rdbuf());
+            std::cout.setstate(quietState);
+        }
+
+        unsigned char messageKey[32];
+        unsigned char iv[16]; 
+        {
+            StageTimer timer(runStats, "key_derivation");
+            std::vector<unsigned char> sec = computeSharedSecret(privateKey, publicKey);
+            if (!resolveMessageKey(inputPaths.front(), sec, messageKey, iv)) {
+                return 1;
+            }
+        }
+
+        // containers may be passed in any order, the seed block tells each shard's slot
+        std::vector<std::vector<unsigned char>> shards(shardCount);
+        std::vector<int> shardSlot(shardCount, -1);
+        std::vector<std::vector<size_t>> corruptChunks(shardCount);
+        std::vector<unsigned char> chunkShifts(shardCount, 0);
+        size_t heldBytes = 0;
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < shardCount; ++i) {
+            workers.emplace_back([&, i]() {
+                RSTEG_TRACE_THREAD("shard " + std::to_string(i));
+                const char* inputPath = inputPaths[i].c_str();
+
+                // containers written before the trailer only carry the raw seed block
+                StegoTrailer trailer;
+                bool legacy;
+                std::vector<unsigned char> encryptedSeed;
+                {
+                    StageTimer timer(runStats, "probe");
+                    if (audioTrack[i] && !readAudioTrackTrailer(inputPath, trailer)) {
+                        std::cerr << "Error:    the audio track trailer of " << inputPath << " is damaged" << std::endl;
+                        return;
+                    }
+                    legacy = !audioTrack[i] && !readTrailer(inputPath, trailer);
+                    encryptedSeed = legacy ? decodeSeedBytes(inputPath) : trailer.encryptedSeed;
+                }
+                if (legacy && encryptedSeed.size() != AES_BLOCK_SIZE) {
+                    std::cerr << "Error:    " << inputPath << " is not a rsteg container" << std::endl;
+                    return;
+                }
+                if (trailer.generator >= GEN_COUNT || (trailer.flags & ~TRAILER_KNOWN_FLAGS)) {
+                    std::cerr << "Error:    " << inputPath << " uses an unknown position generator or layout, update rsteg" << std::endl;
+                    return;
+                }
+
+                std::cout << "extracted seed:   ";
+                for (size_t b = 0; b < encryptedSeed.size(); ++b) {
+                    if (b != 0) {
+                        std::cout << ' ';
+                    }
+                    std::cout << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(encryptedSeed[b]);
+                }
+                std::cout << std::dec << std::endl;
+
+                unsigned char seedBytes[AES_BLOCK_SIZE];
+                int seedBlockLength = decrypt_seed(encryptedSeed.data(), static_cast<int>(encryptedSeed.size()), messageKey, iv, seedBytes);
+                if (seedBlockLength < 8) {
+                    std::cerr << "Error:    failed to decrypt seed" << std::endl;
+                    return;
+                }
+
+                std::uint64_t decryptedSeed = 0;
+                for (int b = 7; b >= 0; --b) {
+                    decryptedSeed = (decryptedSeed << 8) | seedBytes[b];
+                }
+                size_t shardIndex = trailer.shardIndex, shardTotal = trailer.shardCount;
+                if (legacy && seedBlockLength >= 12) {
+                    shardIndex = seedBytes[8] | (seedBytes[9] << 8);
+                    shardTotal = seedBytes[10] | (seedBytes[11] << 8);
+                }
+                if (shardTotal != shardCount || shardIndex >= shardCount) {
+                    std::cerr << "Error:    " << inputPath << " is shard " << shardIndex + 1 << " of " << shardTotal
+                              << ", got " << shardCount << " container(s)" << std::endl;
+                    return;
+                }
+
+                std::cout << "decrypted seed:   " << decryptedSeed << std::endl;
+
+                // before trailer version 2 the position count was packed into the seed
+                std::uint64_t numPos = embeddedLength(trailer) * 4;
+                if (legacy || trailer.version < 2) {
+                    std::uint64_t packedPos = unpackSeed(decryptedSeed);
+                    if (!legacy && packedPos != numPos) {
+                        std::cerr << "Error:    " << inputPath << " trailer does not match the seed" << std::endl;
+                        return;
+                    }
+                    numPos = packedPos;
+                }
+
+                // positions all fall below numPos, a video is decoded up to the segment holding it
+                bool streamed = tiled || audioTrack[i] || isAudioFile(inputPath);
+                Carrier carrier = audioTrack[i] ? probeAudioTrack(inputPath)
+                                : streamed ? probeCarrier(inputPath, false) : readCarrier(inputPath, "", DEFAULT_CACHE_BYTES, numPos);
+                if (!streamed && numPos > carrier.rawSize) {
+                    std::cerr << "Error:    " << inputPath << " is shorter than its embedded stream" << std::endl;
+                    return;
+                }
+
+                // tiled runs check the budget before generating positions
+                size_t tileBytes = streamed ? AUDIO_STREAM_UNITS * tileUnit(carrier) : 0;
+                if (tiled) {
+                    size_t fixedBytes = heldBytes + tiledFixedBytes(numPos / 4);
+                    tileBytes = tileSizeFor(memoryBudget, fixedBytes, tileUnit(carrier), carrier.rawSize);
+                    if (tileBytes == 0) {
+                        std::cerr << "Error:    --max-memory is below the " << (fixedBytes + TILE_BUFFERS * tileUnit(carrier)) / (1024 * 1024) + 1
+                                  << " MB needed for " << inputPath << std::endl;
+                        return;
+                    }
+                }
+
+                auto start = std::chrono::high_resolution_clock::now();
+                PositionTable pos;
+                {
+                    StageTimer timer(runStats, "position_generation");
+                    pos = entropyChannel(decryptedSeed, numPos, trailer.generator, trailer.flags & TRAILER_FLAG_BLOCK_LAYOUT);
+                }
+                auto stop = std::chrono::high_resolution_clock::now();
+                std::chrono::duration<double, std::milli> duration = stop - start;
+                std::cout << "generated encoding sequence in " << std::setprecision(2) << duration.count() << " ms" << std::endl; 
+
+                if (streamed) {
+                    StageTimer timer(runStats, "extract");
+                    invertPositions(pos);
+                    shards[i] = extractTiled(carrier, pos, tileBytes);
+                    if (shards[i].empty()) {
+                        return;
+                    }
+                } else {
+                    StageTimer timer(runStats, "extract");
+                    shards[i] = decode_file(carrier.rawBytes(), pos);
+                }
+                runStats.addBytes(runStats.embeddedBytes, shards[i].size());
+
+                // check the chunk table, then drop it from the stream
+                if (!legacy && trailer.chunkShift != 0) {
+                    StageTimer timer(runStats, "verify");
+                    corruptChunks[i] = verifyChunks(shards[i].data(), trailer.payloadLength,
+                                                    shards[i].data() + trailer.payloadLength, trailer.chunkShift);
+                    shards[i].resize(trailer.payloadLength);
+                    chunkShifts[i] = trailer.chunkShift;
+                }
+                if (tiled)
+                    heldBytes += shards[i].size();
+                shardSlot[i] = static_cast<int>(shardIndex);
+            });
+            if (tiled) {
+                workers.back().join();
+            }
+        }
+        for (auto& worker : workers) {
+            if (worker.joinable())
+                worker.join();
+        }
+
+        // corrupt ranges are reported as offsets into the combined ciphertext
+        std::vector<unsigned char> extractedBytes;
+        std::vector<std::pair<size_t, size_t>> corruptRanges;
+        for (size_t slot = 0; slot < shardCount; ++slot) {
+            auto it = std::find(shardSlot.begin(), shardSlot.end(), static_cast<int>(slot));
+            if (it == shardSlot.end()) {
+                std::cerr << "Error:    missing shard " << slot + 1 << " of " << shardCount << std::endl;
+                return 1;
+            }
+            size_t i = std::distance(shardSlot.begin(), it);
+            size_t chunkSize = size_t(1) << chunkShifts[i];
+            for (auto chunk : corruptChunks[i]) {
+                size_t begin = chunk * chunkSize;
+                size_t end = std::min(begin + chunkSize, shards[i].size());
+                std::cerr << "Error:    corrupt chunk in " << inputPaths[i] << ":   bytes " << extractedBytes.size() + begin
+                          << " - " << extractedBytes.size() + end - 1 << std::endl;
+                corruptRanges.emplace_back(extractedBytes.size() + begin, extractedBytes.size() + end);
+            }
+            extractedBytes.insert(extractedBytes.end(), shards[i].begin(), shards[i].end());
+            std::vector<unsigned char>().swap(shards[i]);
+        }
+
+        if (!corruptRanges.empty() && !recover) {
+            std::cerr << "Error:    " << corruptRanges.size() << " corrupt chunk(s), rerun with --recover to keep the intact ones" << std::endl;
+            return 1;
+        }
+
+        // CBC damage spreads one block past a corrupt chunk, blank those bytes and keep the rest
+        if (!corruptRanges.empty()) {
+            std::vector<unsigned char> recovered;
+            decryptStream(extractedBytes, messageKey, iv, [&](const unsigned char* data, size_t len) {
+                recovered.insert(recovered.end(), data, data + len);
+                return true;
+            }, false);
+            for (auto& range : corruptRanges) {
+                std::fill(recovered.begin() + std::min(range.first, recovered.size()),
+                          recovered.begin() + std::min(range.second + AES_BLOCK_SIZE, recovered.size()), 0);
+            }
+            unsigned char padding = recovered.empty() ? 0 : recovered.back();
+            if (padding > 0 && padding <= AES_BLOCK_SIZE && padding <= recovered.size() &&
+                std::all_of(recovered.end() - padding, recovered.end(), [padding](unsigned char b) { return b == padding; })) {
+                recovered.resize(recovered.size() - padding);
+            }
+
+            std::string outFile = toStdout ? "-" : outputPath + getFileExtension(recovered);
+            PayloadOutput output;
+            if (!output.open(outFile) || !output.write(recovered.data(), recovered.size()) || !output.close()) {
+                std::cerr << "Error: cannot reconstruct file" << std::endl;
+                return 1;
+            }
+            std::cout << "partially reconstructed the file:   " << outFile << std::endl;
+            return 1;
+        }
+
+        // the first plaintext chunk decides the file extension, the rest is streamed out
+        PayloadOutput output;
+        bool opened = false;
+        std::string outFile;
+        bool decrypted;
+        {
+            StageTimer timer(runStats, "decrypt_write");
+            decrypted = decryptStream(extractedBytes, messageKey, iv, [&](const unsigned char* data, size_t len) {
+                if (!opened) {
+                    outFile = toStdout ? "-" : outputPath + getFileExtension(std::vector<unsigned char>(data, data + len));
+                    opened = output.open(outFile);
+                    if (!opened) {
+                        std::cerr << "Error: cannot reconstruct file" << std::endl;
+                        return false;
+                    }
+                }
+                runStats.payloadBytes += len;
+                return output.write(data, len);
+            });
+            if (opened) {
+                decrypted = output.close() && decrypted;
+            }
+        }
+        runStats.bytesOut = runStats.payloadBytes;
+
+        if (!decrypted) {
+            std::cerr << "Error:    unable to decrypt extracted file" << std::endl;
+            return 1;
+        }
+        std::cout << "reconstructed the file:   " << outFile << std::endl;
+
+    } else {
+        std::cerr << "rsteg --help for more information" << std::endl;
+        return 1;
+    }
+
+    if (!statsPath.empty()) {
+        FILE* statsFile = openPayloadStream(statsPath, true);
+        if (!statsFile) {
+            std::cerr << "Error:    unable to write stats to " << statsPath << std::endl;
+            return 1;
+        }
+        runStats.buffersReused = bufferPool().reused;
+        runStats.hugePageBytes = bufferPool().hugePageBytes;
+        std::string record = runStats.toJson() + "\n";
+        fwrite(record.data(), 1, record.size(), statsFile);
+        closePayloadStream(statsFile);
+    }
+    if (!tracePath.empty() && !traceDump(tracePath)) {
+        std::cerr << "Error:    unable to write trace to " << tracePath << std::endl;
         return 1;
     }
 
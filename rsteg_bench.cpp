@@ -0,0 +1,514 @@
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <filesystem>
+#include <unistd.h>
+#include "io_helpers.hpp"
+#include "image_helpers.hpp"
+#include "lsb_rand.hpp"
+#include "aes_helpers.hpp"
+#include "trailer_helpers.hpp"
+#include "tile_helpers.hpp"
+#include "synth_helpers.hpp"
+
+// rsteg_bench: per-stage throughput of the enc/dec pipeline on synthetic carriers.
+// Everything random is derived from --seed so runs are reproducible.
+
+struct BenchOptions {
+    std::vector<std::string> carriers = { "png", "qoi", "webp", "wav", "video" };
+    double sizeMB = 16.0;
+    double fill = 0.9;
+    int iterations = 5;
+    std::uint64_t seed = 1;
+    bool largeCheck = false;
+    std::string out = "-";
+};
+
+struct StageResult {
+    std::string carrier;
+    std::string stage;
+    size_t bytes = 0;
+    std::vector<double> ms;
+};
+
+struct GeneratorResult {
+    std::string generator;
+    size_t positions = 0;
+    size_t memoryBytes = 0;
+    std::uint32_t fingerprint = 0;
+    std::vector<double> ms;
+};
+
+struct LayoutResult {
+    std::string layout;
+    size_t positions = 0;
+    bool verified = false;
+    std::vector<double> generateMs, embedMs, extractMs;
+};
+
+struct LargeCheckResult {
+    std::string status = "not run";
+    std::uint64_t carrierBytes = 0;
+    std::uint64_t maxPosition = 0;
+    std::uint64_t payloadLength = 0;
+};
+
+struct CarrierStatus {
+    std::string carrier;
+    std::string status;
+    std::uint64_t fileBytes = 0;   // stego container written by the last iteration
+};
+
+struct CarrierSample {
+    std::string path;
+    int width = 0, height = 0, channels = 3;
+    int sampleRate = 44100, audioChannels = 2;
+};
+
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+};
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+    return values[std::min(values.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+template <typename F>
+void timeStage(StageResult& result, F&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto stop = std::chrono::steady_clock::now();
+    result.ms.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+}
+
+// synthesizes the carrier on disk and returns its raw (decoded) size
+size_t makeCarrier(const std::string& kind, const std::string& dir, const BenchOptions& options, std::mt19937_64& rng, CarrierSample& sample) {
+    size_t rawSize = static_cast<size_t>(options.sizeMB * 1024 * 1024);
+    ImageFormat format;
+    if (parseImageFormat(kind, format)) {
+        // the same picture for every image format
+        sample.path = dir + "/carrier." + kind;
+        sample.width = 1024;
+        sample.height = std::max<int>(1, static_cast<int>(rawSize / (sample.width * 3)));
+        RawBytes pixels = syntheticPicture(sample.width, sample.height, rng);
+        return writeImageAs(sample.path.c_str(), format, pixels.data(), sample.width, sample.height, 3) ? pixels.size() : 0;
+    }
+    if (kind == "wav") {
+        sample.path = dir + "/carrier.wav";
+        std::vector<unsigned char> pcm = randomBytes(rawSize & ~size_t(3), rng);
+        return writeWav(sample.path, pcm, sample.sampleRate, sample.audioChannels) ? pcm.size() : 0;
+    }
+    if (kind == "video") {
+        // raw rgb24 frames, measures the pipeline without a codec in the way
+        sample.path = dir + "/carrier.rgb";
+        sample.width = 1280;
+        sample.height = 720;
+        size_t frame = static_cast<size_t>(sample.width) * sample.height * 3;
+        RawBytes frames = randomBytes<RawBytes>(std::max<size_t>(1, rawSize / frame) * frame, rng);
+        FILE* fp = fopen(sample.path.c_str(), "wb");
+        bool ok = fp && fwrite(frames.data(), 1, frames.size(), fp) == frames.size();
+        if (fp)
+            fclose(fp);
+        return ok ? frames.size() : 0;
+    }
+    return 0;
+}
+
+bool readSample(const std::string& kind, CarrierSample& sample, RawBytes& raw) {
+    ImageFormat format;
+    if (parseImageFormat(kind, format)) {
+        raw = readImageAs(sample.path.c_str(), format).second;
+        return true;
+    }
+    if (kind == "wav") {
+        raw = readAudio(sample.path.c_str()).rawData;
+        return true;
+    }
+    FILE* fp = fopen(sample.path.c_str(), "rb");
+    if (!fp)
+        return false;
+    readIntoRaw(fp, raw);
+    fclose(fp);
+    return !raw.empty();
+}
+
+std::string sampleOutputPath(const std::string& kind, const std::string& dir) {
+    return dir + "/out." + (kind == "video" ? "rgb" : kind);
+}
+
+bool writeSample(const std::string& kind, const std::string& dir, CarrierSample& sample, const RawBytes& raw) {
+    ImageFormat format;
+    if (parseImageFormat(kind, format)) {
+        return writeImageAs(sampleOutputPath(kind, dir).c_str(), format, raw.data(), sample.width, sample.height, sample.channels);
+    }
+    if (kind == "wav") {
+        std::string codec = "pcm_s16le";
+        return writeAudio(sample.path.c_str(), sampleOutputPath(kind, dir).c_str(), raw.data(), raw.size(), sample.sampleRate, sample.audioChannels, codec);
+    }
+    FILE* fp = fopen(sampleOutputPath(kind, dir).c_str(), "wb");
+    bool ok = fp && fwrite(raw.data(), 1, raw.size(), fp) == raw.size();
+    if (fp)
+        fclose(fp);
+    return ok;
+}
+
+bool runCarrier(const std::string& kind, const std::string& dir, const BenchOptions& options, std::vector<StageResult>& results,
+                bool& verified, std::uint64_t& fileBytes) {
+    std::mt19937_64 rng(options.seed);
+    CarrierSample sample;
+    size_t rawSize = makeCarrier(kind, dir, options, rng, sample);
+    if (rawSize == 0) {
+        return false;
+    }
+
+    // payload sized so ciphertext + chunk table fill the requested share of the carrier
+    size_t capacity = rawSize / 4;
+    capacity -= std::min(capacity, 4 * chunkCount(capacity, CHUNK_SHIFT));
+    size_t fillBytes = static_cast<size_t>(capacity * options.fill);
+    size_t payloadSize = fillBytes > AES_BLOCK_SIZE ? fillBytes - AES_BLOCK_SIZE : 1;
+    std::vector<unsigned char> payload = randomBytes(payloadSize, rng);
+    std::uint64_t seedVal = rng() | 1;
+
+    std::string privateKey = dir + "/bench.pem", publicKey = dir + "/bench.pub";
+    if (!writeKeyPair(privateKey, publicKey)) {
+        return false;
+    }
+
+    const char* stageNames[] = { "read", "key_derivation", "encrypt", "checksum", "position_generation", "encode_lsb", "decode_file", "write" };
+    std::vector<StageResult> stages;
+    for (auto name : stageNames) {
+        StageResult result;
+        result.carrier = kind;
+        result.stage = name;
+        stages.push_back(result);
+    }
+
+    verified = true;
+    for (int it = 0; it < options.iterations; ++it) {
+        RawBytes raw;
+        std::vector<unsigned char> stream;
+        PositionTable pos;
+        unsigned char key[32], iv[16];
+
+        timeStage(stages[0], [&]() { readSample(kind, sample, raw); });
+        stages[0].bytes = raw.size();
+
+        timeStage(stages[1], [&]() {
+            std::vector<unsigned char> sec = computeSharedSecret(privateKey, publicKey);
+            deriveAesKeyAndIv(sec, key, iv);
+        });
+
+        // fixed key material keeps the ciphertext identical across runs
+        deriveAesKeyAndIv(std::vector<unsigned char>(32, static_cast<unsigned char>(options.seed)), key, iv);
+        timeStage(stages[2], [&]() {
+            FILE* input = fmemopen(payload.data(), payload.size(), "rb");
+            encryptStream(input, key, iv, stream);
+            fclose(input);
+        });
+        stages[2].bytes = payload.size();
+
+        timeStage(stages[3], [&]() {
+            std::vector<unsigned char> checksums = chunkChecksums(stream.data(), stream.size(), CHUNK_SHIFT);
+            stream.insert(stream.end(), checksums.begin(), checksums.end());
+        });
+        stages[3].bytes = stream.size();
+
+        timeStage(stages[4], [&]() { pos = entropyChannel(seedVal, stream.size() * std::uint64_t(4), DEFAULT_GENERATOR); });
+        stages[4].bytes = stream.size();
+
+        timeStage(stages[5], [&]() { encode_lsb(raw, stream, pos); });
+        stages[5].bytes = stream.size();
+
+        std::vector<unsigned char> extracted;
+        timeStage(stages[6], [&]() { extracted = decode_file(raw, pos); });
+        stages[6].bytes = stream.size();
+        verified = verified && extracted == stream;
+
+        timeStage(stages[7], [&]() { writeSample(kind, dir, sample, raw); });
+        stages[7].bytes = raw.size();
+    }
+
+    std::error_code ec;
+    fileBytes = std::filesystem::file_size(sampleOutputPath(kind, dir), ec);
+    results.insert(results.end(), stages.begin(), stages.end());
+    return true;
+}
+
+// positions/sec of every backend over the capacity of a --size-mb carrier; the
+// fingerprint (CRC32C of the table) has to match between builds for the portable ones
+void runGenerators(const BenchOptions& options, std::vector<GeneratorResult>& results) {
+    size_t positions = std::min<size_t>(static_cast<size_t>(options.sizeMB * 1024 * 1024), POSITION_NARROW_LIMIT);
+    for (unsigned char g = 0; g < GEN_COUNT; ++g) {
+        GeneratorResult result;
+        result.generator = generatorName(g);
+        result.positions = positions;
+        result.memoryBytes = positions * positionEntryBytes(positions) + generatorStateBytes(g);
+        for (int it = 0; it < options.iterations; ++it) {
+            PositionTable pos;
+            pos.narrow.resize(positions);
+            std::iota(pos.narrow.begin(), pos.narrow.end(), 0);
+            auto start = std::chrono::steady_clock::now();
+            shufflePositions(pos, options.seed, g);
+            auto stop = std::chrono::steady_clock::now();
+            result.ms.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+            result.fingerprint = crc32c(reinterpret_cast<const unsigned char*>(pos.narrow.data()), pos.narrow.size() * sizeof(std::uint32_t));
+        }
+        results.push_back(result);
+    }
+}
+
+// shuffle against block layout on one --size-mb carrier filled to --fill, the
+// difference grows once the carrier no longer fits in the last-level cache
+void runLayouts(const BenchOptions& options, std::vector<LayoutResult>& results) {
+    std::mt19937_64 rng(options.seed);
+    size_t carrierBytes = static_cast<size_t>(options.sizeMB * 1024 * 1024);
+    std::vector<unsigned char> carrier = randomBytes(carrierBytes, rng);
+    std::vector<unsigned char> stream = randomBytes(std::max<size_t>(1, static_cast<size_t>(carrierBytes * options.fill / 4)), rng);
+
+    for (bool block : { false, true }) {
+        LayoutResult result;
+        result.layout = block ? "block" : "shuffle";
+        result.positions = stream.size() * 4;
+        result.verified = true;
+        for (int it = 0; it < options.iterations; ++it) {
+            PositionTable pos;
+            std::vector<unsigned char> extracted;
+            auto t0 = std::chrono::steady_clock::now();
+            pos = entropyChannel(options.seed, result.positions, DEFAULT_GENERATOR, block);
+            auto t1 = std::chrono::steady_clock::now();
+            encode_lsb(carrier.data(), stream, pos);
+            auto t2 = std::chrono::steady_clock::now();
+            extracted = decode_file(carrier.data(), pos);
+            auto t3 = std::chrono::steady_clock::now();
+            result.generateMs.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+            result.embedMs.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+            result.extractMs.push_back(std::chrono::duration<double, std::milli>(t3 - t2).count());
+            result.verified = result.verified && extracted == stream;
+        }
+        results.push_back(result);
+    }
+}
+
+// --large-check: a sparse 6 GB carrier addressed through a wide position table
+// with every position past 4 GB, an in-place inversion of a wide table and a
+// trailer whose payload length needs more than 32 bits. Only the pages that
+// hold positions are ever touched, so it runs on machines with far less memory.
+const std::uint64_t LARGE_CARRIER_BYTES = std::uint64_t(6) << 30;
+const std::uint64_t LARGE_POSITION_BASE = std::uint64_t(4) << 30;
+
+void runLargeCheck(const BenchOptions& options, LargeCheckResult& result) {
+    void* mapping = mmap(NULL, LARGE_CARRIER_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED) {
+        result.status = "skipped: no address space";
+        return;
+    }
+    unsigned char* carrier = static_cast<unsigned char*>(mapping);
+    result.carrierBytes = LARGE_CARRIER_BYTES;
+
+    std::mt19937_64 rng(options.seed);
+    std::vector<unsigned char> stream = randomBytes(4096, rng);
+    PositionTable table;
+    table.wide.resize(stream.size() * 4);
+    std::uint64_t stride = (LARGE_CARRIER_BYTES - LARGE_POSITION_BASE) / table.wide.size();
+    for (size_t i = 0; i < table.wide.size(); ++i) {
+        table.wide[i] = LARGE_POSITION_BASE + i * stride + rng() % stride;
+    }
+    Xoshiro256 gen(options.seed);
+    fisherYates(table.wide, gen);
+    result.maxPosition = *std::max_element(table.wide.begin(), table.wide.end());
+
+    encode_lsb(carrier, stream, table);
+    bool ok = decode_file(carrier, table) == stream;
+    munmap(mapping, LARGE_CARRIER_BYTES);
+
+    for (int k = 0; k < 1024; ++k) {
+        ok = ok && boundedDraw64(gen, LARGE_CARRIER_BYTES) < LARGE_CARRIER_BYTES;
+    }
+
+    PositionTable permutation;
+    permutation.wide.resize(1 << 20);
+    std::iota(permutation.wide.begin(), permutation.wide.end(), 0);
+    fisherYates(permutation.wide, gen);
+    PositionTable inverse = permutation;
+    invertPositions(inverse);
+    for (size_t i = 0; ok && i < permutation.wide.size(); ++i) {
+        ok = inverse.wide[permutation.wide[i]] == i;
+    }
+
+    StegoTrailer trailer, parsed;
+    trailer.payloadLength = (std::uint64_t(5) << 30) + 3;
+    trailer.chunkShift = CHUNK_SHIFT;
+    trailer.encryptedSeed.assign(AES_BLOCK_SIZE, 0x5A);
+    std::vector<unsigned char> bytes = serializeTrailer(trailer);
+    ok = ok && parseTrailer(bytes.data(), parsed) && parsed.payloadLength == trailer.payloadLength
+         && positionEntryBytes(embeddedLength(parsed) * 4) == sizeof(std::uint64_t);
+    result.payloadLength = parsed.payloadLength;
+
+    result.status = ok ? "ok" : "mismatch";
+}
+
+void printResults(std::ostream& out, const BenchOptions& options, const std::vector<StageResult>& results,
+                  const std::vector<GeneratorResult>& generators, const std::vector<LayoutResult>& layouts,
+                  const std::vector<CarrierStatus>& carrierStatus, const LargeCheckResult& large) {
+    out << std::fixed << std::setprecision(3);
+    out << "{\n  \"config\": { \"size_mb\": " << options.sizeMB << ", \"fill\": " << options.fill
+        << ", \"iterations\": " << options.iterations << ", \"seed\": " << options.seed << " },\n";
+    out << "  \"buffer_pool\": { \"reused\": " << bufferPool().reused << ", \"huge_page_bytes\": " << bufferPool().hugePageBytes << " },\n";
+    out << "  \"carriers\": [";
+    for (size_t i = 0; i < carrierStatus.size(); ++i) {
+        out << (i ? ", " : " ") << "{ \"carrier\": \"" << carrierStatus[i].carrier << "\", \"status\": \""
+            << carrierStatus[i].status << "\", \"file_bytes\": " << carrierStatus[i].fileBytes << " }";
+    }
+    out << " ],\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const StageResult& r = results[i];
+        double p50 = percentile(r.ms, 50);
+        out << "    { \"carrier\": \"" << r.carrier << "\", \"stage\": \"" << r.stage << "\", \"bytes\": " << r.bytes
+            << ", \"mb_per_s\": " << (p50 > 0 && r.bytes > 0 ? r.bytes / 1e6 / (p50 / 1e3) : 0.0)
+            << ", \"p50_ms\": " << p50 << ", \"p90_ms\": " << percentile(r.ms, 90)
+            << ", \"p99_ms\": " << percentile(r.ms, 99) << ", \"max_ms\": " << percentile(r.ms, 100) << " }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n  \"generators\": [\n";
+    for (size_t i = 0; i < generators.size(); ++i) {
+        const GeneratorResult& g = generators[i];
+        double p50 = percentile(g.ms, 50);
+        out << "    { \"generator\": \"" << g.generator << "\", \"positions\": " << g.positions
+            << ", \"positions_per_s\": " << (p50 > 0 ? g.positions / (p50 / 1e3) : 0.0)
+            << ", \"memory_bytes\": " << g.memoryBytes << ", \"fingerprint\": \"" << std::hex << std::setw(8)
+            << std::setfill('0') << g.fingerprint << std::dec << std::setfill(' ') << "\""
+            << ", \"p50_ms\": " << p50 << ", \"max_ms\": " << percentile(g.ms, 100) << " }"
+            << (i + 1 < generators.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n  \"layouts\": [\n";
+    for (size_t i = 0; i < layouts.size(); ++i) {
+        const LayoutResult& l = layouts[i];
+        double embed = percentile(l.embedMs, 50), extract = percentile(l.extractMs, 50);
+        out << "    { \"layout\": \"" << l.layout << "\", \"positions\": " << l.positions
+            << ", \"verified\": " << (l.verified ? "true" : "false")
+            << ", \"generate_p50_ms\": " << percentile(l.generateMs, 50) << ", \"embed_p50_ms\": " << embed
+            << ", \"extract_p50_ms\": " << extract
+            << ", \"embed_mb_per_s\": " << (embed > 0 ? l.positions / 4 / 1e6 / (embed / 1e3) : 0.0)
+            << ", \"extract_mb_per_s\": " << (extract > 0 ? l.positions / 4 / 1e6 / (extract / 1e3) : 0.0) << " }"
+            << (i + 1 < layouts.size() ? ",\n" : "\n");
+    }
+    out << "  ],\n  \"large_check\": { \"status\": \"" << large.status << "\", \"carrier_bytes\": " << large.carrierBytes
+        << ", \"max_position\": " << large.maxPosition << ", \"payload_length\": " << large.payloadLength << " }\n}" << std::endl;
+}
+
+bool parseBenchArgs(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--carriers" && hasValue) {
+            options.carriers.clear();
+            std::stringstream list(argv[++i]);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                options.carriers.push_back(item);
+            }
+        } else if (arg == "--size-mb" && hasValue) {
+            options.sizeMB = std::stod(argv[++i]);
+        } else if (arg == "--fill" && hasValue) {
+            options.fill = std::stod(argv[++i]);
+        } else if (arg == "--iterations" && hasValue) {
+            options.iterations = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = std::stoull(argv[++i]);
+        } else if (arg == "--out" && hasValue) {
+            options.out = argv[++i];
+        } else if (arg == "--large-check") {
+            options.largeCheck = true;
+        } else {
+            std::cerr << "usage: rsteg_bench\n" << std::endl;
+            std::cerr << "          --carriers    [ png,qoi,webp,wav,video ]" << std::endl;
+            std::cerr << "          --size-mb     [ raw carrier size, default 16 ]" << std::endl;
+            std::cerr << "          --fill        [ payload share of capacity, default 0.9 ]" << std::endl;
+            std::cerr << "          --iterations  [ default 5 ]" << std::endl;
+            std::cerr << "          --seed        [ default 1 ]" << std::endl;
+            std::cerr << "          --out         [ json file, default stdout ]" << std::endl;
+            std::cerr << "          --large-check [ 64-bit addressing on a sparse 6 GB carrier ]" << std::endl;
+            return false;
+        }
+    }
+    return options.fill > 0 && options.fill <= 1 && options.sizeMB > 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseBenchArgs(argc, argv, options)) {
+        return 1;
+    }
+
+    // the pipeline's progress output would drown the report
+    NullBuffer nullBuffer;
+    std::streambuf* coutBuffer = std::cout.rdbuf(&nullBuffer);
+
+    std::string dir = (std::filesystem::temp_directory_path() / ("rsteg_bench_" + std::to_string(getpid()))).string();
+    std::filesystem::create_directories(dir);
+
+    bool ffmpeg = haveFfmpeg();
+    bool allVerified = true;
+    std::vector<StageResult> results;
+    std::vector<CarrierStatus> carrierStatus;
+    for (const auto& kind : options.carriers) {
+        ImageFormat format;
+        if (!parseImageFormat(kind, format) && kind != "wav" && kind != "video") {
+            carrierStatus.push_back({ kind, "unknown" });
+            continue;
+        }
+        if (kind == "wav" && !ffmpeg) {
+            carrierStatus.push_back({ kind, "skipped: ffmpeg not found" });
+            continue;
+        }
+#ifndef RSTEG_ENABLE_WEBP
+        if (kind == "webp") {
+            carrierStatus.push_back({ kind, "skipped: built without libwebp" });
+            continue;
+        }
+#endif
+        bool verified = false;
+        std::uint64_t fileBytes = 0;
+        if (!runCarrier(kind, dir, options, results, verified, fileBytes)) {
+            carrierStatus.push_back({ kind, "failed" });
+            allVerified = false;
+            continue;
+        }
+        carrierStatus.push_back({ kind, verified ? "ok" : "mismatch", fileBytes });
+        allVerified = allVerified && verified;
+    }
+
+    std::filesystem::remove_all(dir);
+    std::vector<GeneratorResult> generators;
+    runGenerators(options, generators);
+    std::vector<LayoutResult> layouts;
+    runLayouts(options, layouts);
+    for (const auto& layout : layouts) {
+        allVerified = allVerified && layout.verified;
+    }
+    LargeCheckResult large;
+    if (options.largeCheck) {
+        runLargeCheck(options, large);
+        allVerified = allVerified && large.status != "mismatch";
+    }
+    std::cout.rdbuf(coutBuffer);
+
+    if (options.out == "-") {
+        printResults(std::cout, options, results, generators, layouts, carrierStatus, large);
+    } else {
+        std::ofstream out(options.out);
+        if (!out.is_open()) {
+            std::cerr << "Error:    unable to write " << options.out << std::endl;
+            return 1;
+        }
+        printResults(out, options, results, generators, layouts, carrierStatus, large);
+    }
+
+    return allVerified ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// ffmpeg and ffprobe run as children on a pipe2 pipe, started with posix_spawn
+// through "sh -c exec ..." so the commands keep their quoting and the pid waited
+// on is ffmpeg itself. Both pipe ends are close-on-exec: a child never inherits
+// the stdin of another shard's encoder, which would keep that encoder from ever
+// seeing the end of its input. Pipes are grown to PIPE_BUFFER_SIZE so a frame
+// crosses in a few large transfers, and buffers that stay untouched until the
+// child exits are handed to the pipe with vmsplice instead of being copied.
+
+extern char** environ;
+
+const int PIPE_BUFFER_SIZE = 1 << 20;
+
+struct ChildPipe {
+    pid_t pid = -1;
+    int fd = -1;        // our end: the child's stdout, or its stdin when writing
+};
+
+// toChild connects the child's stdin to the pipe, otherwise its stdout
+bool spawnPipe(const std::string& cmd, bool toChild, ChildPipe& child) {
+    // a child that exits early fails the write with EPIPE instead of killing rsteg
+    static bool pipeSignalIgnored = std::signal(SIGPIPE, SIG_IGN) != SIG_ERR;
+    (void)pipeSignalIgnored;
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return false;
+    }
+#ifdef F_SETPIPE_SZ
+    fcntl(fds[0], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+    int childEnd = toChild ? fds[0] : fds[1];
+    int ourEnd = toChild ? fds[1] : fds[0];
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, childEnd, toChild ? STDIN_FILENO : STDOUT_FILENO);
+    std::string script = "exec " + cmd;
+    char* argv[] = { const_cast<char*>("sh"), const_cast<char*>("-c"), const_cast<char*>(script.c_str()), nullptr };
+    int error = posix_spawn(&child.pid, "/bin/sh", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(childEnd);
+    if (error != 0) {
+        close(ourEnd);
+        child.pid = -1;
+        return false;
+    }
+    child.fd = ourEnd;
+    return true;
+}
+
+// fills up to size bytes, less only at the end of the child's output
+size_t readPipe(int fd, unsigned char* buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = read(fd, buffer + total, size - total);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    return total;
+}
+
+// copies through the pipe, the buffer can be reused as soon as this returns
+bool writePipe(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// maps the pages into the pipe, the child may read them until it exits, so the
+// buffer must not change before waitChild. Falls back to write where vmsplice is missing
+bool splicePipe(int fd, const unsigned char* data, size_t size) {
+#ifdef __linux__
+    while (size > 0) {
+        struct iovec iov = { const_cast<unsigned char*>(data), size };
+        ssize_t n = vmsplice(fd, &iov, 1, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+            break;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+#endif
+    return writePipe(fd, data, size);
+}
+
+// closes our end and reaps the child: its exit status, -1 when it did not exit normally
+int waitChild(ChildPipe& child) {
+    if (child.fd >= 0) {
+        close(child.fd);
+        child.fd = -1;
+    }
+    if (child.pid < 0) {
+        return -1;
+    }
+    int status;
+    pid_t waited;
+    while ((waited = waitpid(child.pid, &status, 0)) < 0 && errno == EINTR) {}
+    child.pid = -1;
+    if (waited < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+// runs cmd to completion with its stdout collected, the exit status or -1
+int runCapture(const std::string& cmd, std::string& output) {
+    ChildPipe child;
+    if (!spawnPipe(cmd, false, child)) {
+        return -1;
+    }
+    output.clear();
+    char buffer[4096];
+    size_t n;
+    while ((n = readPipe(child.fd, reinterpret_cast<unsigned char*>(buffer), sizeof(buffer))) > 0) {
+        output.append(buffer, n);
+    }
+    return waitChild(child);
+}
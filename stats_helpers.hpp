@@ -0,0 +1,115 @@
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+// Per-run instrumentation behind --stats: wall and CPU time per stage, byte
+// counts and resource usage, written as a single JSON record.
+
+struct StageStats {
+    double wallMs = 0;
+    double cpuMs = 0;
+    size_t calls = 0;
+};
+
+struct RunStats {
+    std::string mode;
+    std::vector<std::string> order;
+    std::map<std::string, StageStats> stages;
+    std::mutex lock;
+
+    std::uint64_t payloadBytes = 0;
+    std::uint64_t embeddedBytes = 0;
+    std::uint64_t carrierBytes = 0;
+    std::uint64_t bytesIn = 0;
+    std::uint64_t bytesOut = 0;
+    size_t threads = 1;
+    size_t buffersReused = 0;
+    size_t hugePageBytes = 0;
+    std::uint64_t cacheHits = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // stages run on several workers add up, calls tells how many contributed
+    void record(const std::string& stage, double wallMs, double cpuMs) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (stages.find(stage) == stages.end()) {
+            order.push_back(stage);
+        }
+        StageStats& entry = stages[stage];
+        entry.wallMs += wallMs;
+        entry.cpuMs += cpuMs;
+        ++entry.calls;
+    }
+
+    void addBytes(std::uint64_t& counter, std::uint64_t n) {
+        std::lock_guard<std::mutex> guard(lock);
+        counter += n;
+    }
+
+    std::string toJson() {
+        std::lock_guard<std::mutex> guard(lock);
+        rusage self{}, children{};
+        getrusage(RUSAGE_SELF, &self);
+        getrusage(RUSAGE_CHILDREN, &children);
+        auto ms = [](const timeval& tv) { return tv.tv_sec * 1e3 + tv.tv_usec / 1e3; };
+        double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::ostringstream out;
+        out.setf(std::ios::fixed);
+        out.precision(3);
+        out << "{\"mode\": \"" << mode << "\", \"wall_ms\": " << wall << ", \"stages\": [";
+        for (size_t i = 0; i < order.size(); ++i) {
+            const StageStats& entry = stages[order[i]];
+            out << (i ? ", " : "") << "{\"stage\": \"" << order[i] << "\", \"wall_ms\": " << entry.wallMs
+                << ", \"cpu_ms\": " << entry.cpuMs << ", \"calls\": " << entry.calls << "}";
+        }
+        out << "], \"payload_bytes\": " << payloadBytes << ", \"embedded_bytes\": " << embeddedBytes
+            << ", \"carrier_bytes\": " << carrierBytes << ", \"bytes_in\": " << bytesIn << ", \"bytes_out\": " << bytesOut
+            << ", \"carrier_utilization\": " << (carrierBytes ? embeddedBytes * 4.0 / carrierBytes : 0.0)
+            << ", \"threads\": " << threads
+            << ", \"buffers_reused\": " << buffersReused << ", \"huge_page_bytes\": " << hugePageBytes
+            << ", \"cache_hits\": " << cacheHits
+            << ", \"cpu_user_ms\": " << ms(self.ru_utime) << ", \"cpu_sys_ms\": " << ms(self.ru_stime)
+            << ", \"children_cpu_ms\": " << ms(children.ru_utime) + ms(children.ru_stime)
+            << ", \"peak_rss_kb\": " << self.ru_maxrss << ", \"children_peak_rss_kb\": " << children.ru_maxrss << "}";
+        return out.str();
+    }
+};
+
+double threadCpuMs() {
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// records wall and CPU time of the enclosing scope (CPU of the calling thread only)
+class StageTimer {
+public:
+    StageTimer(RunStats& stats, const char* stage)
+        : stats(stats), stage(stage), wallStart(std::chrono::steady_clock::now()), cpuStart(threadCpuMs())
+#ifdef RSTEG_ENABLE_TRACE
+        , span(stage)
+#endif
+    {}
+
+    ~StageTimer() {
+        double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+        stats.record(stage, wall, threadCpuMs() - cpuStart);
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    RunStats& stats;
+    const char* stage;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart;
+#ifdef RSTEG_ENABLE_TRACE
+    TraceSpan span;
+#endif
+};
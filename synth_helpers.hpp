@@ -0,0 +1,89 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+// Synthetic carriers, payloads and keys for rsteg_bench and the round-trip tests.
+// Everything random comes from the caller's generator so runs are reproducible.
+
+bool haveFfmpeg() {
+    return system("ffmpeg -version > /dev/null 2>&1") == 0;
+}
+
+template <typename Bytes = std::vector<unsigned char>>
+Bytes randomBytes(size_t n, std::mt19937_64& rng) {
+    Bytes bytes(n);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        std::uint64_t v = rng();
+        memcpy(&bytes[i], &v, 8);
+    }
+    for (; i < n; ++i) {
+        bytes[i] = static_cast<unsigned char>(rng());
+    }
+    return bytes;
+}
+
+// 16-bit stereo PCM wav
+bool writeWav(const std::string& path, const std::vector<unsigned char>& pcm, int sampleRate, int channels) {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+    unsigned char header[44] = { 'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' };
+    putLE(&header[4], 36 + pcm.size(), 4);
+    putLE(&header[16], 16, 4);
+    putLE(&header[20], 1, 2);
+    putLE(&header[22], channels, 2);
+    putLE(&header[24], sampleRate, 4);
+    putLE(&header[28], sampleRate * channels * 2, 4);
+    putLE(&header[32], channels * 2, 2);
+    putLE(&header[34], 16, 2);
+    memcpy(&header[36], "data", 4);
+    putLE(&header[40], pcm.size(), 4);
+    bool ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header) &&
+              fwrite(pcm.data(), 1, pcm.size(), fp) == pcm.size();
+    return (fclose(fp) == 0) && ok;
+}
+
+bool writeKeyPair(const std::string& privatePath, const std::string& publicPath) {
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    EVP_PKEY* key = nullptr;
+    bool ok = ctx && EVP_PKEY_keygen_init(ctx) > 0 &&
+              EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) > 0 &&
+              EVP_PKEY_keygen(ctx, &key) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    if (!ok)
+        return false;
+
+    FILE* priv = fopen(privatePath.c_str(), "w");
+    FILE* pub = fopen(publicPath.c_str(), "w");
+    ok = priv && pub && PEM_write_PrivateKey(priv, key, NULL, NULL, 0, NULL, NULL) && PEM_write_PUBKEY(pub, key);
+    if (priv)
+        fclose(priv);
+    if (pub)
+        fclose(pub);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+// gradients with noise on a third of the pixels: compressible like a photo, unlike random bytes
+RawBytes syntheticPicture(int width, int height, std::mt19937_64& rng) {
+    RawBytes pixels(static_cast<size_t>(width) * height * 3);
+    unsigned char* px = pixels.data();
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x, px += 3) {
+            std::uint64_t noise = rng();
+            int jitter = noise % 3 == 0 ? static_cast<int>((noise >> 8) % 33) - 16 : 0;
+            px[0] = static_cast<unsigned char>(x * 255 / width + jitter);
+            px[1] = static_cast<unsigned char>(y * 255 / height + jitter);
+            px[2] = static_cast<unsigned char>((x + y) / 4 + jitter);
+        }
+    }
+    return pixels;
+}
@@ -0,0 +1,31 @@
+# cmake -P script, run at build time: asks rsteg_roundtrip for its cases and writes
+# one ctest per case into OUTPUT, which ctest includes. Cases with a stored baseline
+# are timed, they run alone.
+execute_process(COMMAND ${ROUNDTRIP} --list OUTPUT_VARIABLE listed RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${ROUNDTRIP} --list failed")
+endif()
+string(REPLACE "\n" ";" cases "${listed}")
+
+file(STRINGS ${BASELINES} baseline_lines REGEX "^[a-z]")
+set(perf_cases "")
+foreach(line ${baseline_lines})
+    string(REGEX MATCH "^[^ ]+" case ${line})
+    list(APPEND perf_cases ${case})
+endforeach()
+
+set(content "")
+foreach(case ${cases})
+    if(case STREQUAL "")
+        continue()
+    endif()
+    string(APPEND content "add_test(roundtrip_${case} \"${ROUNDTRIP}\" --rsteg \"${RSTEG}\" --work \"${WORK}\""
+                          " --baselines \"${BASELINES}\" --threshold ${THRESHOLD} ${case})\n")
+    list(FIND perf_cases ${case} perf)
+    if(perf EQUAL -1)
+        string(APPEND content "set_tests_properties(roundtrip_${case} PROPERTIES SKIP_RETURN_CODE 77 LABELS roundtrip TIMEOUT 600)\n")
+    else()
+        string(APPEND content "set_tests_properties(roundtrip_${case} PROPERTIES SKIP_RETURN_CODE 77 LABELS \"roundtrip;perf\" TIMEOUT 600 RUN_SERIAL TRUE)\n")
+    endif()
+endforeach()
+file(WRITE ${OUTPUT} "${content}")
@@ -0,0 +1,560 @@
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "io_helpers.hpp"
+#include "image_helpers.hpp"
+#include "lsb_rand.hpp"
+#include "aes_helpers.hpp"
+#include "trailer_helpers.hpp"
+#include "synth_helpers.hpp"
+
+// rsteg_roundtrip: one ctest case per run. The case builds its carriers, payload and
+// keys in its own scratch directory, runs the rsteg binary through enc and dec and
+// compares the payload byte for byte; some cases add update, probe, a cache hit or a
+// damaged container on the way (see Flow). Cases listed in the baselines file also have
+// their enc/dec throughput checked against it; RSTEG_RECORD_BASELINES=1 stores the
+// measured numbers instead.
+
+const int SKIPPED = 77;
+
+// payload sizes relative to the carrier's capacity
+const long long EXACT_CAPACITY = -1;
+const long long OVER_CAPACITY = -2;
+
+// what runs between and after enc and dec
+enum Flow {
+    ENC_DEC,        // enc, then dec
+    RECIPIENTS,     // enc for three recipients, every one decodes, a stranger is turned away
+    UPDATE,         // rsteg update swaps in a payload with a changed tail before dec
+    CACHE,          // enc twice with --cache, the second run has to hit
+    PROBE,          // rsteg probe tells the container from its clean carrier
+    RECOVER,        // a damaged container fails dec, --recover keeps the intact chunks
+};
+
+struct RoundTripCase {
+    std::string name;
+    std::string carrier;        // png qoi ppm bmp wav flac ffv1 x264
+    long long payload;          // bytes, or one of the capacity sizes above
+    int carriers;               // shards, enc and dec run one worker per carrier
+    std::string encArgs;
+    std::string decArgs;
+    std::string rejectWith;     // enc has to fail with this message
+    size_t rangeOffset;         // dec --range compares this slice only
+    size_t rangeLength;
+    Flow flow;
+
+    RoundTripCase(std::string name, std::string carrier, long long payload, int carriers = 1,
+                  std::string encArgs = "", std::string decArgs = "", std::string rejectWith = "",
+                  size_t rangeOffset = 0, size_t rangeLength = 0, Flow flow = ENC_DEC)
+        : name(std::move(name)), carrier(std::move(carrier)), payload(payload), carriers(carriers),
+          encArgs(std::move(encArgs)), decArgs(std::move(decArgs)), rejectWith(std::move(rejectWith)),
+          rangeOffset(rangeOffset), rangeLength(rangeLength), flow(flow) {}
+};
+
+const size_t KB = 1024, MB = 1024 * 1024;
+
+// tests/CMakeLists.txt registers one ctest per name printed by --list
+const std::vector<RoundTripCase> CASES = {
+    { "png_empty",      "png",  0,              1, "", "", "is empty, there is nothing to embed" },
+    { "png_tiny",       "png",  1 },
+    { "png_small",      "png",  16 * KB },
+    { "png_1m",         "png",  1 * MB },
+    { "png_4m",         "png",  4 * MB },
+    { "png_exact",      "png",  EXACT_CAPACITY },
+    { "png_over",       "png",  OVER_CAPACITY,  1, "", "", "insufficient container size" },
+    { "png_mt19937",    "png",  256 * KB,       1, "--prng mt19937" },
+    { "png_aes_ctr",    "png",  256 * KB,       1, "--prng aes-ctr" },
+    { "png_feistel",    "png",  256 * KB,       1, "--prng feistel" },
+    { "png_block",      "png",  1 * MB,         1, "--layout block" },
+    { "png_shards",     "png",  4 * MB,         3 },
+    { "png_tiled",      "png",  1 * MB,         1, "--max-memory 48M", "--max-memory 48M" },
+    { "png_range",      "png",  1 * MB,         1, "--prng feistel", "--range 300K:64K", "", 300 * KB, 64 * KB },
+    { "png_verify",     "png",  1 * MB,         1, "--verify" },
+    { "png_recipients", "png",  256 * KB,       1, "", "", "", 0, 0, RECIPIENTS },
+    { "png_update",     "png",  1 * MB,         1, "", "", "", 0, 0, UPDATE },
+    { "png_cache",      "png",  1 * MB,         1, "", "", "", 0, 0, CACHE },
+    { "png_probe",      "png",  256 * KB,       2, "", "", "", 0, 0, PROBE },
+    { "qoi_1m",         "qoi",  1 * MB },
+    { "ppm_4m",         "ppm",  4 * MB },
+    { "ppm_recover",    "ppm",  1 * MB,         1, "", "", "", 0, 0, RECOVER },
+    { "bmp_1m",         "bmp",  1 * MB },
+    { "bmp_update",     "bmp",  1 * MB,         1, "", "", "", 0, 0, UPDATE },
+    { "wav_1m",         "wav",  1 * MB },
+    { "wav_tiled",      "wav",  1 * MB,         1, "--max-memory 48M", "--max-memory 48M" },
+    { "flac_256k",      "flac", 256 * KB },
+    { "ffv1_1m",        "ffv1", 1 * MB },
+    { "ffv1_range",     "ffv1", 1 * MB,         1, "--prng feistel", "--range 300K:64K", "", 300 * KB, 64 * KB },
+    { "ffv1_audio",     "ffv1", 1 * MB,         1, "--audio-track" },
+    { "x264_1m",        "x264", 1 * MB },
+};
+
+struct Baseline {
+    double encMBps = 0;
+    double decMBps = 0;
+};
+
+bool needsFfmpeg(const std::string& carrier) {
+    return carrier == "wav" || carrier == "flac" || carrier == "ffv1" || carrier == "x264";
+}
+
+std::string shellQuoted(const std::string& path) {
+    return "'" + path + "'";
+}
+
+// the capacity rsteg computes: 4 positions per byte, less 4 bytes of checksum per chunk
+size_t capacityOf(size_t rawSize) {
+    size_t capacity = rawSize / 4;
+    return capacity - std::min(capacity, 4 * chunkCount(capacity, CHUNK_SHIFT));
+}
+
+// largest payload whose padded ciphertext still fits
+size_t exactPayload(size_t rawSize) {
+    return capacityOf(rawSize) / AES_BLOCK_SIZE * AES_BLOCK_SIZE - 1;
+}
+
+bool writePpm(const std::string& path, const RawBytes& pixels, int width, int height) {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp)
+        return false;
+    bool ok = fprintf(fp, "P6\n%d %d\n255\n", width, height) > 0 &&
+              fwrite(pixels.data(), 1, pixels.size(), fp) == pixels.size();
+    return (fclose(fp) == 0) && ok;
+}
+
+// 24-bit BI_RGB, bottom-up BGR rows padded to 4 bytes
+bool writeBmp(const std::string& path, const RawBytes& pixels, int width, int height) {
+    size_t rowBytes = (static_cast<size_t>(width) * 3 + 3) & ~size_t(3);
+    std::vector<unsigned char> file(54 + rowBytes * height, 0);
+    auto putLE = [&](size_t at, std::uint32_t value, int bytes) {
+        for (int b = 0; b < bytes; ++b)
+            file[at + b] = static_cast<unsigned char>(value >> (8 * b));
+    };
+    file[0] = 'B';
+    file[1] = 'M';
+    putLE(2, static_cast<std::uint32_t>(file.size()), 4);
+    putLE(10, 54, 4);
+    putLE(14, 40, 4);
+    putLE(18, width, 4);
+    putLE(22, height, 4);
+    putLE(26, 1, 2);
+    putLE(28, 24, 2);
+    putLE(34, static_cast<std::uint32_t>(rowBytes * height), 4);
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* src = pixels.data() + static_cast<size_t>(height - 1 - y) * width * 3;
+        unsigned char* dst = file.data() + 54 + y * rowBytes;
+        for (int x = 0; x < width; ++x) {
+            dst[3 * x] = src[3 * x + 2];
+            dst[3 * x + 1] = src[3 * x + 1];
+            dst[3 * x + 2] = src[3 * x];
+        }
+    }
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(file.data()), file.size());
+    return static_cast<bool>(out);
+}
+
+// a carrier with room for rawBytes of decoded data, -1 when the tools for it are missing
+int makeCarrier(const std::string& kind, const std::string& path, size_t rawBytes, std::mt19937_64& rng) {
+    const int width = 512;
+    int height = static_cast<int>((rawBytes + width * 3 - 1) / (width * 3));
+    if (kind == "png" || kind == "qoi" || kind == "ppm" || kind == "bmp") {
+        RawBytes pixels = syntheticPicture(width, height, rng);
+        if (kind == "ppm")
+            return writePpm(path, pixels, width, height) ? 1 : 0;
+        if (kind == "bmp")
+            return writeBmp(path, pixels, width, height) ? 1 : 0;
+        ImageFormat format = IMAGE_PNG;
+        if (!parseImageFormat(kind, format))
+            return 0;
+        return writeImageAs(path.c_str(), format, pixels.data(), width, height, 3) ? 1 : 0;
+    }
+
+    // 16-bit stereo: 4 bytes per sample
+    std::string wav = kind == "wav" ? path : path + ".wav";
+    if (kind == "wav" || kind == "flac") {
+        std::vector<unsigned char> pcm = randomBytes((rawBytes + 3) & ~size_t(3), rng);
+        if (!writeWav(wav, pcm, 44100, 2))
+            return 0;
+        if (kind == "wav")
+            return 1;
+        std::string cmd = "ffmpeg -v error -y -i " + shellQuoted(wav) + " -c:a flac " + shellQuoted(path);
+        return system(cmd.c_str()) == 0 ? 1 : 0;
+    }
+
+    // yuv420p frames with an audio track, rsteg copies the audio through
+    const size_t frameBytes = 320 * 240 * 3 / 2;
+    size_t frames = (rawBytes + frameBytes - 1) / frameBytes;
+    std::string codec = kind == "ffv1" ? "ffv1" : "libx264 -qp 0";
+    std::ostringstream cmd;
+    cmd << "ffmpeg -v error -y -f lavfi -i testsrc2=size=320x240:rate=25 -f lavfi -i sine=frequency=440"
+        << " -frames:v " << frames << " -pix_fmt yuv420p -c:v " << codec << " -c:a flac -shortest " << shellQuoted(path);
+    if (system(cmd.str().c_str()) != 0) {
+        std::cerr << "skipped: ffmpeg could not encode a " << kind << " carrier" << std::endl;
+        return -1;
+    }
+    return 1;
+}
+
+std::string carrierExtension(const std::string& kind) {
+    if (kind == "ffv1" || kind == "x264")
+        return ".mkv";
+    return "." + kind;
+}
+
+bool readFile(const std::string& path, std::vector<unsigned char>& data) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool writeFile(const std::string& path, const std::vector<unsigned char>& data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return static_cast<bool>(out);
+}
+
+bool logContains(const std::string& path, const std::string& text) {
+    std::ifstream log(path);
+    std::stringstream content;
+    content << log.rdbuf();
+    return content.str().find(text) != std::string::npos;
+}
+
+// flips the two low bits of bytes in the middle of the file, where a bitmap keeps its pixels
+bool damageMiddle(const std::string& path, size_t bytes) {
+    std::vector<unsigned char> data;
+    if (!readFile(path, data) || data.size() < 2 * bytes)
+        return false;
+    for (size_t i = data.size() / 2; i < data.size() / 2 + bytes; ++i)
+        data[i] ^= 0x03;
+    return writeFile(path, data);
+}
+
+// --recover zeroes the chunks it could not verify and keeps every other byte; a zeroed
+// last chunk takes the padding with it, so the output may run up to a block long
+bool zeroedOnlyWhereDamaged(const std::vector<unsigned char>& decoded, const std::vector<unsigned char>& expected) {
+    if (decoded.size() < expected.size() || decoded.size() > expected.size() + AES_BLOCK_SIZE)
+        return false;
+    bool damaged = false;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (decoded[i] != expected[i]) {
+            if (decoded[i] != 0)
+                return false;
+            damaged = true;
+        }
+    }
+    return damaged;
+}
+
+// runs rsteg and returns the wall time in seconds, negative when it failed
+double runTimed(const std::string& cmd) {
+    auto start = std::chrono::steady_clock::now();
+    int status = system(cmd.c_str());
+    auto stop = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(stop - start).count();
+    return status == 0 ? seconds : -seconds;
+}
+
+void printLog(const std::string& path) {
+    std::ifstream log(path);
+    std::cerr << log.rdbuf() << std::endl;
+}
+
+std::map<std::string, Baseline> readBaselines(const std::string& path) {
+    std::map<std::string, Baseline> baselines;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string name;
+        Baseline baseline;
+        if (fields >> name >> baseline.encMBps >> baseline.decMBps)
+            baselines[name] = baseline;
+    }
+    return baselines;
+}
+
+// rewrites this case's line, the other lines and the comments are kept as they are
+bool recordBaseline(const std::string& path, const std::string& name, const Baseline& measured) {
+    std::ifstream in(path);
+    std::ostringstream out;
+    std::string line;
+    bool replaced = false;
+    std::ostringstream entry;
+    entry << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1)
+          << std::setw(10) << measured.encMBps << std::setw(10) << measured.decMBps;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string first;
+        fields >> first;
+        if (first == name) {
+            out << entry.str() << "\n";
+            replaced = true;
+        } else {
+            out << line << "\n";
+        }
+    }
+    if (!replaced)
+        out << entry.str() << "\n";
+    in.close();
+    std::ofstream file(path, std::ios::trunc);
+    file << out.str();
+    return static_cast<bool>(file);
+}
+
+// slower than the baseline by more than threshold is a regression
+bool checkThroughput(const std::string& name, const char* stage, double measured, double baseline, double threshold) {
+    std::cout << name << " " << stage << ":   " << std::fixed << std::setprecision(1) << measured << " MB/s";
+    if (baseline <= 0 || threshold <= 0) {
+        std::cout << std::endl;
+        return true;
+    }
+    double change = (measured - baseline) / baseline;
+    std::cout << " (baseline " << baseline << " MB/s, " << std::showpos << change * 100 << std::noshowpos << "%)" << std::endl;
+    if (change < -threshold) {
+        std::cerr << "Error:    " << name << " " << stage << " throughput regressed more than "
+                  << threshold * 100 << "% below its baseline" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int runCase(const RoundTripCase& test, const std::string& rsteg, const std::string& workRoot,
+            const std::string& baselinePath, double threshold) {
+    if (needsFfmpeg(test.carrier) && !haveFfmpeg()) {
+        std::cerr << "skipped: ffmpeg not found" << std::endl;
+        return SKIPPED;
+    }
+    std::string dir = (std::filesystem::path(workRoot) / test.name).string();
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    std::filesystem::create_directories(dir);
+
+    // seeded by the case name, every run embeds the same payload into the same carriers
+    std::mt19937_64 rng(std::hash<std::string>()(test.name));
+    if (!writeKeyPair(dir + "/sender.pem", dir + "/sender.pub") ||
+        !writeKeyPair(dir + "/recipient.pem", dir + "/recipient.pub")) {
+        std::cerr << "Error:    unable to generate test keys" << std::endl;
+        return 1;
+    }
+
+    // carriers get room for the payload plus a margin, the capacity cases size the payload instead
+    const size_t exactRaw = 512 * 3 * 128;
+    size_t payloadBytes = test.payload >= 0 ? static_cast<size_t>(test.payload) : exactPayload(exactRaw)
+                          + (test.payload == OVER_CAPACITY ? 1 : 0);
+    size_t rawPerCarrier = test.payload >= 0 ? (payloadBytes / test.carriers) * 9 / 2 + 64 * KB : exactRaw;
+    std::vector<std::string> inputs;
+    for (int i = 0; i < test.carriers; ++i) {
+        std::string path = dir + "/carrier" + std::to_string(i) + carrierExtension(test.carrier);
+        int made = makeCarrier(test.carrier, path, rawPerCarrier, rng);
+        if (made < 0)
+            return SKIPPED;
+        if (made == 0) {
+            std::cerr << "Error:    unable to generate " << path << std::endl;
+            return 1;
+        }
+        inputs.push_back(path);
+    }
+    std::vector<unsigned char> payload = randomBytes(payloadBytes, rng);
+    std::string payloadPath = dir + "/payload.bin";
+    writeFile(payloadPath, payload);
+
+    // RECIPIENTS wraps the message key for two more key pairs, a third one is left out
+    std::string recipientArgs = " -rk " + shellQuoted(dir + "/recipient.pub");
+    if (test.flow == RECIPIENTS) {
+        for (const char* name : { "second", "third", "stranger" }) {
+            if (!writeKeyPair(dir + "/" + name + ".pem", dir + "/" + name + ".pub")) {
+                std::cerr << "Error:    unable to generate test keys" << std::endl;
+                return 1;
+            }
+        }
+        recipientArgs += " -rk " + shellQuoted(dir + "/second.pub") + " -rk " + shellQuoted(dir + "/third.pub");
+    }
+
+    std::string ext = carrierExtension(test.carrier);
+    std::string encCmd = shellQuoted(rsteg) + " enc";
+    for (auto& input : inputs)
+        encCmd += " -i " + shellQuoted(input);
+    encCmd += " -m " + shellQuoted(payloadPath) + recipientArgs + " -pk " + shellQuoted(dir + "/sender.pem")
+            + " -o " + shellQuoted(dir + "/out" + (test.carriers == 1 ? ext : "")) + " " + test.encArgs
+            + (test.flow == CACHE ? " --cache " + shellQuoted(dir + "/cache") : "")
+            + " > " + shellQuoted(dir + "/enc.log") + " 2>&1";
+    double encSeconds = runTimed(encCmd);
+    if (!test.rejectWith.empty()) {
+        if (encSeconds >= 0) {
+            std::cerr << "Error:    enc accepted a payload it has to reject" << std::endl;
+            return 1;
+        }
+        if (!logContains(dir + "/enc.log", test.rejectWith)) {
+            std::cerr << "Error:    enc did not fail with \"" << test.rejectWith << "\"" << std::endl;
+            printLog(dir + "/enc.log");
+            return 1;
+        }
+        std::cout << test.name << ":   rejected as expected" << std::endl;
+        std::filesystem::remove_all(dir, ec);
+        return 0;
+    }
+    if (encSeconds < 0) {
+        std::cerr << "Error:    enc failed" << std::endl;
+        printLog(dir + "/enc.log");
+        return 1;
+    }
+
+    std::vector<std::string> outputs;
+    for (int i = 0; i < test.carriers; ++i)
+        outputs.push_back(dir + (test.carriers == 1 ? "/out" : "/out_" + std::to_string(i)) + ext);
+    // dec as the named key pair into <log>.bin and <log>.log
+    auto decCommand = [&](const std::string& key, const std::string& args, const std::string& log) {
+        std::string cmd = shellQuoted(rsteg) + " dec";
+        for (auto& output : outputs)
+            cmd += " -i " + shellQuoted(output);
+        return cmd + " -rk " + shellQuoted(dir + "/sender.pub") + " -pk " + shellQuoted(dir + "/" + key + ".pem") + " -o - " + args
+               + " > " + shellQuoted(dir + "/" + log + ".bin") + " 2> " + shellQuoted(dir + "/" + log + ".log");
+    };
+
+    std::vector<unsigned char> expected = payload;
+    if (test.flow == CACHE && (runTimed(encCmd) < 0 || !logContains(dir + "/enc.log", "decoded carrier from cache"))) {
+        std::cerr << "Error:    the second enc did not take its carrier from the cache" << std::endl;
+        printLog(dir + "/enc.log");
+        return 1;
+    }
+    if (test.flow == UPDATE) {
+        // same length with a changed tail, the cheap case for update
+        for (size_t i = expected.size() - std::min(expected.size(), 4 * KB); i < expected.size(); ++i)
+            expected[i] ^= 0x5a;
+        writeFile(dir + "/update.bin", expected);
+        std::string cmd = shellQuoted(rsteg) + " update";
+        for (auto& output : outputs)
+            cmd += " -i " + shellQuoted(output);
+        cmd += " -m " + shellQuoted(dir + "/update.bin") + " -rk " + shellQuoted(dir + "/recipient.pub")
+             + " -pk " + shellQuoted(dir + "/sender.pem") + " > " + shellQuoted(dir + "/update.log") + " 2>&1";
+        if (system(cmd.c_str()) != 0) {
+            std::cerr << "Error:    update failed" << std::endl;
+            printLog(dir + "/update.log");
+            return 1;
+        }
+    }
+    if (test.flow == RECOVER) {
+        if (!damageMiddle(outputs.front(), 16)) {
+            std::cerr << "Error:    unable to damage " << outputs.front() << std::endl;
+            return 1;
+        }
+        if (system(decCommand("recipient", test.decArgs, "damaged").c_str()) == 0 ||
+            !logContains(dir + "/damaged.log", "corrupt chunk(s)")) {
+            std::cerr << "Error:    dec did not report the damaged chunks" << std::endl;
+            printLog(dir + "/damaged.log");
+            return 1;
+        }
+    }
+
+    double decSeconds = runTimed(decCommand("recipient", test.decArgs + (test.flow == RECOVER ? " --recover" : ""), "decoded"));
+    // a partial recovery still exits 1, its log tells it from a failed dec
+    if (test.flow == RECOVER && decSeconds < 0 && logContains(dir + "/decoded.log", "partially reconstructed"))
+        decSeconds = -decSeconds;
+    if (decSeconds < 0) {
+        std::cerr << "Error:    dec failed" << std::endl;
+        printLog(dir + "/decoded.log");
+        return 1;
+    }
+
+    std::vector<unsigned char> decoded;
+    readFile(dir + "/decoded.bin", decoded);
+    if (test.rangeLength != 0) {
+        expected.assign(expected.begin() + test.rangeOffset, expected.begin() + test.rangeOffset + test.rangeLength);
+    }
+    if (test.flow == RECOVER ? !zeroedOnlyWhereDamaged(decoded, expected) : decoded != expected) {
+        std::cerr << "Error:    " << test.name << " decoded " << decoded.size() << " bytes that differ from the "
+                  << expected.size() << " embedded" << std::endl;
+        return 1;
+    }
+
+    if (test.flow == RECIPIENTS) {
+        std::vector<unsigned char> third;
+        if (system(decCommand("third", test.decArgs, "third").c_str()) != 0 || !readFile(dir + "/third.bin", third) ||
+            third != expected) {
+            std::cerr << "Error:    the last recipient of the key table could not decode" << std::endl;
+            printLog(dir + "/third.log");
+            return 1;
+        }
+        if (system(decCommand("stranger", test.decArgs, "stranger").c_str()) == 0 ||
+            !logContains(dir + "/stranger.log", "not addressed to this key pair")) {
+            std::cerr << "Error:    dec accepted a key pair the container was not wrapped for" << std::endl;
+            printLog(dir + "/stranger.log");
+            return 1;
+        }
+    }
+    if (test.flow == PROBE) {
+        std::string cmd = shellQuoted(rsteg) + " probe";
+        for (auto& path : outputs)
+            cmd += " " + shellQuoted(path);
+        for (auto& path : inputs)
+            cmd += " " + shellQuoted(path);
+        cmd += " > " + shellQuoted(dir + "/probe.log") + " 2>&1";
+        std::string summary = std::to_string(outputs.size()) + " of " + std::to_string(outputs.size() + inputs.size())
+                            + " file(s) carry a rsteg trailer";
+        std::string shard = "shard " + std::to_string(outputs.size()) + "/" + std::to_string(outputs.size());
+        if (system(cmd.c_str()) != 0 || !logContains(dir + "/probe.log", summary) || !logContains(dir + "/probe.log", shard)) {
+            std::cerr << "Error:    probe did not tell the containers from their carriers" << std::endl;
+            printLog(dir + "/probe.log");
+            return 1;
+        }
+    }
+
+    std::filesystem::remove_all(dir, ec);
+    Baseline measured{ payloadBytes / 1e6 / encSeconds, expected.size() / 1e6 / decSeconds };
+    const char* record = getenv("RSTEG_RECORD_BASELINES");
+    if (record && std::string(record) == "1") {
+        recordBaseline(baselinePath, test.name, measured);
+        std::cout << test.name << ":   baseline recorded" << std::endl;
+        return 0;
+    }
+    std::map<std::string, Baseline> baselines = readBaselines(baselinePath);
+    Baseline baseline = baselines.count(test.name) ? baselines[test.name] : Baseline();
+    bool enc = checkThroughput(test.name, "enc", measured.encMBps, baseline.encMBps, threshold);
+    bool dec = checkThroughput(test.name, "dec", measured.decMBps, baseline.decMBps, threshold);
+    return enc && dec ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    std::string rsteg, work, baselines, name;
+    double threshold = 0.3;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--rsteg" && hasValue) {
+            rsteg = argv[++i];
+        } else if (arg == "--work" && hasValue) {
+            work = argv[++i];
+        } else if (arg == "--baselines" && hasValue) {
+            baselines = argv[++i];
+        } else if (arg == "--threshold" && hasValue) {
+            threshold = std::stod(argv[++i]);
+        } else if (arg == "--list") {
+            for (auto& test : CASES)
+                std::cout << test.name << std::endl;
+            return 0;
+        } else {
+            name = arg;
+        }
+    }
+
+    auto test = std::find_if(CASES.begin(), CASES.end(), [&](const RoundTripCase& c) { return c.name == name; });
+    if (rsteg.empty() || work.empty() || test == CASES.end()) {
+        std::cerr << "usage: rsteg_roundtrip\n" << std::endl;
+        std::cerr << "          --rsteg       [ rsteg binary ]" << std::endl;
+        std::cerr << "          --work        [ scratch directory ]" << std::endl;
+        std::cerr << "          --baselines   [ baselines file ]" << std::endl;
+        std::cerr << "          --threshold   [ allowed throughput drop, default 0.3 ]" << std::endl;
+        std::cerr << "          [ case ] or --list" << std::endl;
+        return 1;
+    }
+    return runCase(*test, rsteg, work, baselines, threshold);
+}
@@ -0,0 +1,165 @@
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// --max-memory: the carrier is streamed through a single tile buffer instead
+// of being decoded whole. The position table is inverted once so that it maps
+// carrier offset -> stream bit, then every tile embeds or extracts the bits
+// that fall into it while it is resident and is flushed exactly once.
+// TILE_BUFFERS tiles are in flight so decoding, embedding and encoding overlap.
+
+const size_t TILE_BUFFERS = 3;
+
+// accepts plain bytes or a K/M/G suffix, e.g. 512M
+bool parseMemorySize(const std::string& text, size_t& bytes) {
+    if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) {
+        return false;
+    }
+    size_t used = 0;
+    double value = 0;
+    try {
+        value = std::stod(text, &used);
+    } catch (const std::exception&) {
+        return false;
+    }
+    std::string suffix = text.substr(used);
+    double scale = 1;
+    if (suffix == "K" || suffix == "k")
+        scale = 1024.0;
+    else if (suffix == "M" || suffix == "m")
+        scale = 1024.0 * 1024;
+    else if (suffix == "G" || suffix == "g")
+        scale = 1024.0 * 1024 * 1024;
+    else if (!suffix.empty())
+        return false;
+    // the cast is undefined past SIZE_MAX, e.g. for 1e30G
+    if (!(value * scale < static_cast<double>(SIZE_MAX)))
+        return false;
+    bytes = static_cast<size_t>(value * scale);
+    return bytes > 0;
+}
+
+// memory a tiled shard holds besides its tile: the stream and 4 positions per stream byte
+size_t tiledFixedBytes(size_t streamBytes) {
+    return streamBytes + 4 * streamBytes * positionEntryBytes(4 * std::uint64_t(streamBytes));
+}
+
+// largest whole number of units per tile buffer that fits next to the fixed allocations,
+// 0 if not even one does. rawSize is SIZE_MAX for carriers probed without counting
+size_t tileSizeFor(size_t budget, size_t fixedBytes, size_t unit, size_t rawSize) {
+    if (unit == 0 || budget <= fixedBytes || (budget - fixedBytes) / TILE_BUFFERS < unit) {
+        return 0;
+    }
+    size_t tile = (budget - fixedBytes) / TILE_BUFFERS / unit * unit;
+    if (rawSize > SIZE_MAX - unit) {
+        return tile;
+    }
+    size_t whole = (rawSize + unit - 1) / unit * unit;
+    return std::max(unit, std::min(tile, whole));
+}
+
+// pos[i] = offset becomes pos[offset] = i, in place by walking every cycle once;
+// visited slots carry the top bit until the final pass
+template <typename Pos>
+void invertCycles(std::vector<Pos>& pos) {
+    const Pos mark = Pos(1) << (8 * sizeof(Pos) - 1);
+    for (size_t start = 0; start < pos.size(); ++start) {
+        if (pos[start] & mark)
+            continue;
+        Pos prev = static_cast<Pos>(start);
+        Pos cur = pos[start];
+        while (cur != static_cast<Pos>(start)) {
+            Pos next = pos[cur];
+            pos[cur] = prev | mark;
+            prev = cur;
+            cur = next;
+        }
+        pos[start] = prev | mark;
+    }
+    for (auto& p : pos) {
+        p &= ~mark;
+    }
+}
+
+void invertPositions(PositionTable& table) {
+    withPositions(table, [](auto& pos) { invertCycles(pos); });
+}
+
+// tile holds carrier bytes [offset, offset + length), inverse maps carrier offset -> stream bit pair
+void embedTile(unsigned char* tile, size_t offset, size_t length, const PositionTable& inverse, const std::vector<unsigned char>& stream) {
+    size_t end = std::min<std::uint64_t>(offset + length, inverse.size());
+    withPositions(inverse, [&](const auto& inv) {
+        for (size_t p = offset; p < end; ++p) {
+            std::uint64_t i = inv[p];
+            unsigned char bits = (stream[i >> 2] >> (6 - 2 * (i & 3))) & 0x03;
+            tile[p - offset] = (tile[p - offset] & 0xFC) | bits;
+        }
+    });
+}
+
+// stream has to be zeroed, bits are or-ed into place
+void extractTile(const unsigned char* tile, size_t offset, size_t length, const PositionTable& inverse, std::vector<unsigned char>& stream) {
+    size_t end = std::min<std::uint64_t>(offset + length, inverse.size());
+    withPositions(inverse, [&](const auto& inv) {
+        for (size_t p = offset; p < end; ++p) {
+            std::uint64_t i = inv[p];
+            stream[i >> 2] |= (tile[p - offset] & 0x03) << (6 - 2 * (i & 3));
+        }
+    });
+}
+
+// --check for tiled runs, bit pairs in the tile that disagree with the stream
+size_t verifyTile(const unsigned char* tile, size_t offset, size_t length, const PositionTable& inverse, const std::vector<unsigned char>& stream) {
+    size_t errors = 0;
+    size_t end = std::min<std::uint64_t>(offset + length, inverse.size());
+    withPositions(inverse, [&](const auto& inv) {
+        for (size_t p = offset; p < end; ++p) {
+            std::uint64_t i = inv[p];
+            errors += (tile[p - offset] & 0x03) != ((stream[i >> 2] >> (6 - 2 * (i & 3))) & 0x03);
+        }
+    });
+    return errors;
+}
+
+// hands tile buffers between the decode, embed and encode threads, in order
+class TileQueue {
+public:
+    void push(unsigned buffer, size_t length) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tiles.emplace_back(buffer, length);
+        }
+        ready.notify_one();
+    }
+
+    // false once the queue is closed and drained
+    bool pop(unsigned& buffer, size_t& length) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this]() { return closed || !tiles.empty(); });
+        if (tiles.empty()) {
+            return false;
+        }
+        buffer = tiles.front().first;
+        length = tiles.front().second;
+        tiles.pop_front();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::pair<unsigned, size_t>> tiles;
+    bool closed = false;
+};
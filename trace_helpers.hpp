@@ -0,0 +1,129 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped span tracing, dumped as Chrome trace JSON (chrome://tracing, Perfetto).
+// Configure with -DRSTEG_TRACE=ON to compile it in; otherwise RSTEG_TRACE_SCOPE
+// expands to nothing and the pipeline carries no tracing code at all.
+
+#ifdef RSTEG_ENABLE_TRACE
+
+struct TraceEvent {
+    const char* name;
+    std::uint64_t beginNs;
+    std::uint64_t endNs;
+};
+
+// single-writer ring per thread, the owning thread is the only one that writes
+struct TraceRing {
+    static const size_t CAPACITY = 1 << 16;
+    TraceEvent events[CAPACITY];
+    std::atomic<std::uint64_t> count{ 0 };
+    int tid = 0;
+    std::string name;
+
+    void push(const char* spanName, std::uint64_t beginNs, std::uint64_t endNs) {
+        std::uint64_t n = count.load(std::memory_order_relaxed);
+        events[n % CAPACITY] = TraceEvent{ spanName, beginNs, endNs };
+        count.store(n + 1, std::memory_order_release);
+    }
+};
+
+struct TraceRegistry {
+    std::mutex lock;
+    std::vector<TraceRing*> rings;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+};
+
+TraceRegistry& traceRegistry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+// rings are registered once per thread and kept alive until exit so a dump
+// after the workers joined still sees their events
+TraceRing& traceRing() {
+    thread_local TraceRing* ring = nullptr;
+    if (!ring) {
+        ring = new TraceRing();
+        TraceRegistry& registry = traceRegistry();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        ring->tid = static_cast<int>(registry.rings.size()) + 1;
+        registry.rings.push_back(ring);
+    }
+    return *ring;
+}
+
+std::uint64_t traceNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - traceRegistry().origin).count();
+}
+
+void traceThreadName(const std::string& name) {
+    traceRing().name = name;
+}
+
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name(name), beginNs(traceNowNs()) {}
+    ~TraceSpan() { traceRing().push(name, beginNs, traceNowNs()); }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    std::uint64_t beginNs;
+};
+
+bool traceDump(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "w");
+    if (!fp) {
+        return false;
+    }
+
+    TraceRegistry& registry = traceRegistry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (TraceRing* ring : registry.rings) {
+        if (!ring->name.empty()) {
+            fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", ring->tid, ring->name.c_str());
+            first = false;
+        }
+        std::uint64_t count = ring->count.load(std::memory_order_acquire);
+        std::uint64_t begin = count > TraceRing::CAPACITY ? count - TraceRing::CAPACITY : 0;
+        for (std::uint64_t n = begin; n < count; ++n) {
+            const TraceEvent& event = ring->events[n % TraceRing::CAPACITY];
+            fprintf(fp, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    first ? "" : ",\n", event.name, ring->tid, event.beginNs / 1e3, (event.endNs - event.beginNs) / 1e3);
+            first = false;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    return fclose(fp) == 0;
+}
+
+#define RSTEG_TRACE_CONCAT_INNER(a, b) a##b
+#define RSTEG_TRACE_CONCAT(a, b) RSTEG_TRACE_CONCAT_INNER(a, b)
+#define RSTEG_TRACE_SCOPE(name) TraceSpan RSTEG_TRACE_CONCAT(traceSpan, __LINE__)(name)
+#define RSTEG_TRACE_THREAD(name) traceThreadName(name)
+const bool TRACE_COMPILED_IN = true;
+
+#else
+
+#define RSTEG_TRACE_SCOPE(name) ((void)0)
+#define RSTEG_TRACE_THREAD(name) ((void)0)
+const bool TRACE_COMPILED_IN = false;
+
+bool traceDump(const std::string&) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "checksum_helpers.hpp"
+
+// Fixed 64-byte trailer appended after the container, all fields little-endian
+//
+//   offset  size  field
+//    0      4     magic "RSTG"
+//    4      1     version
+//    5      1     flags
+//    6      1     bit density (LSBs used per carrier byte)
+//    7      1     position generator id (PositionGenerator), 0 = mt19937
+//    8      8     payload length (ciphertext bytes)
+//   16      2     shard index
+//   18      2     shard count
+//   20      1     encrypted seed length
+//   21      1     checksum chunk size as log2, 0 when the stream has no chunk table
+//   22      2     reserved
+//   24     32     encrypted seed block
+//   56      4     length of variable data stored right before the trailer
+//   60      4     CRC32C of bytes 0..59
+//
+// The embedded stream is the ciphertext followed by the per-chunk CRC32C
+// table (see chunkChecksums). A reader only ever needs the last
+// TRAILER_SIZE bytes of a file to tell whether it is a stego container.
+//
+// Version 2 takes the position count from the embedded length (4 per stream
+// byte) and keeps the whole 64-bit seed for the generator. Version 1 packed the
+// count into the seed's low decimal digits, see unpackSeed.
+//
+// Version 3 is version 2 with meaningful flags. Containers without flags are
+// still written as version 2, older readers ignore the flags byte and would
+// decode a flagged container with the wrong positions, version 3 makes them
+// refuse it instead.
+//
+//   flag 0x01   block layout positions (see blockShufflePositions)
+//   flag 0x02   multi-recipient key table in the variable data (see wrapMessageKey)
+//   flag 0x04   a second shard in the audio track, its own trailer is the last
+//               TRAILER_SIZE bytes of the variable data, after the key table
+const size_t TRAILER_SIZE = 64;
+const unsigned char TRAILER_MAGIC[4] = { 'R', 'S', 'T', 'G' };
+const unsigned char TRAILER_VERSION = 3;
+const unsigned char TRAILER_FLAG_BLOCK_LAYOUT = 0x01;
+const unsigned char TRAILER_FLAG_KEY_TABLE = 0x02;
+const unsigned char TRAILER_FLAG_AUDIO_TRACK = 0x04;
+const unsigned char TRAILER_KNOWN_FLAGS = TRAILER_FLAG_BLOCK_LAYOUT | TRAILER_FLAG_KEY_TABLE | TRAILER_FLAG_AUDIO_TRACK;
+const size_t TRAILER_SEED_SIZE = 32;
+
+struct StegoTrailer {
+    unsigned char version = 2;
+    unsigned char flags = 0;
+    unsigned char bitDensity = 2;
+    unsigned char generator = GEN_MT19937;
+    std::uint64_t payloadLength = 0;
+    std::uint16_t shardIndex = 0;
+    std::uint16_t shardCount = 1;
+    unsigned char chunkShift = 0;
+    std::vector<unsigned char> encryptedSeed;
+    std::uint32_t extraLength = 0;
+};
+
+void putLE(unsigned char* out, std::uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+std::uint64_t getLE(const unsigned char* in, int bytes) {
+    std::uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+std::vector<unsigned char> serializeTrailer(const StegoTrailer& trailer) {
+    std::vector<unsigned char> bytes(TRAILER_SIZE, 0);
+    std::copy(TRAILER_MAGIC, TRAILER_MAGIC + 4, bytes.begin());
+    bytes[4] = trailer.version;
+    bytes[5] = trailer.flags;
+    bytes[6] = trailer.bitDensity;
+    bytes[7] = trailer.generator;
+    putLE(&bytes[8], trailer.payloadLength, 8);
+    putLE(&bytes[16], trailer.shardIndex, 2);
+    putLE(&bytes[18], trailer.shardCount, 2);
+    size_t seedLength = std::min(trailer.encryptedSeed.size(), TRAILER_SEED_SIZE);
+    bytes[20] = static_cast<unsigned char>(seedLength);
+    bytes[21] = trailer.chunkShift;
+    std::copy(trailer.encryptedSeed.begin(), trailer.encryptedSeed.begin() + seedLength, bytes.begin() + 24);
+    putLE(&bytes[56], trailer.extraLength, 4);
+    putLE(&bytes[60], crc32c(bytes.data(), 60), 4);
+    return bytes;
+}
+
+// validates magic, version and checksum before trusting any field
+bool parseTrailer(const unsigned char* bytes, StegoTrailer& trailer) {
+    if (!std::equal(TRAILER_MAGIC, TRAILER_MAGIC + 4, bytes)) {
+        return false;
+    }
+    if (bytes[4] == 0 || bytes[4] > TRAILER_VERSION) {
+        return false;
+    }
+    if (getLE(&bytes[60], 4) != crc32c(bytes, 60)) {
+        return false;
+    }
+    if (bytes[20] > TRAILER_SEED_SIZE || bytes[21] > 40) {
+        return false;
+    }
+
+    trailer.version = bytes[4];
+    trailer.flags = bytes[5];
+    trailer.bitDensity = bytes[6];
+    trailer.generator = bytes[7];
+    trailer.payloadLength = getLE(&bytes[8], 8);
+    trailer.shardIndex = static_cast<std::uint16_t>(getLE(&bytes[16], 2));
+    trailer.shardCount = static_cast<std::uint16_t>(getLE(&bytes[18], 2));
+    trailer.chunkShift = bytes[21];
+    trailer.encryptedSeed.assign(bytes + 24, bytes + 24 + bytes[20]);
+    trailer.extraLength = static_cast<std::uint32_t>(getLE(&bytes[56], 4));
+    return true;
+}
+
+// one seek and one TRAILER_SIZE read, independent of the container size
+bool readTrailer(const std::string& path, StegoTrailer& trailer) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    unsigned char bytes[TRAILER_SIZE];
+    bool found = fseek(fp, -static_cast<long>(TRAILER_SIZE), SEEK_END) == 0 &&
+                 fread(bytes, 1, TRAILER_SIZE, fp) == TRAILER_SIZE &&
+                 parseTrailer(bytes, trailer);
+    fclose(fp);
+
+    return found;
+}
+
+// the extraLength bytes stored before the trailer
+bool readTrailerExtra(const std::string& path, const StegoTrailer& trailer, std::vector<unsigned char>& extra) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    extra.resize(trailer.extraLength);
+    bool found = fseeko(fp, -static_cast<off_t>(TRAILER_SIZE + trailer.extraLength), SEEK_END) == 0 &&
+                 fread(extra.data(), 1, extra.size(), fp) == extra.size();
+    fclose(fp);
+
+    return found;
+}
+
+// key table part of the variable data, the audio track trailer follows it
+size_t keyTableLength(const StegoTrailer& trailer) {
+    size_t trackBytes = (trailer.flags & TRAILER_FLAG_AUDIO_TRACK) ? TRAILER_SIZE : 0;
+    return trailer.extraLength - std::min<size_t>(trailer.extraLength, trackBytes);
+}
+
+// the trailer of the shard in the audio track of a flag 0x04 container
+bool readAudioTrackTrailer(const std::string& path, StegoTrailer& trailer) {
+    StegoTrailer outer;
+    std::vector<unsigned char> extra;
+    return readTrailer(path, outer) && (outer.flags & TRAILER_FLAG_AUDIO_TRACK) && outer.extraLength >= TRAILER_SIZE &&
+           readTrailerExtra(path, outer, extra) && parseTrailer(extra.data() + extra.size() - TRAILER_SIZE, trailer);
+}
+
+// extra is the variable data, written right before the trailer that records its length
+bool appendTrailer(const std::string& path, const StegoTrailer& trailer, const std::vector<unsigned char>& extra = {}) {
+    FILE* fp = fopen(path.c_str(), "ab");
+    if (!fp) {
+        return false;
+    }
+
+    StegoTrailer withExtra = trailer;
+    withExtra.extraLength = static_cast<std::uint32_t>(extra.size());
+    std::vector<unsigned char> bytes = serializeTrailer(withExtra);
+    bool written = fwrite(extra.data(), 1, extra.size(), fp) == extra.size() &&
+                   fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+    written = (fclose(fp) == 0) && written;
+
+    return written;
+}
+
+// lowest version that describes the flags, see the version 3 note above
+unsigned char trailerVersionFor(unsigned char flags) {
+    return flags ? TRAILER_VERSION : 2;
+}
+
+// bytes actually embedded in the carrier: ciphertext plus the chunk checksum table
+std::uint64_t embeddedLength(const StegoTrailer& trailer) {
+    if (trailer.chunkShift == 0)
+        return trailer.payloadLength;
+    return trailer.payloadLength + 4 * chunkCount(trailer.payloadLength, trailer.chunkShift);
+}
@@ -0,0 +1,559 @@
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(RSTEG_ENABLE_URING) && defined(__linux__)
+#include <linux/io_uring.h>
+#endif
+
+// Asynchronous file I/O for payloads, carriers and outputs. AsyncReader keeps
+// ASYNC_SLOTS reads of ASYNC_SLOT_SIZE in flight ahead of the consumer and
+// AsyncWriter queues full slots while the caller fills the next one, so disk
+// time hides behind encryption, decoding and embedding. Requests go through an
+// io_uring driven by raw syscalls (no liburing) with the slots registered as
+// fixed buffers; without a ring (older kernels, seccomp, -DRSTEG_URING=OFF)
+// a small pread/pwrite thread pool serves the same queue. Files are opened
+// with O_DIRECT where the filesystem accepts it, slots are page aligned.
+
+const size_t ASYNC_SLOT_SIZE = size_t(1) << 20;
+const unsigned ASYNC_SLOTS = 4;
+const size_t DIRECT_IO_ALIGN = 4096;
+
+struct AsyncCompletion {
+    std::uint64_t tag = 0;
+    std::int64_t result = 0;   // bytes transferred, -errno on failure
+};
+
+// page-aligned slot buffers, what O_DIRECT and buffer registration both need
+class AlignedSlots {
+public:
+    explicit AlignedSlots(unsigned count) {
+        for (unsigned i = 0; i < count; ++i) {
+            void* p = nullptr;
+            if (posix_memalign(&p, DIRECT_IO_ALIGN, ASYNC_SLOT_SIZE) != 0)
+                p = nullptr;
+            slots.push_back(static_cast<unsigned char*>(p));
+        }
+    }
+    ~AlignedSlots() {
+        for (auto p : slots)
+            free(p);
+    }
+    AlignedSlots(const AlignedSlots&) = delete;
+    AlignedSlots& operator=(const AlignedSlots&) = delete;
+
+    bool valid() const { return std::find(slots.begin(), slots.end(), nullptr) == slots.end(); }
+    unsigned char* operator[](unsigned i) const { return slots[i]; }
+    unsigned count() const { return static_cast<unsigned>(slots.size()); }
+
+private:
+    std::vector<unsigned char*> slots;
+};
+
+// One submission/completion queue over a fixed set of slot buffers, used from a single thread
+class AsyncQueue {
+public:
+    AsyncQueue() = default;
+    ~AsyncQueue() { shutdown(); }
+    AsyncQueue(const AsyncQueue&) = delete;
+    AsyncQueue& operator=(const AsyncQueue&) = delete;
+
+    void init(const AlignedSlots& slots) {
+        for (unsigned i = 0; i < slots.count(); ++i)
+            buffers.push_back({ slots[i], ASYNC_SLOT_SIZE });
+#if defined(RSTEG_ENABLE_URING) && defined(__linux__)
+        if (setupRing())
+            return;
+#endif
+        startWorkers();
+    }
+
+    void read(int fd, unsigned slot, size_t length, std::uint64_t offset, std::uint64_t tag) {
+        submit(false, fd, slot, length, offset, tag);
+    }
+
+    void write(int fd, unsigned slot, size_t length, std::uint64_t offset, std::uint64_t tag) {
+        submit(true, fd, slot, length, offset, tag);
+    }
+
+    AsyncCompletion wait() {
+        std::unique_lock<std::mutex> guard(lock);
+#if defined(RSTEG_ENABLE_URING) && defined(__linux__)
+        if (completions.empty() && !ringTags.empty()) {
+            guard.unlock();
+            return reapRing();
+        }
+#endif
+        done.wait(guard, [this]() { return !completions.empty(); });
+        AsyncCompletion completion = completions.front();
+        completions.pop_front();
+        return completion;
+    }
+
+    bool usesRing() const { return ringFd >= 0 && !ringFailed; }
+
+private:
+    struct Request {
+        bool write;
+        int fd;
+        unsigned char* buffer;
+        size_t length;
+        std::uint64_t offset;
+        std::uint64_t tag;
+    };
+
+    void submit(bool write, int fd, unsigned slot, size_t length, std::uint64_t offset, std::uint64_t tag) {
+#if defined(RSTEG_ENABLE_URING) && defined(__linux__)
+        if (usesRing()) {
+            submitRing(write, fd, slot, length, offset, tag);
+            return;
+        }
+#endif
+        std::lock_guard<std::mutex> guard(lock);
+        requests.push_back({ write, fd, static_cast<unsigned char*>(buffers[slot].iov_base), length, offset, tag });
+        pending.notify_one();
+    }
+
+    void startWorkers() {
+        for (unsigned i = 0; i < 2; ++i)
+            workers.emplace_back([this]() { serve(); });
+    }
+
+    // thread pool fallback, a request is retried until it is complete or fails
+    void serve() {
+        for (;;) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                pending.wait(guard, [this]() { return stopping || !requests.empty(); });
+                if (requests.empty())
+                    return;
+                request = requests.front();
+                requests.pop_front();
+            }
+            std::int64_t total = 0;
+            while (total < static_cast<std::int64_t>(request.length)) {
+                ssize_t n = request.write
+                    ? pwrite(request.fd, request.buffer + total, request.length - total, request.offset + total)
+                    : pread(request.fd, request.buffer + total, request.length - total, request.offset + total);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0) {
+                    total = -errno;
+                    break;
+                }
+                if (n == 0)
+                    break;
+                total += n;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            completions.push_back({ request.tag, total });
+            done.notify_one();
+        }
+    }
+
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        pending.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+        workers.clear();
+#if defined(RSTEG_ENABLE_URING) && defined(__linux__)
+        closeRing();
+#endif
+    }
+
+#if defined(RSTEG_ENABLE_URING) && defined(__linux__)
+    void closeRing() {
+        if (ringFd >= 0) {
+            if (sqes != MAP_FAILED)
+                munmap(sqes, sqeBytes);
+            if (cqRing != MAP_FAILED && cqRing != sqRing)
+                munmap(cqRing, cqBytes);
+            if (sqRing != MAP_FAILED)
+                munmap(sqRing, sqBytes);
+            close(ringFd);
+            ringFd = -1;
+        }
+    }
+
+    bool setupRing() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, 2 * ASYNC_SLOTS, &params));
+        if (fd < 0)
+            return false;
+        ringFd = fd;
+
+        sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+            sqBytes = cqBytes = std::max(sqBytes, cqBytes);
+        sqRing = mmap(NULL, sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing : mmap(NULL, cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = mmap(NULL, sqeBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            closeRing();
+            return false;
+        }
+
+        unsigned char* sq = static_cast<unsigned char*>(sqRing);
+        unsigned char* cq = static_cast<unsigned char*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // fixed buffers skip the per-request page pinning, RLIMIT_MEMLOCK may refuse them
+        fixedBuffers = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) == 0;
+        return true;
+    }
+
+    void submitRing(bool write, int fd, unsigned slot, size_t length, std::uint64_t offset, std::uint64_t tag) {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes) + index;
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = fd;
+        sqe->off = offset;
+        sqe->user_data = tag;
+        if (fixedBuffers) {
+            sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->addr = reinterpret_cast<std::uint64_t>(buffers[slot].iov_base);
+            sqe->len = static_cast<std::uint32_t>(length);
+            sqe->buf_index = static_cast<std::uint16_t>(slot);
+        } else {
+            requestVecs[slot] = { buffers[slot].iov_base, length };
+            sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->addr = reinterpret_cast<std::uint64_t>(&requestVecs[slot]);
+            sqe->len = 1;
+        }
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        long submitted;
+        while ((submitted = syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, NULL, 0)) < 0 && errno == EINTR) {}
+        if (submitted == 1) {
+            ringTags.push_back(tag);
+            return;
+        }
+        // the kernel did not take the entry: take it back, fail the request, go on with the pool
+        int error = submitted < 0 ? errno : EAGAIN;
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        dropRing();
+        std::lock_guard<std::mutex> guard(lock);
+        completions.push_back({ tag, -static_cast<std::int64_t>(error) });
+    }
+
+    // only called with requests in flight on the ring; when the ring cannot be waited on
+    // any more, one of them is failed per call and later requests go to the pool
+    AsyncCompletion reapRing() {
+        for (;;) {
+            unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& cqe = cqes[head & cqMask];
+                AsyncCompletion completion{ cqe.user_data, cqe.res };
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                ringTags.erase(std::find(ringTags.begin(), ringTags.end(), completion.tag));
+                return completion;
+            }
+            if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+                AsyncCompletion completion{ ringTags.back(), -static_cast<std::int64_t>(errno) };
+                ringTags.pop_back();
+                dropRing();
+                return completion;
+            }
+        }
+    }
+
+    // the ring stays mapped until shutdown, requests still in it may complete
+    void dropRing() {
+        if (!ringFailed) {
+            ringFailed = true;
+            startWorkers();
+        }
+    }
+
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    void* sqes = MAP_FAILED;
+    size_t sqBytes = 0, cqBytes = 0, sqeBytes = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+    bool fixedBuffers = false;
+    iovec requestVecs[ASYNC_SLOTS];
+    std::vector<std::uint64_t> ringTags;   // submitted to the ring, not reaped yet
+#endif
+
+    int ringFd = -1;
+    bool ringFailed = false;
+    std::vector<iovec> buffers;
+    std::vector<std::thread> workers;
+    std::deque<Request> requests;
+    std::deque<AsyncCompletion> completions;
+    std::mutex lock;
+    std::condition_variable pending, done;
+    bool stopping = false;
+};
+
+// O_DIRECT only sticks where the filesystem supports it (not on tmpfs, for one)
+int openDirect(const std::string& path, int flags, bool& direct) {
+#ifdef O_DIRECT
+    int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+    if (fd >= 0) {
+        direct = true;
+        return fd;
+    }
+#endif
+    direct = false;
+    return open(path.c_str(), flags, 0644);
+}
+
+// unaligned requests (the tail of a file, the rest of a short read) go through a second,
+// buffered descriptor opened on first use; O_DIRECT is never toggled under requests in flight
+class PlainFd {
+public:
+    ~PlainFd() { close(); }
+
+    int get(int fd, bool direct, const std::string& path, int flags) {
+        if (!direct)
+            return fd;
+        if (plain < 0)
+            plain = open(path.c_str(), flags);
+        return plain;
+    }
+
+    void close() {
+        if (plain >= 0)
+            ::close(plain);
+        plain = -1;
+    }
+
+private:
+    int plain = -1;
+};
+
+// sequential read-ahead over a regular file, chunks come back in file order
+class AsyncReader {
+public:
+    AsyncReader() : slots(ASYNC_SLOTS), results(ASYNC_SLOTS, 0), inFlight(ASYNC_SLOTS, false) {}
+    ~AsyncReader() { close(); }
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    bool open(const std::string& path) {
+        struct stat st;
+        if (!slots.valid() || (fd = openDirect(path, O_RDONLY, direct)) < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            close();
+            return false;
+        }
+        filePath = path;
+        fileSize = static_cast<std::uint64_t>(st.st_size);
+        queue.init(slots);
+        for (unsigned i = 0; i < ASYNC_SLOTS; ++i)
+            submitNext();
+        return true;
+    }
+
+    // the previous chunk stays valid until the next call, false at the end or on error
+    bool next(const unsigned char*& data, size_t& length) {
+        if (returned != NONE) {
+            submitNext();
+            returned = NONE;
+        }
+        if (fd < 0 || readOffset >= fileSize)
+            return false;
+
+        unsigned slot = slotFor(readOffset);
+        while (inFlight[slot]) {
+            AsyncCompletion completion = queue.wait();
+            results[completion.tag] = completion.result;
+            inFlight[completion.tag] = false;
+        }
+        size_t expected = static_cast<size_t>(std::min<std::uint64_t>(ASYNC_SLOT_SIZE, fileSize - readOffset));
+        std::int64_t got = results[slot];
+        // a short read (another process truncating, odd filesystems) is finished synchronously
+        while (got >= 0 && static_cast<size_t>(got) < expected) {
+            ssize_t n = pread(plain.get(fd, direct, filePath, O_RDONLY), slots[slot] + got, expected - got, readOffset + got);
+            if (n <= 0)
+                break;
+            got += n;
+        }
+        if (got < 0 || static_cast<size_t>(got) < expected) {
+            error = true;
+            return false;
+        }
+
+        data = slots[slot];
+        length = expected;
+        readOffset += expected;
+        returned = slot;
+        return true;
+    }
+
+    std::uint64_t size() const { return fileSize; }
+    bool failed() const { return error; }
+
+    void close() {
+        while (fd >= 0 && std::find(inFlight.begin(), inFlight.end(), true) != inFlight.end()) {
+            inFlight[queue.wait().tag] = false;
+        }
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        plain.close();
+    }
+
+private:
+    static const unsigned NONE = ~0u;
+
+    unsigned slotFor(std::uint64_t offset) const { return static_cast<unsigned>((offset / ASYNC_SLOT_SIZE) % ASYNC_SLOTS); }
+
+    void submitNext() {
+        if (submitOffset >= fileSize)
+            return;
+        unsigned slot = slotFor(submitOffset);
+        size_t length = static_cast<size_t>(std::min<std::uint64_t>(ASYNC_SLOT_SIZE, fileSize - submitOffset));
+        // O_DIRECT wants the length aligned too, the read stops at the end of the file anyway
+        if (direct)
+            length = (length + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+        inFlight[slot] = true;
+        queue.read(fd, slot, length, submitOffset, slot);
+        submitOffset += ASYNC_SLOT_SIZE;
+    }
+
+    AlignedSlots slots;
+    AsyncQueue queue;
+    std::vector<std::int64_t> results;
+    std::vector<bool> inFlight;
+    int fd = -1;
+    PlainFd plain;
+    std::string filePath;
+    bool direct = false;
+    bool error = false;
+    std::uint64_t fileSize = 0;
+    std::uint64_t submitOffset = 0;
+    std::uint64_t readOffset = 0;
+    unsigned returned = NONE;
+};
+
+// write-behind into a new file: full slots are queued while the caller fills the next
+class AsyncWriter {
+public:
+    AsyncWriter() : slots(ASYNC_SLOTS), inFlight(ASYNC_SLOTS, false) {}
+    ~AsyncWriter() { close(); }
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+    bool open(const std::string& path) {
+        if (!slots.valid() || (fd = openDirect(path, O_WRONLY | O_CREAT | O_TRUNC, direct)) < 0) {
+            fd = -1;
+            return false;
+        }
+        filePath = path;
+        queue.init(slots);
+        return true;
+    }
+
+    bool write(const unsigned char* data, size_t length) {
+        while (fd >= 0 && !error && length > 0) {
+            size_t n = std::min(length, ASYNC_SLOT_SIZE - fill);
+            memcpy(slots[current] + fill, data, n);
+            fill += n;
+            data += n;
+            length -= n;
+            if (fill == ASYNC_SLOT_SIZE)
+                flushSlot();
+        }
+        return fd >= 0 && !error;
+    }
+
+    // the unaligned tail goes out synchronously without O_DIRECT once everything before it landed
+    bool close() {
+        if (fd < 0)
+            return !error;
+        drain();
+        if (fill > 0) {
+            expected[current] = fill;
+            offsets[current] = offset;
+            complete({ current, 0 });
+            offset += fill;
+            fill = 0;
+        }
+        plain.close();
+        error = (::close(fd) != 0) || error;
+        fd = -1;
+        return !error;
+    }
+
+private:
+    void flushSlot() {
+        inFlight[current] = true;
+        expected[current] = fill;
+        offsets[current] = offset;
+        queue.write(fd, current, fill, offset, current);
+        offset += fill;
+        fill = 0;
+        current = (current + 1) % ASYNC_SLOTS;
+        while (inFlight[current])
+            complete(queue.wait());
+    }
+
+    void drain() {
+        while (std::find(inFlight.begin(), inFlight.end(), true) != inFlight.end())
+            complete(queue.wait());
+    }
+
+    // a short write is finished synchronously
+    void complete(const AsyncCompletion& completion) {
+        unsigned slot = static_cast<unsigned>(completion.tag);
+        inFlight[slot] = false;
+        std::int64_t done = completion.result;
+        while (done >= 0 && static_cast<size_t>(done) < expected[slot]) {
+            ssize_t n = pwrite(plain.get(fd, direct, filePath, O_WRONLY), slots[slot] + done, expected[slot] - done, offsets[slot] + done);
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        error = error || done != static_cast<std::int64_t>(expected[slot]);
+    }
+
+    AlignedSlots slots;
+    AsyncQueue queue;
+    std::vector<bool> inFlight;
+    size_t expected[ASYNC_SLOTS] = {};
+    std::uint64_t offsets[ASYNC_SLOTS] = {};
+    int fd = -1;
+    PlainFd plain;
+    std::string filePath;
+    bool direct = false;
+    bool error = false;
+    std::uint64_t offset = 0;
+    size_t fill = 0;
+    unsigned current = 0;
+};